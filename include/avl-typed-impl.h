@@ -0,0 +1,349 @@
+/*
+ * Template body of a typed AVL tree, included once per key type by
+ * avl-typed.h. Before including it, define:
+ *   TYPED_NAME       prefix of the generated identifiers (e.g. avl_int)
+ *   TYPED_KEY        key type, stored by value inside the node
+ *   TYPED_CMP(a, b)  three-way comparison of two TYPED_KEY values
+ * To keep records out of line (key/value separation), also define:
+ *   TYPED_VALUE      record type: the node holds the key and a pointer to
+ *                    the record, which stays owned by the caller
+ *   TYPED_KEY_OF(v)  key of the record pointed to by 'v', e.g. a prefix
+ *   TYPED_TIE(a, b)  (optional) three-way comparison of two records whose
+ *                    keys are equal, needed when the key is only a prefix
+ * insert then takes a record, search and delete take a probe record and
+ * return the record found or removed (NULL if absent). A descent reads the
+ * small nodes only, down to the final tie, and moving a successor copies
+ * the key and the pointer, not the record.
+ * These macros are undefined at the end of this file.
+ */
+
+#include "typed-key.h"
+#include <stdbool.h>
+#include <stdlib.h>
+
+#define NODE TYPED_CAT(TYPED_NAME, node)
+#define SLAB TYPED_CAT(TYPED_NAME, slab)
+#define TREE TYPED_CAT(TYPED_NAME, tree)
+#define FN(suffix) TYPED_CAT(TYPED_NAME, suffix)
+#ifdef TYPED_VALUE
+#define RECORD TYPED_VALUE
+#else
+#define RECORD void /* keys only: the record arguments are NULL */
+#endif
+
+typedef struct NODE {
+    struct NODE *left;
+    struct NODE *right;
+    TYPED_KEY key;
+#ifdef TYPED_VALUE
+    TYPED_VALUE *value;
+#endif
+    signed char balance; /* Balance factor: left height - right height */
+} NODE;
+
+/* Three-way comparison of a probe with a node: keys first, then records */
+static inline int FN(order)(TYPED_KEY key, const RECORD *value, const NODE *node) {
+    int cmp = TYPED_CMP(key, node->key);
+#ifdef TYPED_TIE
+    if (cmp == 0)
+        cmp = TYPED_TIE(value, node->value);
+#else
+    (void)value;
+#endif
+    return cmp;
+}
+
+typedef struct SLAB {
+    struct SLAB *next;
+    NODE nodes[TYPED_SLAB_NODES];
+} SLAB;
+
+typedef struct {
+    NODE *root;
+    size_t count;
+    NODE *free_list; /* released nodes, linked through 'left' */
+    SLAB *slabs;
+    size_t slab_used;
+} TREE;
+
+/* Initialize an empty tree */
+static inline void FN(init)(TREE *tree) {
+    tree->root = NULL;
+    tree->count = 0;
+    tree->free_list = NULL;
+    tree->slabs = NULL;
+    tree->slab_used = TYPED_SLAB_NODES;
+}
+
+/* Release every node of the tree, which is left empty */
+static inline void FN(destroy)(TREE *tree) {
+    while (tree->slabs) {
+        SLAB *next = tree->slabs->next;
+        free(tree->slabs);
+        tree->slabs = next;
+    }
+    FN(init)(tree);
+}
+
+static inline NODE *FN(node_alloc)(TREE *tree) {
+    if (tree->free_list) {
+        NODE *node = tree->free_list;
+        tree->free_list = node->left;
+        return node;
+    }
+    if (tree->slab_used == TYPED_SLAB_NODES) {
+        SLAB *slab = malloc(sizeof(SLAB));
+        if (!slab)
+            return NULL;
+        slab->next = tree->slabs;
+        tree->slabs = slab;
+        tree->slab_used = 0;
+    }
+    return &tree->slabs->nodes[tree->slab_used++];
+}
+
+static inline NODE *FN(rotate_left)(NODE *root) {
+    NODE *right = root->right;
+    root->right = right->left;
+    right->left = root;
+    return right;
+}
+
+static inline NODE *FN(rotate_right)(NODE *root) {
+    NODE *left = root->left;
+    root->left = left->right;
+    left->right = root;
+    return left;
+}
+
+/* Rebalance a node whose balance reached +2 or -2, return the new root */
+static inline NODE *FN(fix_balance)(NODE *node) {
+    if (node->balance > 1) {
+        NODE *left = node->left;
+        if (left->balance >= 0) { /* simple rotation -> left left */
+            node->balance = 1 - left->balance;
+            left->balance = left->balance - 1;
+            return FN(rotate_right)(node);
+        }
+        NODE *pivot = left->right; /* double rotation -> left right */
+        node->balance = pivot->balance == 1 ? -1 : 0;
+        left->balance = pivot->balance == -1 ? 1 : 0;
+        pivot->balance = 0;
+        node->left = FN(rotate_left)(left);
+        return FN(rotate_right)(node);
+    } else {
+        NODE *right = node->right;
+        if (right->balance <= 0) { /* simple rotation -> right right */
+            node->balance = -1 - right->balance;
+            right->balance = right->balance + 1;
+            return FN(rotate_left)(node);
+        }
+        NODE *pivot = right->left; /* double rotation -> right left */
+        node->balance = pivot->balance == -1 ? 1 : 0;
+        right->balance = pivot->balance == 1 ? -1 : 0;
+        pivot->balance = 0;
+        node->right = FN(rotate_right)(right);
+        return FN(rotate_left)(node);
+    }
+}
+
+/* Insert 'key' while maintaining balance, return the new node
+   (NULL if duplicate or out of memory) */
+static inline NODE *FN(insert_node)(TREE *tree, TYPED_KEY key, RECORD *value) {
+    NODE **links[TYPED_MAX_DEPTH]; /* link leading to each node of the path */
+    bool went_left[TYPED_MAX_DEPTH];
+    int depth = 0;
+
+    NODE **link = &tree->root;
+    while (*link) {
+        NODE *cur = *link;
+        int cmp = FN(order)(key, value, cur);
+        if (cmp == 0)
+            return NULL;
+        links[depth] = link;
+        went_left[depth++] = cmp < 0;
+        link = cmp < 0 ? &cur->left : &cur->right;
+    }
+
+    NODE *node = FN(node_alloc)(tree);
+    if (!node)
+        return NULL;
+    node->left = NULL;
+    node->right = NULL;
+    node->key = key;
+#ifdef TYPED_VALUE
+    node->value = value;
+#else
+    (void)value;
+#endif
+    node->balance = 0;
+    *link = node;
+    tree->count++;
+
+    /* Retrace until the height change is absorbed */
+    for (int i = depth - 1; i >= 0; i--) {
+        NODE *p = *links[i];
+        p->balance += went_left[i] ? 1 : -1;
+        if (p->balance == 0)
+            break;
+        if (p->balance == 2 || p->balance == -2) {
+            *links[i] = FN(fix_balance)(p);
+            break;
+        }
+    }
+    return node;
+}
+
+/* Return the node of 'key', NULL if absent */
+static inline NODE *FN(search_node)(const TREE *tree, TYPED_KEY key, const RECORD *value) {
+    NODE *cur = tree->root;
+    while (cur) {
+        int cmp = FN(order)(key, value, cur);
+        if (cmp == 0)
+            return cur;
+        cur = cmp < 0 ? cur->left : cur->right;
+    }
+    return NULL;
+}
+
+/* Delete 'key' while maintaining balance, '*removed' gets its record.
+   Returns true if the key was present */
+static inline bool FN(delete_node)(TREE *tree, TYPED_KEY key, const RECORD *value,
+                                   RECORD **removed) {
+    NODE **links[TYPED_MAX_DEPTH];
+    bool went_left[TYPED_MAX_DEPTH];
+    int depth = 0;
+
+    NODE **link = &tree->root;
+    while (*link) {
+        int cmp = FN(order)(key, value, *link);
+        if (cmp == 0)
+            break;
+        links[depth] = link;
+        went_left[depth++] = cmp < 0;
+        link = cmp < 0 ? &(*link)->left : &(*link)->right;
+    }
+    NODE *z = *link;
+    if (!z)
+        return false;
+#ifdef TYPED_VALUE
+    *removed = z->value;
+#else
+    (void)removed;
+#endif
+
+    /* Two children: the successor's key moves into z, the successor goes */
+    NODE **victim = link;
+    if (z->left && z->right) {
+        links[depth] = link;
+        went_left[depth++] = false;
+        victim = &z->right;
+        while ((*victim)->left) {
+            links[depth] = victim;
+            went_left[depth++] = true;
+            victim = &(*victim)->left;
+        }
+        z->key = (*victim)->key;
+#ifdef TYPED_VALUE
+        z->value = (*victim)->value;
+#endif
+    }
+
+    NODE *gone = *victim;
+    *victim = gone->left ? gone->left : gone->right;
+    gone->left = tree->free_list;
+    tree->free_list = gone;
+    tree->count--;
+
+    /* Retrace while the subtree keeps getting shorter */
+    for (int i = depth - 1; i >= 0; i--) {
+        NODE *p = *links[i];
+        p->balance += went_left[i] ? -1 : 1;
+        if (p->balance == 1 || p->balance == -1)
+            break;
+        if (p->balance == 2 || p->balance == -2) {
+            NODE *sub = FN(fix_balance)(p);
+            *links[i] = sub;
+            if (sub->balance != 0)
+                break;
+        }
+    }
+    return true;
+}
+
+#ifdef TYPED_VALUE
+/**
+ * Insert the record 'value' under TYPED_KEY_OF(value), keeping the pointer.
+ * Returns true if insertion succeeds, false if duplicate or out of memory.
+ */
+static inline bool FN(insert)(TREE *tree, TYPED_VALUE *value) {
+    return FN(insert_node)(tree, TYPED_KEY_OF(value), value) != NULL;
+}
+
+/**
+ * Search for the record equal to 'probe'.
+ * Returns the stored record pointer if found, NULL otherwise.
+ */
+static inline TYPED_VALUE *FN(search)(const TREE *tree, const TYPED_VALUE *probe) {
+    NODE *node = FN(search_node)(tree, TYPED_KEY_OF(probe), probe);
+    return node ? node->value : NULL;
+}
+
+/**
+ * Delete the record equal to 'probe' while maintaining balance.
+ * Returns the record that was removed (for the caller to free), NULL if absent.
+ */
+static inline TYPED_VALUE *FN(delete)(TREE *tree, const TYPED_VALUE *probe) {
+    TYPED_VALUE *removed = NULL;
+    FN(delete_node)(tree, TYPED_KEY_OF(probe), probe, &removed);
+    return removed;
+}
+#else
+/**
+ * Insert 'key' while maintaining balance.
+ * Returns true if insertion succeeds, false if duplicate or out of memory.
+ */
+static inline bool FN(insert)(TREE *tree, TYPED_KEY key) {
+    return FN(insert_node)(tree, key, NULL) != NULL;
+}
+
+/**
+ * Search for 'key'.
+ * Returns a pointer to the stored key if found, NULL otherwise.
+ */
+static inline TYPED_KEY *FN(search)(const TREE *tree, TYPED_KEY key) {
+    NODE *node = FN(search_node)(tree, key, NULL);
+    return node ? &node->key : NULL;
+}
+
+/**
+ * Delete 'key' while maintaining balance.
+ * Returns true if the key was present.
+ */
+static inline bool FN(delete)(TREE *tree, TYPED_KEY key) {
+    return FN(delete_node)(tree, key, NULL, NULL);
+}
+#endif
+
+/* Return the number of keys, in constant time */
+static inline size_t FN(size)(const TREE *tree) { return tree->count; }
+
+/* Return the height of the tree (number of levels) */
+static inline size_t FN(height)(const TREE *tree) {
+    size_t height = 0;
+    for (NODE *cur = tree->root; cur; height++)
+        cur = cur->balance < 0 ? cur->right : cur->left;
+    return height;
+}
+
+#undef NODE
+#undef SLAB
+#undef TREE
+#undef FN
+#undef RECORD
+#undef TYPED_NAME
+#undef TYPED_KEY
+#undef TYPED_CMP
+#undef TYPED_VALUE
+#undef TYPED_KEY_OF
+#undef TYPED_TIE
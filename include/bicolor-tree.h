@@ -1,7 +1,8 @@
-#ifndef TREE_H
-#define TREE_H
+#ifndef BICOLOR_TREE_H
+#define BICOLOR_TREE_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 
 /* ============================
@@ -20,11 +21,81 @@ struct _BicolorTreeNode {
     Tree parent;
     Tree left;
     Tree right;
-    Color color;
+    unsigned int color : 1;    /* Color, shares a word with in_arena */
+    unsigned int in_arena : 1; /* Carved from an arena chunk, else malloc'ed */
+    unsigned int : 30;         /* Rest of the word: 'data' stays int aligned */
+#ifdef TREE_ORDER_STATISTICS
+    size_t count;  /* Nodes in the subtree rooted here */
+#endif
     char data[1];
 };
 
 
+
+/* ============================
+   Node Arena
+   ============================ */
+
+typedef struct _BicolorTreeArena *TreeArena;
+
+/*
+ * Every tree keeps its nodes in an arena. A tree started by an insertion
+ * into an empty tree, tree_from_sorted or a stream gets a private arena
+ * that holds its nodes and no others: tree_delete releases it in one step
+ * (after the 'delete' callbacks, if any), and it goes with the last node
+ * removed otherwise. Splitting or joining trees (tree_split, tree_join, the set
+ * operations, tree_set_left/right) shares their private arenas, which are
+ * then locked and released with their last node. Only tree_create nodes
+ * come from malloc.
+ * A private arena takes a whole 64 KiB chunk with its first node, so even a
+ * one-node tree costs 64 KiB: many small trees are cheaper built in one
+ * user arena (tree_arena_insert).
+ */
+
+/**
+ * Create an empty node arena, for the trees of one thread at a time.
+ * Nodes are carved from 64 KiB chunks, with one free list per payload
+ * size. A node finds its class from the header of its chunk, and goes back
+ * to that free list whichever tree releases it (node_delete, tree_delete,
+ * the set operations). No lock is taken: the parallel walks and set
+ * operations stay on the calling thread for trees of such an arena.
+ */
+TreeArena tree_arena_new();
+
+/**
+ * Create an empty node arena whose free lists are guarded by a lock, for
+ * trees shared between threads or run in parallel.
+ */
+TreeArena tree_arena_new_shared();
+
+/**
+ * Release every chunk of the arena at once, without visiting the nodes.
+ * The trees still holding nodes of the arena go with it; the arena stays
+ * usable for new trees. Only the nodes taken from the arena are released:
+ * a tree emptied of its last node leaves the arena (start it again with
+ * tree_arena_insert), and the nodes a tree gets from other trees through
+ * tree_join or the set operations must be freed with tree_delete.
+ */
+void tree_arena_clear(TreeArena arena);
+
+/**
+ * Clear the arena, then release the arena itself.
+ */
+void tree_arena_delete(TreeArena arena);
+
+/* Return the number of bytes held by the chunks of the arena */
+size_t tree_arena_memory(TreeArena arena);
+
+/**
+ * Insert data like tree_insert_sorted, taking the new node from 'arena'.
+ * This starts a tree in an arena: the later insertions, whatever function
+ * makes them, take their nodes from the arena of the tree's root, and
+ * 'arena' is ignored for a tree that already has nodes.
+ * Returns true if insertion succeeds, false if duplicate or out of memory.
+ */
+bool tree_arena_insert(TreeArena arena, Tree *ptree, const void *data, size_t size,
+                       int (*compare)(const void *, const void *));
+
 /**
  * Create a new empty tree.
  * Returns NULL.
@@ -34,6 +105,10 @@ Tree tree_new();
 /**
  * Recursively delete all nodes in the tree.
  * Optionally calls 'delete' on each node's data.
+ * A root (no parent) with a private arena releases it in one step, after
+ * calling 'delete' if provided. Otherwise, and always for a subtree, nodes
+ * from an arena go back to its free lists, the other nodes of the arena are
+ * left alone (tree_arena_clear releases them all at once).
  */
 void tree_delete(Tree tree, void (*delete)(void *));
 
@@ -75,7 +150,8 @@ Tree tree_get_left(Tree tree);
 Tree tree_get_right(Tree tree);
 void *tree_get_data(Tree tree);
 
-/* Set left child, right child, or data */
+/* Set left child, right child, or data.
+   With TREE_ORDER_STATISTICS, the ancestors of 'tree' keep their old counts */
 bool tree_set_left(Tree tree, Tree left);
 bool tree_set_right(Tree tree, Tree right);
 bool tree_set_data(Tree tree, const void *data, size_t size);
@@ -99,7 +175,7 @@ void tree_post_order(Tree tree, void (*func)(void *, void *), void *extra_data);
 /* Return tree height (number of levels) */
 size_t tree_height(Tree tree);
 
-/* Return total number of nodes in the tree */
+/* Return total number of nodes in the tree (O(1) with TREE_ORDER_STATISTICS) */
 size_t tree_size(Tree tree);
 
 /**
@@ -109,11 +185,621 @@ size_t tree_size(Tree tree);
 void *tree_search(Tree tree, const void *data,
                   int (*compare)(const void *, const void *));
 
+/* ============================
+   Order Statistics
+   ============================ */
+
+/*
+ * Built with TREE_ORDER_STATISTICS (CMake option of the same name), every
+ * node keeps the size of its subtree, updated by the rotations, and these
+ * queries descend a single path in O(log n). Otherwise they still work,
+ * counting subtrees as they go, in O(n).
+ */
+
+/* Return the number of keys smaller than 'data' */
+size_t tree_rank(Tree tree, const void *data,
+                 int (*compare)(const void *, const void *));
+
+/* Return the data of the key of rank 'index' (0 for the smallest), NULL past the end */
+void *tree_select(Tree tree, size_t index);
+
+/* Return the number of keys k with low <= k <= high */
+size_t tree_count_range(Tree tree, const void *low, const void *high,
+                        int (*compare)(const void *, const void *));
+
+/* ============================
+   Ordered Iteration
+   ============================ */
+
+/*
+ * A cursor is a node: read its key with tree_get_data() and step with
+ * iter_next()/iter_prev(), which follow the parent pointers, so a scan
+ * needs no stack and no callback and may stop at any point. A range scan
+ * costs O(log n + k) for k keys. A cursor stays valid until its own node
+ * is removed (see Node Handles).
+ */
+
+/* Return the node of the smallest (largest) key, NULL for an empty tree */
+Tree tree_first(Tree tree);
+Tree tree_last(Tree tree);
+
+/* Return the node of the first key k with k >= data, NULL if there is none */
+Tree tree_lower_bound(Tree tree, const void *data,
+                      int (*compare)(const void *, const void *));
+
+/* Return the node of the first key k with k > data, NULL if there is none */
+Tree tree_upper_bound(Tree tree, const void *data,
+                      int (*compare)(const void *, const void *));
+
+/* Return the node of the next (previous) key in order, NULL past the end */
+Tree iter_next(Tree node);
+Tree iter_prev(Tree node);
+
+/* ============================
+   Node Handles
+   ============================ */
+
+/*
+ * A handle is the node of a key. Nodes never move and their data is never
+ * copied to another node (a removal puts the successor's node in the place
+ * of the removed one), so a handle stays valid until its own key is
+ * removed. Read it with tree_get_data(), step it with iter_next() and
+ * iter_prev(), and update it in place with tree_set_data() as long as the
+ * key keeps its order.
+ */
+
 /**
- * Sort an array using a red-black tree.
- * Returns true on success, false if duplicate insertion fails.
+ * Insert like tree_insert_sorted and return the handle of 'data': the new
+ * node, or the node already holding an equal key ('inserted', optional,
+ * tells which). Returns NULL if allocation fails.
+ */
+Tree tree_insert_handle(Tree *ptree, const void *data, size_t size,
+                        int (*compare)(const void *, const void *),
+                        bool *inserted);
+
+/**
+ * Remove the node 'node' from the tree, without searching for its key.
+ * 'delete' function is called on node data if provided.
+ * Returns the handle of the next key, NULL if 'node' held the last one.
+ */
+Tree tree_erase_handle(Tree *ptree, Tree node, void (*delete)(void *));
+
+/* ============================
+   Operation Statistics
+   ============================ */
+
+/*
+ * Built with TREE_STATS (CMake option of the same name), the library counts
+ * the work done by the calling thread: rotations, comparator calls and the
+ * nodes visited by each search, insertion and deletion descent (batch
+ * operations count one operation per key). Otherwise the counting compiles
+ * to nothing and tree_stats() returns false.
+ */
+typedef struct {
+    uint64_t single_rotations;
+    uint64_t double_rotations;  /* counted once, not as two single ones */
+    uint64_t recolorings;       /* color changes made by the insert and delete fixups */
+    uint64_t comparisons;       /* comparator calls, by every function */
+    uint64_t searches;
+    uint64_t search_visits;     /* nodes visited, search_visits / searches is the mean path */
+    uint64_t inserts;
+    uint64_t insert_visits;
+    uint64_t deletes;
+    uint64_t delete_visits;
+} TreeStats;
+
+/* Copy the counters of the calling thread to 'stats' (zeros without TREE_STATS) */
+bool tree_stats(TreeStats *stats);
+
+/* Zero the counters of the calling thread */
+void tree_stats_reset(void);
+
+
+/**
+ * Sort an array using a red-black tree, in place. Equal elements are all kept,
+ * in their input order. Input already in order is detected in one pass of
+ * comparisons and left as is; other input is inserted element by element,
+ * in O(n log n), since tree_from_sorted needs sorted data. Reentrant.
+ * Returns true on success, false if allocation fails.
  */
 int tree_sort(void *array, size_t length, size_t size,
               int (*compare)(const void *, const void *));
 
+
+/**
+ * Build a red-black tree from 'length' elements of 'size' bytes sorted in
+ * strictly ascending order, in linear time and without comparisons.
+ * Only the incomplete last level is colored red.
+ * Returns the root, or NULL if the array is empty or allocation fails.
+ */
+Tree tree_from_sorted(const void *array, size_t length, size_t size);
+
+/**
+ * Build the same tree as tree_from_sorted, with all nodes taken from
+ * contiguous chunks of 'arena'.
+ */
+Tree tree_arena_from_sorted(TreeArena arena, const void *array, size_t length,
+                            size_t size);
+
+/**
+ * Insert 'count' elements of 'size' bytes stored back to back in 'data'.
+ * The batch is sorted first if needed, then each insertion starts from the
+ * node of the previous key rather than from the root.
+ * 'inserted' (optional) gets, per input element, true if it was inserted.
+ * Returns the number of inserted elements.
+ */
+size_t tree_insert_batch(Tree *ptree, const void *data, size_t count,
+                         size_t size,
+                         int (*compare)(const void *, const void *),
+                         bool *inserted);
+
+/**
+ * Search 'count' elements of 'size' bytes stored back to back in 'data',
+ * sharing the descents between neighbouring keys.
+ * 'found' (optional) gets, per input element, the data pointer or NULL.
+ * Returns the number of elements found.
+ */
+size_t tree_search_batch(Tree tree, const void *data, size_t count,
+                         size_t size,
+                         int (*compare)(const void *, const void *),
+                         void **found);
+
+/**
+ * Delete 'count' elements of 'size' bytes stored back to back in 'data',
+ * sharing the descents between neighbouring keys.
+ * 'delete' is called on node data if provided.
+ * 'deleted' (optional) gets, per input element, true if it was removed.
+ * Returns the number of deleted elements.
+ */
+size_t tree_delete_batch(Tree *ptree, const void *data, size_t count,
+                         size_t size, void (*delete)(void *),
+                         int (*compare)(const void *, const void *),
+                         bool *deleted);
+
+/* ============================
+   Finger Hints
+   ============================ */
+
+/*
+ * A hint is a node of the tree kept by the caller between calls, NULL
+ * for none. The hinted operations climb from it through the parent
+ * pointers only as far as the subtree that holds 'data', then descend,
+ * so a key d positions away from the hint costs O(log d) comparisons
+ * instead of O(log n): ascending or near-sorted keys are inserted and
+ * found in a few comparisons each. '*hint' is then moved to the node of
+ * 'data' (or, for a search miss, to the last node visited). A hint stays
+ * valid until its own node is removed.
+ */
+
+/* Search like tree_search, starting from '*hint' (from 'tree' if NULL) */
+void *tree_search_hint(Tree tree, Tree *hint, const void *data,
+                       int (*compare)(const void *, const void *));
+
+/* Insert like tree_insert_sorted, starting from '*hint' (from the root if NULL) */
+bool tree_insert_hint(Tree *ptree, Tree *hint, const void *data, size_t size,
+                      int (*compare)(const void *, const void *));
+
+/* ============================
+   Compact Tree
+   ============================ */
+
+/*
+ * Compact red-black tree: nodes live in a pool of large segments and refer to
+ * their children through 32-bit indices (0 means no child). There is no
+ * parent link and the color is packed in the top bit of the left index,
+ * so an int payload takes 12 bytes per node.
+ * Pointers returned by compact_tree_search stay valid until the next
+ * insertion, which may grow (move) the pool.
+ */
+typedef struct _BicolorCompactTree *CompactTree;
+
+/**
+ * Create an empty compact tree storing payloads of 'size' bytes.
+ * Returns NULL on allocation failure.
+ */
+CompactTree compact_tree_new(size_t size);
+
+/**
+ * Delete the tree and its pool.
+ * Optionally calls 'delete' on each node's data.
+ */
+void compact_tree_delete(CompactTree tree, void (*delete)(void *));
+
+/**
+ * Insert data into the compact tree while maintaining balance.
+ * Returns true if insertion succeeds, false if duplicate or out of memory.
+ */
+bool compact_tree_insert_sorted(CompactTree tree, const void *data,
+                                int (*compare)(const void *, const void *));
+
+/**
+ * Delete the node containing the given data.
+ * 'delete' function is called on node data if provided.
+ */
+void compact_node_delete(CompactTree tree, void *data, void (*delete)(void *),
+                         int (*compare)(const void *, const void *));
+
+/**
+ * Search for data in the compact tree using 'compare'.
+ * Returns pointer to the data if found, NULL otherwise.
+ */
+void *compact_tree_search(CompactTree tree, const void *data,
+                          int (*compare)(const void *, const void *));
+
+/**
+ * Apply 'func' to each node's data in in-order.
+ */
+void compact_tree_in_order(CompactTree tree, void (*func)(void *, void *),
+                           void *extra_data);
+
+/* Return the height of the compact tree (number of levels) */
+size_t compact_tree_height(CompactTree tree);
+
+/* Return the number of nodes, in constant time */
+size_t compact_tree_size(CompactTree tree);
+
+/* Return the number of bytes held by the node pool */
+size_t compact_tree_memory(CompactTree tree);
+
+/* ============================
+   Search Snapshot
+   ============================ */
+
+/*
+ * Read-only snapshot of a tree: the payloads are copied in Eytzinger
+ * (breadth-first) order into one cache-line aligned array, so that the
+ * children of slot k sit at 2k and 2k + 1 and a lookup needs no pointer.
+ * The snapshot does not follow later changes to the tree.
+ */
+typedef struct _BicolorTreeSnapshot *TreeSnapshot;
+
+/**
+ * Freeze 'tree' into a new snapshot holding a copy of every payload.
+ * The tree is left untouched and may be modified or freed afterwards.
+ * Returns NULL on allocation failure.
+ */
+TreeSnapshot tree_snapshot_new(Tree tree, size_t size);
+
+/* Free the snapshot (the payload copies are not passed to any callback) */
+void tree_snapshot_delete(TreeSnapshot snapshot);
+
+/**
+ * Search for data in the snapshot using 'compare'.
+ * The descent has no data-dependent branch and prefetches the levels
+ * below the current slot.
+ * Returns pointer to the payload copy if found, NULL otherwise.
+ */
+void *tree_snapshot_search(TreeSnapshot snapshot, const void *data,
+                           int (*compare)(const void *, const void *));
+
+/* Return the number of payloads held by the snapshot */
+size_t tree_snapshot_size(TreeSnapshot snapshot);
+
+/* ============================
+   Wide Int Snapshot
+   ============================ */
+
+/*
+ * Read-only snapshot of a tree of int payloads laid out as a static B-tree:
+ * every node holds WIDE_KEYS (16) sorted keys in one cache line and its 17
+ * children are found by index arithmetic. A lookup reads one line per level
+ * (5 levels for 1M keys) and ranks the probe against a whole node with an
+ * SSE2 or AVX2 kernel, chosen at run time, or a scalar loop elsewhere.
+ */
+typedef struct _BicolorTreeWide *TreeWide;
+
+/* Kernels used to rank a probe inside a wide node */
+typedef enum {
+    WIDE_SCALAR,
+    WIDE_SSE2,
+    WIDE_AVX2,
+} WideKernel;
+
+/**
+ * Freeze a tree whose payloads are int into a new wide snapshot.
+ * Returns NULL on allocation failure.
+ */
+TreeWide tree_wide_new(Tree tree);
+
+/* Free the wide snapshot */
+void tree_wide_delete(TreeWide wide);
+
+/**
+ * Search for 'key' in the wide snapshot.
+ * Returns pointer to the key if found, NULL otherwise.
+ */
+const int *tree_wide_search(TreeWide wide, int key);
+
+/* Return the number of keys held by the wide snapshot */
+size_t tree_wide_size(TreeWide wide);
+
+/* Return the kernel used by tree_wide_search, the fastest one by default */
+WideKernel tree_wide_kernel(void);
+
+/**
+ * Make tree_wide_search use 'kernel' (for benchmarking).
+ * Returns false, keeping the current kernel, if the CPU lacks it.
+ */
+bool tree_wide_use_kernel(WideKernel kernel);
+
+/* ============================
+   Front Cache
+   ============================ */
+
+/*
+ * Hash index in front of a tree for point lookups: open addressing over
+ * the payloads of the tree nodes, keyed by the caller's hash function, so
+ * a hot key is found without descending the tree. A bounded cache holds
+ * up to 'capacity' keys, admitted by the lookups that reach the tree and
+ * evicted with the CLOCK algorithm; a complete one (capacity 0) indexes
+ * every key and answers misses without the tree. Ordered operations use
+ * the tree itself. Insertions and removals must go through the cache
+ * while it is attached (lookups may still use tree_search); free it with
+ * or before the tree.
+ */
+typedef struct _BicolorTreeCache *TreeCache;
+
+/**
+ * Attach a new cache to 'tree' (a complete one indexes its keys now).
+ * 'hash' must agree with 'compare': equal keys, equal hashes.
+ * Returns NULL on allocation failure.
+ */
+TreeCache tree_cache_new(Tree tree, size_t capacity,
+                         size_t (*hash)(const void *),
+                         int (*compare)(const void *, const void *));
+
+/* Free the cache (the tree is left untouched) */
+void tree_cache_delete(TreeCache cache);
+
+/**
+ * Search for data through the cache, then in 'tree' on a miss (bounded).
+ * Returns pointer to the data in the tree if found, NULL otherwise.
+ */
+void *tree_cache_search(TreeCache cache, Tree tree, const void *data);
+
+/* Insert like tree_insert_sorted, keeping the cache coherent */
+bool tree_cache_insert(TreeCache cache, Tree *ptree, const void *data, size_t size);
+
+/* Delete like node_delete, keeping the cache coherent */
+void tree_cache_remove(TreeCache cache, Tree *ptree, void *data, void (*delete)(void *),
+                       size_t size);
+
+/* Return the number of keys indexed by the cache */
+size_t tree_cache_size(TreeCache cache);
+
+/* Return the share of tree_cache_search calls answered by the cache */
+double tree_cache_hit_rate(TreeCache cache);
+
+/* ============================
+   Concurrent Tree
+   ============================ */
+
+/*
+ * Thread-safe tree. The key range is cut into partitions, subtrees with
+ * their own writer lock and sequence counter (seqlock): writers to
+ * different partitions run in parallel, and a partition that grows past a
+ * few thousand keys is split in two at its root. Searches take no lock:
+ * they read optimistically and check the counter of their partition only,
+ * retrying if a writer of that partition got in the way, and falling back
+ * to its lock after repeated failures. Writers store the child links
+ * atomically, so such a read is not a data race. Nodes come from arenas
+ * owned by the tree and are only released when the tree is deleted, so a
+ * reader racing a deletion never touches freed memory. Payloads are copied
+ * out, since a node may be reused as soon as the search returns.
+ * 'compare' must cope with a payload being rewritten while it reads it
+ * (plain field comparisons do): such a read is discarded and retried.
+ */
+typedef struct _BicolorConcurrentTree *ConcurrentTree;
+
+/**
+ * Create a new empty concurrent tree of payloads of 'size' bytes.
+ * Returns NULL on allocation failure.
+ */
+ConcurrentTree concurrent_tree_new(size_t size);
+
+/**
+ * Delete the tree and all its nodes, no other thread may still use it.
+ * Optionally calls 'delete' on each node's data.
+ */
+void concurrent_tree_delete(ConcurrentTree tree, void (*delete)(void *));
+
+/**
+ * Insert data into the tree while maintaining balance.
+ * Returns true if insertion succeeds, false if duplicate or out of memory.
+ */
+bool concurrent_tree_insert_sorted(ConcurrentTree tree, const void *data,
+                                   int (*compare)(const void *, const void *));
+
+/**
+ * Delete the node containing the given data.
+ * 'delete' function is called on node data if provided.
+ */
+void concurrent_node_delete(ConcurrentTree tree, void *data, void (*delete)(void *),
+                            int (*compare)(const void *, const void *));
+
+/**
+ * Search for data without locking and copy the payload found into 'out'.
+ * Returns true if found, false otherwise ('out' is then left unspecified).
+ */
+bool concurrent_tree_search(ConcurrentTree tree, const void *data,
+                            int (*compare)(const void *, const void *), void *out);
+
+/* Return the number of nodes (takes each partition lock in turn) */
+size_t concurrent_tree_size(ConcurrentTree tree);
+
+/* ============================
+   Parallel Walks
+   ============================ */
+
+/*
+ * The parallel walks split the tree at its subtrees and hand them to a
+ * small work-stealing pool, started on first use. Callbacks run on several
+ * threads at once and must be thread-safe. The order of a walk is only
+ * kept along each path: a node is visited after (in-order, post-order) or
+ * before (pre-order) its own subtrees, never in a global sequence.
+ */
+
+/**
+ * Set the number of threads used by the parallel walks, the calling
+ * thread included (0, the default, means one per core, 1 runs them
+ * sequentially). Must not be called while a parallel walk is running.
+ */
+void tree_parallel_threads(unsigned threads);
+
+/* Return the number of nodes, counting subtrees in parallel */
+size_t tree_parallel_size(Tree tree);
+
+/* Parallel versions of the walks, see the ordering note above */
+void tree_parallel_pre_order(Tree tree, void (*func)(void *, void *), void *extra_data);
+void tree_parallel_in_order(Tree tree, void (*func)(void *, void *), void *extra_data);
+void tree_parallel_post_order(Tree tree, void (*func)(void *, void *), void *extra_data);
+
+/**
+ * Delete the tree like tree_delete, freeing subtrees in parallel.
+ */
+void tree_parallel_delete(Tree tree, void (*delete)(void *));
+
+/**
+ * Build the same tree as tree_from_sorted, building the two halves of
+ * large ranges on different threads.
+ */
+Tree tree_parallel_from_sorted(const void *array, size_t length, size_t size);
+
+/* ============================
+   Split, Join and Set Operations
+   ============================ */
+
+/*
+ * These functions take their trees apart and reuse the nodes: the trees
+ * passed in are consumed and only the returned ones remain valid.
+ * The set operations split one tree by the root of the other, recurse on
+ * both halves and join the results back, in O(m log(n/m + 1)) for sizes
+ * m <= n. The halves near the top run on the parallel walk pool (see
+ * tree_parallel_threads).
+ */
+
+/**
+ * Split 'tree' into the nodes smaller than 'data' ('left') and the larger
+ * ones ('right'). Returns the node holding 'data' as a one-node tree, or
+ * NULL if there is none.
+ */
+Tree tree_split(Tree tree, const void *data, int (*compare)(const void *, const void *),
+                Tree *left, Tree *right);
+
+/**
+ * Join 'left', the one-node tree 'node' and 'right', where every key of
+ * 'left' is smaller than the key of 'node', itself smaller than every key
+ * of 'right'. 'node' may come from tree_create or tree_split, or be NULL to
+ * concatenate the two trees. Returns the root of the joined tree.
+ */
+Tree tree_join(Tree left, Tree node, Tree right);
+
+/**
+ * Merge 'b' into 'a'. For keys present in both, the node of 'a' is kept
+ * and 'delete' (if provided) is called on the data of the other one.
+ * Returns the root of the result.
+ */
+Tree tree_union(Tree a, Tree b, void (*delete)(void *),
+                int (*compare)(const void *, const void *), size_t size);
+
+/**
+ * Keep the nodes of 'a' whose keys are also in 'b'. 'delete' is called on
+ * the data of every node dropped, from either tree.
+ */
+Tree tree_intersection(Tree a, Tree b, void (*delete)(void *),
+                       int (*compare)(const void *, const void *), size_t size);
+
+/**
+ * Keep the nodes of 'a' whose keys are not in 'b'. 'delete' is called on
+ * the data of every node dropped, from either tree.
+ */
+Tree tree_difference(Tree a, Tree b, void (*delete)(void *),
+                     int (*compare)(const void *, const void *), size_t size);
+
+/* ============================
+   Tree File
+   ============================ */
+
+/*
+ * On-disk copy of a tree that reopens without rebuilding it: the nodes are
+ * written in pre-order to one file, linked by file offsets, behind a header
+ * recording the tree kind, the payload size and the node count. Opening
+ * maps the file read-only and validates the header only, so it costs the
+ * same for any number of keys; pages are read on first use. Payloads are
+ * stored raw: they must not hold pointers. Needs mmap (POSIX).
+ */
+typedef struct _BicolorTreeFile *TreeFile;
+
+/**
+ * Write 'tree' with payloads of 'size' bytes to 'path'. The file is built
+ * next to 'path' and renamed over it once complete and synced.
+ * Returns false on I/O error or a full disk, leaving 'path' untouched.
+ */
+bool tree_file_write(Tree tree, size_t size, const char *path);
+
+/**
+ * Map the tree file at 'path'. Returns NULL if it cannot be mapped or if
+ * it was written by another tree kind, with another payload size, on a
+ * machine of another byte order, or is truncated.
+ */
+TreeFile tree_file_open(const char *path, size_t size);
+
+/* Unmap the file, the pointers returned by tree_file_search become invalid */
+void tree_file_close(TreeFile file);
+
+/**
+ * Search for data in the mapped tree using 'compare', like tree_search.
+ * Returns a pointer to the payload inside the read-only mapping, NULL if
+ * not found (or if a link of a damaged file points outside of it).
+ */
+void *tree_file_search(TreeFile file, const void *data,
+                       int (*compare)(const void *, const void *));
+
+/* Return the number of nodes in the file */
+size_t tree_file_size(TreeFile file);
+
+/* ============================
+   Tree Stream
+   ============================ */
+
+/*
+ * Checkpoint of a tree as its payloads in order, written and read through
+ * one 64 KiB chunk buffer, so that the only large allocation is the tree
+ * itself. Reading feeds tree_from_stream: the tree comes back balanced in
+ * linear time, without any insertion or temporary array. Payloads are
+ * stored raw: they must not hold pointers.
+ */
+typedef enum {
+    TREE_STREAM_RAW,          /* payloads copied as they are */
+    TREE_STREAM_DELTA_VARINT, /* int32/int64 payloads: varint of the gaps */
+} TreeStreamCodec;
+
+/**
+ * Build a tree from 'length' payloads of 'size' bytes in ascending order,
+ * each copied into 'data' by a call to 'next', in order. Returns NULL if
+ * 'next' returns false or on allocation failure.
+ */
+Tree tree_from_stream(size_t length, size_t size, bool (*next)(void *data, void *context),
+                      void *context);
+
+/**
+ * Write the payloads of 'tree' to 'path' in order. TREE_STREAM_DELTA_VARINT
+ * needs payloads of 4 or 8 bytes read as signed integers; it stores dense
+ * keys in about a byte each. As with tree_file_write, 'path' is replaced
+ * only once the new file is complete and synced.
+ * Returns false on I/O error or an unsupported codec and size.
+ */
+bool tree_stream_write(Tree tree, size_t size, const char *path, TreeStreamCodec codec);
+
+/**
+ * Read a tree written by tree_stream_write, by either tree library, into
+ * '*out' (NULL for an empty stream).
+ * Returns false, with '*out' set to NULL, if the file cannot be read, is
+ * truncated or damaged, or holds payloads of another size. Integer keys
+ * (TREE_STREAM_DELTA_VARINT) that do not strictly ascend count as damage.
+ * Raw payloads are trusted to be in ascending order, as tree_stream_write
+ * leaves them: the stream holds no comparison to check them with.
+ */
+bool tree_stream_read(const char *path, size_t size, Tree *out);
+
 #endif
@@ -0,0 +1,406 @@
+/*
+ * Template body of a typed red-black tree, included once per key type by
+ * bicolor-typed.h. Before including it, define:
+ *   TYPED_NAME       prefix of the generated identifiers (e.g. rb_int)
+ *   TYPED_KEY        key type, stored by value inside the node
+ *   TYPED_CMP(a, b)  three-way comparison of two TYPED_KEY values
+ * To keep records out of line (key/value separation), also define:
+ *   TYPED_VALUE      record type: the node holds the key and a pointer to
+ *                    the record, which stays owned by the caller
+ *   TYPED_KEY_OF(v)  key of the record pointed to by 'v', e.g. a prefix
+ *   TYPED_TIE(a, b)  (optional) three-way comparison of two records whose
+ *                    keys are equal, needed when the key is only a prefix
+ * insert then takes a record, search and delete take a probe record and
+ * return the record found or removed (NULL if absent). A descent reads the
+ * small nodes only, down to the final tie, and moving a successor copies
+ * the key and the pointer, not the record.
+ * These macros are undefined at the end of this file.
+ */
+
+#include "typed-key.h"
+#include <stdbool.h>
+#include <stdlib.h>
+
+#define NODE TYPED_CAT(TYPED_NAME, node)
+#define SLAB TYPED_CAT(TYPED_NAME, slab)
+#define TREE TYPED_CAT(TYPED_NAME, tree)
+#define FN(suffix) TYPED_CAT(TYPED_NAME, suffix)
+#ifdef TYPED_VALUE
+#define RECORD TYPED_VALUE
+#else
+#define RECORD void /* keys only: the record arguments are NULL */
+#endif
+
+typedef struct NODE {
+    struct NODE *left;
+    struct NODE *right;
+    TYPED_KEY key;
+#ifdef TYPED_VALUE
+    TYPED_VALUE *value;
+#endif
+    bool red;
+} NODE;
+
+/* Three-way comparison of a probe with a node: keys first, then records */
+static inline int FN(order)(TYPED_KEY key, const RECORD *value, const NODE *node) {
+    int cmp = TYPED_CMP(key, node->key);
+#ifdef TYPED_TIE
+    if (cmp == 0)
+        cmp = TYPED_TIE(value, node->value);
+#else
+    (void)value;
+#endif
+    return cmp;
+}
+
+typedef struct SLAB {
+    struct SLAB *next;
+    NODE nodes[TYPED_SLAB_NODES];
+} SLAB;
+
+typedef struct {
+    NODE *root;
+    size_t count;
+    NODE *free_list; /* released nodes, linked through 'left' */
+    SLAB *slabs;
+    size_t slab_used;
+} TREE;
+
+/* Initialize an empty tree */
+static inline void FN(init)(TREE *tree) {
+    tree->root = NULL;
+    tree->count = 0;
+    tree->free_list = NULL;
+    tree->slabs = NULL;
+    tree->slab_used = TYPED_SLAB_NODES;
+}
+
+/* Release every node of the tree, which is left empty */
+static inline void FN(destroy)(TREE *tree) {
+    while (tree->slabs) {
+        SLAB *next = tree->slabs->next;
+        free(tree->slabs);
+        tree->slabs = next;
+    }
+    FN(init)(tree);
+}
+
+static inline NODE *FN(node_alloc)(TREE *tree) {
+    if (tree->free_list) {
+        NODE *node = tree->free_list;
+        tree->free_list = node->left;
+        return node;
+    }
+    if (tree->slab_used == TYPED_SLAB_NODES) {
+        SLAB *slab = malloc(sizeof(SLAB));
+        if (!slab)
+            return NULL;
+        slab->next = tree->slabs;
+        tree->slabs = slab;
+        tree->slab_used = 0;
+    }
+    return &tree->slabs->nodes[tree->slab_used++];
+}
+
+#define IS_RED(n) ((n) && (n)->red)
+
+/* Make 'parent' (or the root when NULL) point to 'new' instead of 'old' */
+static inline void FN(replace_child)(TREE *tree, NODE *parent, NODE *old,
+                                     NODE *new) {
+    if (!parent)
+        tree->root = new;
+    else if (parent->left == old)
+        parent->left = new;
+    else
+        parent->right = new;
+}
+
+/* Rotate x under 'parent', return the node that took its place */
+static inline NODE *FN(rotate_left)(TREE *tree, NODE *parent, NODE *x) {
+    NODE *y = x->right;
+    x->right = y->left;
+    y->left = x;
+    FN(replace_child)(tree, parent, x, y);
+    return y;
+}
+
+static inline NODE *FN(rotate_right)(TREE *tree, NODE *parent, NODE *x) {
+    NODE *y = x->left;
+    x->left = y->right;
+    y->right = x;
+    FN(replace_child)(tree, parent, x, y);
+    return y;
+}
+
+/* Insert 'key' while maintaining red-black properties, return the new node
+   (NULL if duplicate or out of memory) */
+static inline NODE *FN(insert_node)(TREE *tree, TYPED_KEY key, RECORD *value) {
+    /* path[0] is NULL so that path[i - 1] is always the parent of path[i] */
+    NODE *path[TYPED_MAX_DEPTH + 2];
+    int depth = 0;
+    path[depth++] = NULL;
+
+    NODE *cur = tree->root;
+    int cmp = 0;
+    while (cur) {
+        cmp = FN(order)(key, value, cur);
+        if (cmp == 0)
+            return NULL;
+        path[depth++] = cur;
+        cur = cmp < 0 ? cur->left : cur->right;
+    }
+
+    NODE *node = FN(node_alloc)(tree);
+    if (!node)
+        return NULL;
+    node->left = NULL;
+    node->right = NULL;
+    node->key = key;
+#ifdef TYPED_VALUE
+    node->value = value;
+#else
+    (void)value;
+#endif
+    node->red = true;
+    tree->count++;
+
+    NODE *parent = path[depth - 1];
+    if (!parent)
+        tree->root = node;
+    else if (cmp < 0)
+        parent->left = node;
+    else
+        parent->right = node;
+    path[depth++] = node;
+
+    while (depth >= 3 && IS_RED(path[depth - 2])) {
+        NODE *x = path[depth - 1];
+        NODE *p = path[depth - 2];
+        NODE *g = path[depth - 3]; /* a red parent is never the root */
+        bool left_side = (p == g->left);
+        NODE *uncle = left_side ? g->right : g->left;
+
+        if (IS_RED(uncle)) {
+            p->red = false;
+            uncle->red = false;
+            g->red = true;
+            depth -= 2;
+        } else {
+            if (left_side && x == p->right)
+                p = FN(rotate_left)(tree, g, p);
+            else if (!left_side && x == p->left)
+                p = FN(rotate_right)(tree, g, p);
+
+            p->red = false;
+            g->red = true;
+            if (left_side)
+                FN(rotate_right)(tree, path[depth - 4], g);
+            else
+                FN(rotate_left)(tree, path[depth - 4], g);
+            break;
+        }
+    }
+
+    tree->root->red = false;
+    return node;
+}
+
+/* Return the node of 'key', NULL if absent */
+static inline NODE *FN(search_node)(const TREE *tree, TYPED_KEY key, const RECORD *value) {
+    NODE *cur = tree->root;
+    while (cur) {
+        int cmp = FN(order)(key, value, cur);
+        if (cmp == 0)
+            return cur;
+        cur = cmp < 0 ? cur->left : cur->right;
+    }
+    return NULL;
+}
+
+/* Delete 'key' while maintaining red-black properties, '*removed' gets its record.
+   Returns true if the key was present */
+static inline bool FN(delete_node)(TREE *tree, TYPED_KEY key, const RECORD *value,
+                                   RECORD **removed) {
+    NODE *path[TYPED_MAX_DEPTH + 3];
+    int depth = 0;
+    path[depth++] = NULL;
+
+    NODE *z = tree->root;
+    while (z) {
+        int cmp = FN(order)(key, value, z);
+        if (cmp == 0)
+            break;
+        path[depth++] = z;
+        z = cmp < 0 ? z->left : z->right;
+    }
+    if (!z)
+        return false;
+#ifdef TYPED_VALUE
+    *removed = z->value;
+#else
+    (void)removed;
+#endif
+
+    /* Two children: the successor's key moves into z, the successor goes */
+    NODE *victim = z;
+    if (z->left && z->right) {
+        path[depth++] = z;
+        victim = z->right;
+        while (victim->left) {
+            path[depth++] = victim;
+            victim = victim->left;
+        }
+        z->key = victim->key;
+#ifdef TYPED_VALUE
+        z->value = victim->value;
+#endif
+    }
+
+    NODE *x = victim->left ? victim->left : victim->right;
+    NODE *parent = path[depth - 1];
+    bool x_left = parent && parent->left == victim;
+    bool removed_red = victim->red;
+    FN(replace_child)(tree, parent, victim, x);
+    victim->left = tree->free_list;
+    tree->free_list = victim;
+    tree->count--;
+
+    if (removed_red)
+        return true;
+
+    /* x carries an extra black, path[depth - 1] is its parent */
+    while (depth > 1 && !IS_RED(x)) {
+        NODE *p = path[depth - 1];
+        NODE *s = x_left ? p->right : p->left;
+
+        if (IS_RED(s)) { /* Case 1 */
+            s->red = false;
+            p->red = true;
+            if (x_left)
+                FN(rotate_left)(tree, path[depth - 2], p);
+            else
+                FN(rotate_right)(tree, path[depth - 2], p);
+            path[depth - 1] = s; /* s now sits above p */
+            path[depth++] = p;
+            s = x_left ? p->right : p->left;
+        }
+
+        if (!IS_RED(s->left) && !IS_RED(s->right)) { /* Case 2 */
+            s->red = true;
+            x = p;
+            depth--;
+            x_left = depth > 1 && path[depth - 1]->left == x;
+        } else {
+            if (x_left && !IS_RED(s->right)) { /* Case 3 */
+                s->left->red = false;
+                s->red = true;
+                s = FN(rotate_right)(tree, p, s);
+            } else if (!x_left && !IS_RED(s->left)) {
+                s->right->red = false;
+                s->red = true;
+                s = FN(rotate_left)(tree, p, s);
+            }
+
+            /* Case 4 */
+            s->red = p->red;
+            p->red = false;
+            if (x_left) {
+                if (s->right)
+                    s->right->red = false;
+                FN(rotate_left)(tree, path[depth - 2], p);
+            } else {
+                if (s->left)
+                    s->left->red = false;
+                FN(rotate_right)(tree, path[depth - 2], p);
+            }
+            x = tree->root;
+            break;
+        }
+    }
+    if (x)
+        x->red = false;
+    return true;
+}
+
+#ifdef TYPED_VALUE
+/**
+ * Insert the record 'value' under TYPED_KEY_OF(value), keeping the pointer.
+ * Returns true if insertion succeeds, false if duplicate or out of memory.
+ */
+static inline bool FN(insert)(TREE *tree, TYPED_VALUE *value) {
+    return FN(insert_node)(tree, TYPED_KEY_OF(value), value) != NULL;
+}
+
+/**
+ * Search for the record equal to 'probe'.
+ * Returns the stored record pointer if found, NULL otherwise.
+ */
+static inline TYPED_VALUE *FN(search)(const TREE *tree, const TYPED_VALUE *probe) {
+    NODE *node = FN(search_node)(tree, TYPED_KEY_OF(probe), probe);
+    return node ? node->value : NULL;
+}
+
+/**
+ * Delete the record equal to 'probe' while maintaining red-black properties.
+ * Returns the record that was removed (for the caller to free), NULL if absent.
+ */
+static inline TYPED_VALUE *FN(delete)(TREE *tree, const TYPED_VALUE *probe) {
+    TYPED_VALUE *removed = NULL;
+    FN(delete_node)(tree, TYPED_KEY_OF(probe), probe, &removed);
+    return removed;
+}
+#else
+/**
+ * Insert 'key' while maintaining red-black properties.
+ * Returns true if insertion succeeds, false if duplicate or out of memory.
+ */
+static inline bool FN(insert)(TREE *tree, TYPED_KEY key) {
+    return FN(insert_node)(tree, key, NULL) != NULL;
+}
+
+/**
+ * Search for 'key'.
+ * Returns a pointer to the stored key if found, NULL otherwise.
+ */
+static inline TYPED_KEY *FN(search)(const TREE *tree, TYPED_KEY key) {
+    NODE *node = FN(search_node)(tree, key, NULL);
+    return node ? &node->key : NULL;
+}
+
+/**
+ * Delete 'key' while maintaining red-black properties.
+ * Returns true if the key was present.
+ */
+static inline bool FN(delete)(TREE *tree, TYPED_KEY key) {
+    return FN(delete_node)(tree, key, NULL, NULL);
+}
+#endif
+
+/* Return the number of keys, in constant time */
+static inline size_t FN(size)(const TREE *tree) { return tree->count; }
+
+static inline size_t FN(subtree_height)(const NODE *node) {
+    if (!node)
+        return 0;
+    size_t left = FN(subtree_height)(node->left);
+    size_t right = FN(subtree_height)(node->right);
+    return 1 + (left > right ? left : right);
+}
+
+/* Return the height of the tree (number of levels) */
+static inline size_t FN(height)(const TREE *tree) {
+    return FN(subtree_height)(tree->root);
+}
+
+#undef IS_RED
+#undef NODE
+#undef SLAB
+#undef TREE
+#undef FN
+#undef RECORD
+#undef TYPED_NAME
+#undef TYPED_KEY
+#undef TYPED_CMP
+#undef TYPED_VALUE
+#undef TYPED_KEY_OF
+#undef TYPED_TIE
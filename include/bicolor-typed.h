@@ -0,0 +1,53 @@
+#ifndef BICOLOR_TYPED_H
+#define BICOLOR_TYPED_H
+
+#include "typed-key.h"
+
+/* ============================
+   Typed Red-Black Trees
+   ============================ */
+
+/*
+ * Specializations of the red-black tree with the key type and comparator
+ * fixed at compile time: keys are stored by value inside the nodes and
+ * every comparison is inlined. Each instance NAME provides the types
+ * NAME_tree / NAME_node and the functions NAME_init, NAME_destroy,
+ * NAME_insert, NAME_search, NAME_delete, NAME_size and NAME_height.
+ *
+ * Other key types can be generated the same way:
+ *   #define TYPED_NAME my_tree
+ *   #define TYPED_KEY double
+ *   #define TYPED_CMP(a, b) TYPED_CMP_NUM(a, b)
+ *   #include "bicolor-typed-impl.h"
+ *
+ * Large records can stay out of line: with TYPED_VALUE, TYPED_KEY_OF and
+ * TYPED_TIE (see bicolor-typed-impl.h) a node holds the key, or a prefix of
+ * it, and a pointer to the record, e.g. for the Hashmap entries of test.h:
+ *   #define TYPED_NAME rb_dico
+ *   #define TYPED_KEY TypedStrKey
+ *   #define TYPED_CMP(a, b) TYPED_CMP_STR(a, b)
+ *   #define TYPED_VALUE Hashmap
+ *   #define TYPED_KEY_OF(v) typed_str_key((v)->word)
+ *   #define TYPED_TIE(a, b) strcmp((a)->word, (b)->word)
+ *   #include "bicolor-typed-impl.h"
+ */
+
+/* rb_int: int keys */
+#define TYPED_NAME rb_int
+#define TYPED_KEY int
+#define TYPED_CMP(a, b) TYPED_CMP_NUM(a, b)
+#include "bicolor-typed-impl.h"
+
+/* rb_u64: uint64_t keys */
+#define TYPED_NAME rb_u64
+#define TYPED_KEY uint64_t
+#define TYPED_CMP(a, b) TYPED_CMP_NUM(a, b)
+#include "bicolor-typed-impl.h"
+
+/* rb_str: string keys reduced to a TYPED_STR_PREFIX byte prefix */
+#define TYPED_NAME rb_str
+#define TYPED_KEY TypedStrKey
+#define TYPED_CMP(a, b) TYPED_CMP_STR(a, b)
+#include "bicolor-typed-impl.h"
+
+#endif
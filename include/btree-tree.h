@@ -0,0 +1,86 @@
+#ifndef BTREE_TREE_H
+#define BTREE_TREE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* ============================
+   B+-Tree Types
+   ============================ */
+
+/*
+ * B+-tree: every payload lives in a leaf, inner nodes only hold copies of
+ * payloads used as separators. A node spans BTREE_NODE_BYTES (a few cache
+ * lines, adjacent lines are fetched together), so a search needs one node
+ * per level and the height stays around log(n) / log(fanout).
+ * Leaves are chained left to right for in-order traversal.
+ * Like Tree, an empty BTree is NULL: the first insertion creates it and
+ * deleting the last payload frees it.
+ */
+typedef struct _BTree *BTree;
+
+/* Bytes per node, raised for large payloads so that a node holds at least 4 */
+#ifndef BTREE_NODE_BYTES
+#define BTREE_NODE_BYTES 256
+#endif
+
+
+/* ============================
+   B+-Tree Operations
+   ============================ */
+
+/**
+ * Create a new empty B+-tree.
+ * Returns NULL.
+ */
+BTree btree_new();
+
+/**
+ * Delete all nodes in the tree.
+ * Optionally calls 'delete' on each payload (separator copies excluded).
+ */
+void btree_delete(BTree tree, void (*delete)(void *));
+
+/**
+ * Insert data into the B+-tree, splitting full nodes on the way back up.
+ * 'size' is the payload size, fixed by the first insertion.
+ * Returns true if insertion succeeds, false if duplicate or out of memory.
+ */
+bool btree_insert_sorted(BTree *ptree, const void *data, size_t size,
+                         int (*compare)(const void *, const void *));
+
+/**
+ * Delete the payload equal to the given data.
+ * Underfull nodes borrow from or merge with a sibling.
+ * 'delete' function is called on the payload if provided, once no
+ * separator of the inner nodes holds a copy of it any more.
+ */
+void btree_node_delete(BTree *ptree, void *data, void (*delete)(void *),
+                       int (*compare)(const void *, const void *), size_t size);
+
+/**
+ * Search for data in the tree using 'compare'.
+ * Returns pointer to the payload if found, NULL otherwise.
+ * The pointer stays valid until the next insertion or deletion.
+ */
+void *btree_search(BTree tree, const void *data,
+                   int (*compare)(const void *, const void *));
+
+/**
+ * Apply 'func' to each payload in in-order.
+ * 'extra_data' can be used as context.
+ */
+void btree_in_order(BTree tree, void (*func)(void *, void *), void *extra_data);
+
+/* Return the height of the tree (number of levels) */
+size_t btree_height(BTree tree);
+
+/* Return the number of payloads, in constant time */
+size_t btree_size(BTree tree);
+
+/* Return the number of payloads a leaf and an inner node can hold */
+size_t btree_leaf_capacity(BTree tree);
+size_t btree_inner_capacity(BTree tree);
+
+#endif
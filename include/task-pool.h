@@ -0,0 +1,61 @@
+#ifndef TASK_POOL_H
+#define TASK_POOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* ============================
+   Work-Stealing Task Pool
+   ============================ */
+
+/*
+ * Fork-join pool shared by the parallel tree walks. Each participant (the
+ * calling thread and the workers) owns a deque: it pushes and pops forked
+ * tasks at one end while idle participants steal from the other end.
+ * Waiting on a task never blocks: the waiter runs pending tasks until the
+ * one it waits for is done. Compiled into each tree library, not exported.
+ */
+#if defined(__GNUC__)
+#define TASK_POOL_API __attribute__((visibility("hidden")))
+#else
+#define TASK_POOL_API
+#endif
+
+/* A forked call, owned (usually on the stack) by the task that forks it */
+typedef struct {
+    void (*run)(void *);
+    void *arg;
+    int done;
+} Task;
+
+/**
+ * Make the calling thread a participant, starting the workers on first use.
+ * Returns false if the pool has a single participant or could not start:
+ * the caller then simply runs everything itself.
+ * Nested calls from a task are allowed; other threads wait their turn.
+ */
+TASK_POOL_API bool task_pool_enter(void);
+
+/* End the parallel section opened by a successful task_pool_enter */
+TASK_POOL_API void task_pool_leave(void);
+
+/* Queue 'task' so that another participant may run it (inside a section) */
+TASK_POOL_API void task_spawn(Task *task);
+
+/* Run queued tasks until 'task' is done */
+TASK_POOL_API void task_wait(Task *task);
+
+/* Number of participants, the calling thread included */
+TASK_POOL_API unsigned task_pool_size(void);
+
+/**
+ * Set the number of participants (0: one per core). Running workers are
+ * stopped and the new ones start with the next parallel section.
+ * Must not be called from inside a parallel section.
+ */
+TASK_POOL_API void task_pool_resize(unsigned threads);
+
+/* Fork depth giving a few tasks per participant on a balanced tree */
+TASK_POOL_API int task_pool_fork_depth(void);
+
+#endif
@@ -7,18 +7,39 @@
 #include <stdio.h>
 #include <time.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 typedef struct {
     char word[50];
     char definition[200];
 } Hashmap;
 
+/* Hardware performance counters read around each timed loop */
+enum {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_L1D_MISSES,    /* L1 data cache read misses */
+    PERF_LLC_MISSES,    /* last level cache read misses */
+    PERF_BRANCH_MISSES,
+    PERF_DTLB_MISSES,   /* data TLB read misses */
+    PERF_COUNTERS
+};
+
+/* Counts per operation, NAN for a counter that could not be read */
+typedef struct {
+    double value[PERF_COUNTERS];
+} PerfCounts;
+
 /* Structure to store performance results */
 typedef struct {
     size_t n;
     double insert_time;  /* Time to insert n elements (seconds) */
     double search_time;  /* Time to search n elements (seconds) */
     double delete_time;  /* Time to delete n elements (seconds) */
+    double snapshot_search_time; /* Time to search n elements in a snapshot (seconds) */
+    PerfCounts insert_perf;
+    PerfCounts search_perf;
+    PerfCounts delete_perf;
 } Result;
 
 /**
@@ -27,6 +48,96 @@ typedef struct {
  */
 int *unique_list(size_t size);
 
+/**
+ * Shuffle 'list' in place with a fixed seed, so that runs are comparable.
+ */
+void shuffle_list(int *list, size_t size);
+
+/**
+ * Return the next number of the xorshift64 generator whose state is '*state'
+ * (never 0). The generators below use fixed seeds: runs are comparable.
+ */
+uint64_t next_random(uint64_t *state);
+
+/**
+ * Create 'size' integers drawn uniformly from the whole int range, in random
+ * order. Duplicates are possible, as with real identifiers.
+ * Returns pointer to allocated array (must be freed by caller), or NULL on failure.
+ */
+int *uniform_list(size_t size);
+
+/**
+ * Create 'size' mostly ascending integers, like the keys of an append-mostly
+ * log: gaps of 1 to 4, each key moved by up to 8 positions, and one key in
+ * 32 drawn from the whole range instead (the noise).
+ * Returns pointer to allocated array (must be freed by caller), or NULL on failure.
+ */
+int *clustered_list(size_t size);
+
+/**
+ * Create 'size' Hashmap entries with distinct YCSB-style string keys
+ * ("user" and a scrambled number), in random order. The definition is
+ * filler text. Compare them with compare_dico.
+ * Returns pointer to allocated array (must be freed by caller), or NULL on failure.
+ */
+Hashmap *word_list(size_t size);
+
+/* Zipfian generator (YCSB): rank r of 'items' is drawn with a probability
+   proportional to 1 / (r + 1)^theta, and ranks are scattered over the items
+   by a hash, so that the hot items are not neighbours */
+typedef struct {
+    size_t items;
+    double theta;
+    double alpha;
+    double zetan;
+    double eta;
+    uint64_t state;
+} Zipf;
+
+/**
+ * Prepare 'zipf' to draw from [0, items) with skew 'theta' (0 < theta < 1,
+ * YCSB uses 0.99). Costs O(items), drawing costs O(1).
+ */
+void zipf_init(Zipf *zipf, size_t items, double theta);
+
+/* Draw the next item index */
+size_t zipf_next(Zipf *zipf);
+
+/**
+ * Start counting: the timing helpers below call it before their clock
+ * starts. Only built with TREE_PERF_COUNTERS (Linux perf_event_open); the
+ * counters are opened on the first call, for the calling thread, user
+ * space only. Otherwise, or when the kernel refuses, counting does nothing.
+ */
+void perf_start(void);
+
+/* Stop counting, divide the counts by 'operations' (see perf_last) */
+void perf_stop(size_t operations);
+
+/* Counts per operation of the last perf_start/perf_stop pair */
+PerfCounts perf_last(void);
+
+/**
+ * Write the CSV columns of the counters, named "<prefix>_<counter>"
+ * (insert_cycles...), each after a comma, or the counts of 'counts'.
+ * Both write nothing without TREE_PERF_COUNTERS, so the files keep
+ * their usual columns.
+ */
+void perf_csv_header(FILE *f, const char *prefix);
+void perf_csv_row(FILE *f, const PerfCounts *counts);
+
+/**
+ * Print "errors=<errors>" and end the line. The errors of every call add
+ * up for test_status.
+ */
+void report_errors(size_t errors);
+
+/**
+ * Exit status of the run: EXIT_FAILURE once report_errors saw an error,
+ * so that ctest reports it. Returned by main.
+ */
+int test_status(void);
+
 /**
  * Compare two integers.
  * Returns -1 if a < b, 1 if a > b, 0 if equal.
@@ -61,11 +172,30 @@ typedef void (*DeleteFunc)(void *root, void *data, void (*delete)(void *),
 typedef void *(*SearchFunc)(void *root, const void *data,
                             int (*compare)(const void *, const void *));
 
+/* Function type for batch insertion into a tree */
+typedef size_t (*InsertBatchFunc)(void *root, const void *data, size_t count,
+                                  size_t size,
+                                  int (*compare)(const void *, const void *),
+                                  bool *inserted);
+
+/* Function type for batch deletion from a tree */
+typedef size_t (*DeleteBatchFunc)(void *root, const void *data, size_t count,
+                                  size_t size, void (*delete)(void *),
+                                  int (*compare)(const void *, const void *),
+                                  bool *deleted);
+
+/* Function type for batch searching in a tree */
+typedef size_t (*SearchBatchFunc)(void *root, const void *data, size_t count,
+                                  size_t size,
+                                  int (*compare)(const void *, const void *),
+                                  void **found);
+
 /**
  * Measure the time to insert 'n' integer values into the tree.
  * 'root' is a pointer to the tree root.
  * 'insert' is the insertion function to test.
- * Returns elapsed time in seconds.
+ * Returns elapsed time in seconds. This helper and the five below also
+ * count hardware events, read them with perf_last().
  */
 double test_insert_complexity(void **root, int *values, size_t n, InsertFunc insert);
 
@@ -83,4 +213,28 @@ double test_delete_complexity(void **root, int *values, size_t n, DeleteFunc del
  */
 double test_search_complexity(void **root, int *values, size_t n, SearchFunc search);
 
+/**
+ * Measure the time to insert 'n' integer values into the tree,
+ * 'batch' values per call of the batch insertion function.
+ * Returns elapsed time in seconds.
+ */
+double test_insert_batch_complexity(void **root, int *values, size_t n, size_t batch,
+                                    InsertBatchFunc insert);
+
+/**
+ * Measure the time to delete 'n' integer values from the tree,
+ * 'batch' values per call of the batch deletion function.
+ * Returns elapsed time in seconds.
+ */
+double test_delete_batch_complexity(void **root, int *values, size_t n, size_t batch,
+                                    DeleteBatchFunc del);
+
+/**
+ * Measure the time to search for 'n' integer values in the tree,
+ * 'batch' values per call of the batch search function.
+ * Returns elapsed time in seconds.
+ */
+double test_search_batch_complexity(void **root, int *values, size_t n, size_t batch,
+                                    SearchBatchFunc search);
+
 #endif // TEST_H
@@ -0,0 +1,82 @@
+#ifndef TREE_FILE_H
+#define TREE_FILE_H
+
+#include <stdint.h>
+
+/* ============================
+   Tree File Format
+   ============================ */
+
+/*
+ * A tree file is a header followed by 'count' records of 'node_size'
+ * bytes in pre-order, so a left child directly follows its parent. Links
+ * are byte offsets from the start of the file (0: no child), which lets a
+ * reader map the file anywhere and descend it without any decoding.
+ * Numbers are in the byte order of the writer, recorded in 'byte_order'.
+ * Shared by the tree libraries, not installed.
+ */
+#define TREE_FILE_MAGIC "TREEFILE"
+#define TREE_FILE_VERSION 1
+#define TREE_FILE_BYTE_ORDER 0x01020304u
+
+/* Tree kinds, a file is only reopened by the library that wrote it */
+#define TREE_FILE_AVL 1
+#define TREE_FILE_BICOLOR 2
+
+typedef struct {
+    char magic[8];          /* TREE_FILE_MAGIC, without the terminator */
+    uint32_t version;
+    uint32_t byte_order;    /* TREE_FILE_BYTE_ORDER as stored by the writer */
+    uint32_t kind;
+    uint32_t reserved;
+    uint64_t payload_size;
+    uint64_t count;
+    uint64_t node_size;     /* record size, payload included, multiple of 8 */
+    uint64_t root;          /* offset of the root record, 0 for an empty tree */
+} TreeFileHeader;
+
+/* Record header, the payload follows */
+typedef struct {
+    uint64_t left;
+    uint64_t right;
+    int32_t balance;        /* AVL balance factor or Red-Black color */
+    uint32_t reserved;
+} TreeFileNode;
+
+static inline uint64_t tree_file_node_size(uint64_t payload_size) {
+    return (sizeof(TreeFileNode) + payload_size + 7) & ~(uint64_t)7;
+}
+
+/* ============================
+   Tree Stream Format
+   ============================ */
+
+/*
+ * A tree stream is a header followed by chunks, each a TreeStreamChunk and
+ * 'bytes' bytes holding 'count' whole payloads in ascending order. It
+ * records no tree shape: a stream written by one tree kind loads into the
+ * other. TREE_STREAM_DELTA_VARINT stores int32 or int64 payloads as the
+ * zigzag LEB128 varint of their difference with the previous payload
+ * (0 before the first), TREE_STREAM_RAW copies the payloads.
+ */
+#define TREE_STREAM_MAGIC "TREESTRM"
+#define TREE_STREAM_VERSION 1
+#define TREE_STREAM_CHUNK 65536 /* largest chunk body, in bytes */
+#define TREE_STREAM_VARINT_MAX 10
+
+typedef struct {
+    char magic[8];          /* TREE_STREAM_MAGIC, without the terminator */
+    uint32_t version;
+    uint32_t byte_order;    /* TREE_FILE_BYTE_ORDER as stored by the writer */
+    uint32_t codec;         /* TreeStreamCodec */
+    uint32_t reserved;
+    uint64_t payload_size;
+    uint64_t count;
+} TreeStreamHeader;
+
+typedef struct {
+    uint32_t bytes;
+    uint32_t count;
+} TreeStreamChunk;
+
+#endif
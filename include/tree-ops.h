@@ -0,0 +1,46 @@
+#ifndef TREE_OPS_H
+#define TREE_OPS_H
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+/* ============================
+   Tree Dispatch Table
+   ============================ */
+
+/*
+ * The AVL and Red-Black libraries export the same tree_* functions, so a
+ * program linked with both can not name them. Each library also exports
+ * a table of its operations under its own name, in the shape of the
+ * InsertFunc, SearchFunc and DeleteFunc types of test.h: trees are passed
+ * as void * (the address of the root for the functions that change it).
+ * This header does not include the tree headers and may be used with all
+ * of them in one translation unit.
+ */
+typedef struct {
+    const char *name;   /* "avl", "bicolor" or "btree" */
+
+    bool (*insert)(void *root, const void *data, size_t size,
+                   int (*compare)(const void *, const void *));
+    void *(*search)(void *tree, const void *data,
+                    int (*compare)(const void *, const void *));
+    void (*remove)(void *root, void *data, void (*delete)(void *),
+                   int (*compare)(const void *, const void *), size_t size);
+    void (*destroy)(void *tree, void (*delete)(void *));
+    size_t (*size)(void *tree);
+    size_t (*height)(void *tree);
+
+    /* Cursors (NULL for the B+-tree): the node of the first key >= data,
+       the next node in order and the data of a node */
+    void *(*lower_bound)(void *tree, const void *data,
+                         int (*compare)(const void *, const void *));
+    void *(*next)(void *node);
+    void *(*data)(void *node);
+} TreeOps;
+
+/* One table per library, defined by the library of the same name */
+extern const TreeOps avl_tree_ops;
+extern const TreeOps bicolor_tree_ops;
+extern const TreeOps btree_tree_ops;
+
+#endif
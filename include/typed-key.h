@@ -0,0 +1,44 @@
+#ifndef TYPED_KEY_H
+#define TYPED_KEY_H
+
+#include <stdint.h>
+#include <string.h>
+
+/* ============================
+   Typed Tree Helpers
+   ============================ */
+
+/* Paste helpers used by the typed tree templates */
+#define TYPED_CAT_(a, b) a##_##b
+#define TYPED_CAT(a, b) TYPED_CAT_(a, b)
+
+/* Three-way comparison of two numeric keys, inlined at every call site */
+#define TYPED_CMP_NUM(a, b) (((a) > (b)) - ((a) < (b)))
+
+/* Longest path a typed tree can hold (AVL and red-black, 64-bit counts) */
+#define TYPED_MAX_DEPTH 128
+
+/* Nodes handed out by one slab of a typed tree */
+#define TYPED_SLAB_NODES 1024
+
+/* Fixed-size string prefix, zero padded, ordered like strncmp */
+#define TYPED_STR_PREFIX 16
+
+typedef struct {
+    char bytes[TYPED_STR_PREFIX];
+} TypedStrKey;
+
+/**
+ * Build a string-prefix key from the first TYPED_STR_PREFIX bytes of 's'.
+ * Strings sharing that prefix compare equal.
+ */
+static inline TypedStrKey typed_str_key(const char *s) {
+    TypedStrKey key = {{0}};
+    for (size_t i = 0; i < TYPED_STR_PREFIX && s[i]; i++)
+        key.bytes[i] = s[i];
+    return key;
+}
+
+#define TYPED_CMP_STR(a, b) memcmp((a).bytes, (b).bytes, TYPED_STR_PREFIX)
+
+#endif
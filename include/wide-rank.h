@@ -0,0 +1,69 @@
+#ifndef WIDE_RANK_H
+#define WIDE_RANK_H
+
+#include <stddef.h>
+
+/* ============================
+   Wide Node Rank Kernels
+   ============================ */
+
+/*
+ * A wide node holds WIDE_KEYS sorted int keys in one 64-byte cache line.
+ * Each kernel returns how many keys of the node are below 'key', that is
+ * the slot where the search goes on. The SIMD kernels compare the probe
+ * against all keys at once and count the hits of the movemask.
+ * Callers pick a kernel at run time, see wide_rank_avx2_supported().
+ */
+#define WIDE_KEYS 16
+
+typedef unsigned (*WideRankFunc)(const int *keys, int key);
+
+static inline unsigned wide_rank_scalar(const int *keys, int key) {
+    unsigned rank = 0;
+    for (size_t i = 0; i < WIDE_KEYS; i++)
+        rank += keys[i] < key;
+    return rank;
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+
+__attribute__((target("sse2")))
+static inline unsigned wide_rank_sse2(const int *keys, int key) {
+    __m128i probe = _mm_set1_epi32(key);
+    const __m128i *lanes = (const __m128i *)keys;
+    __m128i b0 = _mm_cmpgt_epi32(probe, _mm_load_si128(lanes));
+    __m128i b1 = _mm_cmpgt_epi32(probe, _mm_load_si128(lanes + 1));
+    __m128i b2 = _mm_cmpgt_epi32(probe, _mm_load_si128(lanes + 2));
+    __m128i b3 = _mm_cmpgt_epi32(probe, _mm_load_si128(lanes + 3));
+    /* Narrow the 16 all-ones/all-zeros lanes to bytes: one movemask */
+    __m128i bytes = _mm_packs_epi16(_mm_packs_epi32(b0, b1), _mm_packs_epi32(b2, b3));
+    return (unsigned)__builtin_popcount((unsigned)_mm_movemask_epi8(bytes));
+}
+
+__attribute__((target("avx2")))
+static inline unsigned wide_rank_avx2(const int *keys, int key) {
+    __m256i probe = _mm256_set1_epi32(key);
+    const __m256i *lanes = (const __m256i *)keys;
+    __m256i low = _mm256_cmpgt_epi32(probe, _mm256_load_si256(lanes));
+    __m256i high = _mm256_cmpgt_epi32(probe, _mm256_load_si256(lanes + 1));
+    /* The pack shuffles lanes, which the count ignores: 2 mask bits per key */
+    __m256i halves = _mm256_packs_epi32(low, high);
+    return (unsigned)__builtin_popcount((unsigned)_mm256_movemask_epi8(halves)) / 2;
+}
+
+static inline int wide_rank_sse2_supported(void) {
+    return __builtin_cpu_supports("sse2");
+}
+
+static inline int wide_rank_avx2_supported(void) {
+    return __builtin_cpu_supports("avx2");
+}
+#else
+#define wide_rank_sse2 wide_rank_scalar
+#define wide_rank_avx2 wide_rank_scalar
+static inline int wide_rank_sse2_supported(void) { return 0; }
+static inline int wide_rank_avx2_supported(void) { return 0; }
+#endif
+
+#endif
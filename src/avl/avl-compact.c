@@ -0,0 +1,373 @@
+#include "avl-tree.h"
+#include <string.h>
+
+/*--------------------------------------------------------------------*/
+/* Compact AVL tree: index-addressed pool, balance packed in 'right' */
+
+#define NIL 0
+#define INDEX_MASK 0x3fffffffu
+#define BALANCE_SHIFT 30
+#define MAX_NODES INDEX_MASK
+#define MAX_DEPTH 64 // AVL height stays below 1.45 log2(2^30)
+#define FIRST_CAPACITY 64
+#define SEGMENT_SHIFT 16 // 2^16 slots per segment past the first
+#define SEGMENT_SLOTS ((uint32_t)1 << SEGMENT_SHIFT)
+#define SEGMENT_MASK (SEGMENT_SLOTS - 1)
+
+typedef struct {
+  uint32_t left;
+  uint32_t right; // child index in the low 30 bits, balance + 1 on top
+} Links;
+
+struct _AvlCompactTree {
+  char **segments; // segment k holds the slots from k << SEGMENT_SHIFT on;
+                   // slot 0 is never used so that index 0 can mean NIL
+  size_t segment_room; // entries of 'segments'
+  size_t size;     // payload size
+  size_t stride;   // bytes per slot: links followed by the payload
+  uint32_t root;
+  uint32_t count;
+  uint32_t used;   // slots handed out so far, including slot 0
+  uint32_t capacity;
+  uint32_t free_list; // released slots, linked through 'left'
+};
+
+#define LINKS(t, i)                                                            \
+  ((Links *)((t)->segments[(i) >> SEGMENT_SHIFT] + (size_t)((i) & SEGMENT_MASK) * (t)->stride))
+#define DATA(t, i) ((char *)LINKS(t, i) + sizeof(Links))
+#define LEFT(t, i) (LINKS(t, i)->left)
+#define RIGHT(t, i) (LINKS(t, i)->right & INDEX_MASK)
+#define BALANCE(t, i) ((int)(LINKS(t, i)->right >> BALANCE_SHIFT) - 1)
+
+static void set_right(CompactTree t, uint32_t i, uint32_t right) {
+  Links *l = LINKS(t, i);
+  l->right = (l->right & ~INDEX_MASK) | right;
+}
+
+static void set_balance(CompactTree t, uint32_t i, int balance) {
+  Links *l = LINKS(t, i);
+  l->right = (l->right & INDEX_MASK) | ((uint32_t)(balance + 1) << BALANCE_SHIFT);
+}
+
+// Make room for more slots. The first segment doubles up to SEGMENT_SLOTS;
+// past it whole segments are added and no slot moves, so the pool never
+// holds more than one segment of slack, nor a second copy while growing
+static bool pool_grow(CompactTree t) {
+  if (t->capacity < SEGMENT_SLOTS) {
+    char *first = realloc(t->segments[0], (size_t)t->capacity * 2 * t->stride);
+    if (!first)
+      return false;
+    t->segments[0] = first;
+    t->capacity *= 2;
+    return true;
+  }
+
+  size_t count = t->capacity >> SEGMENT_SHIFT;
+  if (count == t->segment_room) {
+    char **segments = realloc(t->segments, 2 * count * sizeof(char *));
+    if (!segments)
+      return false;
+    t->segments = segments;
+    t->segment_room = 2 * count;
+  }
+  char *segment = malloc((size_t)SEGMENT_SLOTS * t->stride);
+  if (!segment)
+    return false;
+  t->segments[count] = segment;
+  t->capacity += SEGMENT_SLOTS;
+  return true;
+}
+
+static uint32_t slot_alloc(CompactTree t) {
+  if (t->free_list != NIL) {
+    uint32_t i = t->free_list;
+    t->free_list = LEFT(t, i);
+    return i;
+  }
+
+  if (t->used == MAX_NODES || (t->used == t->capacity && !pool_grow(t)))
+    return NIL;
+  return t->used++;
+}
+
+static void slot_free(CompactTree t, uint32_t i) {
+  LINKS(t, i)->left = t->free_list;
+  t->free_list = i;
+}
+
+// Make 'parent' (or the root when NIL) point to 'new' instead of 'old'
+static void replace_child(CompactTree t, uint32_t parent, uint32_t old,
+                          uint32_t new) {
+  if (parent == NIL)
+    t->root = new;
+  else if (LEFT(t, parent) == old)
+    LEFT(t, parent) = new;
+  else
+    set_right(t, parent, new);
+}
+
+static uint32_t rotate_left(CompactTree t, uint32_t root) {
+  uint32_t right = RIGHT(t, root);
+  set_right(t, root, LEFT(t, right));
+  LEFT(t, right) = root;
+  return right;
+}
+
+static uint32_t rotate_right(CompactTree t, uint32_t root) {
+  uint32_t left = LEFT(t, root);
+  LEFT(t, root) = RIGHT(t, left);
+  set_right(t, left, root);
+  return left;
+}
+
+// Rebalance a node whose balance reached +2 or -2, return the new subtree
+// root. The two packed bits cannot hold +-2, so the balance is passed in and
+// the final factors are set directly for each rotation case.
+static uint32_t fix_balance(CompactTree t, uint32_t node, int balance) {
+  if (balance > 1) {
+    uint32_t left = LEFT(t, node);
+    int leftBal = BALANCE(t, left);
+    if (leftBal >= 0) { // simple rotation -> left left
+      set_balance(t, node, 1 - leftBal);
+      set_balance(t, left, leftBal - 1);
+      return rotate_right(t, node);
+    }
+    // double rotation -> left right
+    uint32_t pivot = RIGHT(t, left);
+    int pivotBal = BALANCE(t, pivot);
+    set_balance(t, node, pivotBal == 1 ? -1 : 0);
+    set_balance(t, left, pivotBal == -1 ? 1 : 0);
+    set_balance(t, pivot, 0);
+    LEFT(t, node) = rotate_left(t, left);
+    return rotate_right(t, node);
+  } else {
+    uint32_t right = RIGHT(t, node);
+    int rightBal = BALANCE(t, right);
+    if (rightBal <= 0) { // simple rotation -> right right
+      set_balance(t, node, -1 - rightBal);
+      set_balance(t, right, rightBal + 1);
+      return rotate_left(t, node);
+    }
+    // double rotation -> right left
+    uint32_t pivot = LEFT(t, right);
+    int pivotBal = BALANCE(t, pivot);
+    set_balance(t, node, pivotBal == -1 ? 1 : 0);
+    set_balance(t, right, pivotBal == 1 ? -1 : 0);
+    set_balance(t, pivot, 0);
+    set_right(t, node, rotate_right(t, right));
+    return rotate_left(t, node);
+  }
+}
+
+CompactTree compact_tree_new(size_t size) {
+  CompactTree tree = malloc(sizeof(struct _AvlCompactTree));
+  if (!tree)
+    return NULL;
+
+  size_t align = size >= sizeof(uint64_t) ? sizeof(uint64_t) : sizeof(uint32_t);
+  tree->size = size;
+  tree->stride = (sizeof(Links) + size + align - 1) & ~(align - 1);
+  tree->segments = malloc(sizeof(char *));
+  char *first = tree->segments ? malloc(FIRST_CAPACITY * tree->stride) : NULL;
+  if (!first) {
+    free(tree->segments);
+    free(tree);
+    return NULL;
+  }
+  tree->segments[0] = first;
+  tree->segment_room = 1;
+  tree->root = NIL;
+  tree->count = 0;
+  tree->used = 1;
+  tree->capacity = FIRST_CAPACITY;
+  tree->free_list = NIL;
+  return tree;
+}
+
+static void delete_nodes(CompactTree t, uint32_t node, void (*delete)(void *)) {
+  if (node != NIL) {
+    delete_nodes(t, LEFT(t, node), delete);
+    delete_nodes(t, RIGHT(t, node), delete);
+    delete (DATA(t, node));
+  }
+}
+
+void compact_tree_delete(CompactTree tree, void (*delete)(void *)) {
+  if (tree) {
+    if (delete)
+      delete_nodes(tree, tree->root, delete);
+    size_t count = tree->capacity > SEGMENT_SLOTS ? tree->capacity >> SEGMENT_SHIFT : 1;
+    for (size_t k = 0; k < count; k++)
+      free(tree->segments[k]);
+    free(tree->segments);
+    free(tree);
+  }
+}
+
+bool compact_tree_insert_sorted(CompactTree tree, const void *data,
+                                int (*compare)(const void *, const void *)) {
+  if (!tree)
+    return false;
+
+  uint32_t path[MAX_DEPTH];
+  bool went_left[MAX_DEPTH];
+  int depth = 0;
+
+  uint32_t cur = tree->root;
+  while (cur != NIL) {
+    int cmp = compare(data, DATA(tree, cur));
+    if (cmp == 0)
+      return false; // don't add duplicates
+    path[depth] = cur;
+    went_left[depth++] = cmp < 0;
+    cur = cmp < 0 ? LEFT(tree, cur) : RIGHT(tree, cur);
+  }
+
+  uint32_t node = slot_alloc(tree);
+  if (node == NIL)
+    return false;
+  LINKS(tree, node)->left = NIL;
+  LINKS(tree, node)->right = NIL;
+  set_balance(tree, node, 0);
+  memcpy(DATA(tree, node), data, tree->size);
+  tree->count++;
+
+  if (depth == 0) {
+    tree->root = node;
+    return true;
+  }
+  if (went_left[depth - 1])
+    LEFT(tree, path[depth - 1]) = node;
+  else
+    set_right(tree, path[depth - 1], node);
+
+  // Retrace until the height change is absorbed
+  for (int i = depth - 1; i >= 0; i--) {
+    uint32_t p = path[i];
+    int balance = BALANCE(tree, p) + (went_left[i] ? 1 : -1);
+    if (balance == 2 || balance == -2) {
+      uint32_t sub = fix_balance(tree, p, balance);
+      replace_child(tree, i > 0 ? path[i - 1] : NIL, p, sub);
+      break;
+    }
+    set_balance(tree, p, balance);
+    if (balance == 0)
+      break;
+  }
+  return true;
+}
+
+void compact_node_delete(CompactTree tree, void *data, void (*delete)(void *),
+                         int (*compare)(const void *, const void *)) {
+  if (!tree)
+    return;
+
+  uint32_t path[MAX_DEPTH];
+  bool went_left[MAX_DEPTH];
+  int depth = 0;
+
+  uint32_t z = tree->root;
+  while (z != NIL) {
+    int cmp = compare(data, DATA(tree, z));
+    if (cmp == 0)
+      break;
+    path[depth] = z;
+    went_left[depth++] = cmp < 0;
+    z = cmp < 0 ? LEFT(tree, z) : RIGHT(tree, z);
+  }
+  if (z == NIL)
+    return;
+
+  if (delete)
+    delete (DATA(tree, z));
+
+  // Two children: the successor's payload moves into z, the successor goes
+  uint32_t victim = z;
+  if (LEFT(tree, z) != NIL && RIGHT(tree, z) != NIL) {
+    path[depth] = z;
+    went_left[depth++] = false;
+    victim = RIGHT(tree, z);
+    while (LEFT(tree, victim) != NIL) {
+      path[depth] = victim;
+      went_left[depth++] = true;
+      victim = LEFT(tree, victim);
+    }
+    memcpy(DATA(tree, z), DATA(tree, victim), tree->size);
+  }
+
+  uint32_t child = LEFT(tree, victim) != NIL ? LEFT(tree, victim)
+                                             : RIGHT(tree, victim);
+  replace_child(tree, depth > 0 ? path[depth - 1] : NIL, victim, child);
+  slot_free(tree, victim);
+  tree->count--;
+
+  // Retrace while the subtree keeps getting shorter
+  for (int i = depth - 1; i >= 0; i--) {
+    uint32_t p = path[i];
+    int balance = BALANCE(tree, p) + (went_left[i] ? -1 : 1);
+    if (balance == 2 || balance == -2) {
+      uint32_t sub = fix_balance(tree, p, balance);
+      replace_child(tree, i > 0 ? path[i - 1] : NIL, p, sub);
+      if (BALANCE(tree, sub) != 0)
+        break;
+      continue;
+    }
+    set_balance(tree, p, balance);
+    if (balance == 1 || balance == -1)
+      break;
+  }
+}
+
+void *compact_tree_search(CompactTree tree, const void *data,
+                          int (*compare)(const void *, const void *)) {
+  if (!tree)
+    return NULL;
+
+  uint32_t cur = tree->root;
+  while (cur != NIL) {
+    int cmp = compare(data, DATA(tree, cur));
+    if (cmp == 0)
+      return DATA(tree, cur);
+    cur = cmp < 0 ? LEFT(tree, cur) : RIGHT(tree, cur);
+  }
+  return NULL;
+}
+
+static void in_order(CompactTree t, uint32_t node, void (*func)(void *, void *),
+                     void *extra_data) {
+  if (node != NIL) {
+    in_order(t, LEFT(t, node), func, extra_data);
+    func(DATA(t, node), extra_data);
+    in_order(t, RIGHT(t, node), func, extra_data);
+  }
+}
+
+void compact_tree_in_order(CompactTree tree, void (*func)(void *, void *),
+                           void *extra_data) {
+  if (tree)
+    in_order(tree, tree->root, func, extra_data);
+}
+
+size_t compact_tree_height(CompactTree tree) {
+  if (!tree)
+    return 0;
+
+  // Follow the taller child, as told by the balance factor
+  size_t height = 0;
+  uint32_t cur = tree->root;
+  while (cur != NIL) {
+    height++;
+    cur = BALANCE(tree, cur) < 0 ? RIGHT(tree, cur) : LEFT(tree, cur);
+  }
+  return height;
+}
+
+size_t compact_tree_size(CompactTree tree) { return tree ? tree->count : 0; }
+
+size_t compact_tree_memory(CompactTree tree) {
+  if (tree)
+    return sizeof(struct _AvlCompactTree) + (size_t)tree->capacity * tree->stride +
+           tree->segment_room * sizeof(char *);
+  else
+    return 0;
+}
@@ -0,0 +1,48 @@
+#include "avl-tree.h"
+#include "tree-ops.h"
+
+/*--------------------------------------------------------------------*/
+/* Dispatch table: the tree functions with the void * trees of TreeOps */
+
+static bool insert(void *root, const void *data, size_t size,
+                   int (*compare)(const void *, const void *)) {
+  return tree_insert_sorted(root, data, size, compare);
+}
+
+static void *search(void *tree, const void *data,
+                    int (*compare)(const void *, const void *)) {
+  return tree_search(tree, data, compare);
+}
+
+static void remove_data(void *root, void *data, void (*delete)(void *),
+                        int (*compare)(const void *, const void *), size_t size) {
+  node_delete(root, data, delete, compare, size);
+}
+
+static void destroy(void *tree, void (*delete)(void *)) { tree_delete(tree, delete); }
+
+static size_t size_of(void *tree) { return tree_size(tree); }
+
+static size_t height(void *tree) { return tree_height(tree); }
+
+static void *lower_bound(void *tree, const void *data,
+                         int (*compare)(const void *, const void *)) {
+  return tree_lower_bound(tree, data, compare);
+}
+
+static void *next(void *node) { return iter_next(node); }
+
+static void *data_of(void *node) { return tree_get_data(node); }
+
+const TreeOps avl_tree_ops = {
+    .name = "avl",
+    .insert = insert,
+    .search = search,
+    .remove = remove_data,
+    .destroy = destroy,
+    .size = size_of,
+    .height = height,
+    .lower_bound = lower_bound,
+    .next = next,
+    .data = data_of,
+};
@@ -0,0 +1,20 @@
+#ifndef TREE_HOOKS_H
+#define TREE_HOOKS_H
+
+/*
+ * Per-library side of the modules of src/common. They only use the public
+ * tree API, and each tree library compiles them against its own header,
+ * found through this file.
+ */
+#include "avl-tree.h"
+
+/* Tag of an opaque type of the header: TREE_STRUCT(TreeSnapshot) is struct _AvlTreeSnapshot */
+#define TREE_STRUCT(name) struct _Avl##name
+
+/* Kind written in and required from a tree file header */
+#define TREE_FILE_KIND TREE_FILE_AVL
+
+/* Value stored in the balance field of a tree file record */
+#define TREE_FILE_BALANCE(node) ((node)->balance)
+
+#endif
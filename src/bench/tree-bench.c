@@ -0,0 +1,743 @@
+#include "test.h"
+#include <dlfcn.h>
+#include <errno.h>
+#include <math.h>
+
+/*--------------------------------------------------------------------*/
+/* Benchmark harness: every structure is loaded with dlopen into its own
+ * namespace, since the AVL and Red-Black libraries export the same
+ * symbols, and driven through the function types of test.h. */
+
+typedef void (*DestroyFunc)(void *tree, void (*delete)(void *));
+
+/* Cursor functions, for range scans (not provided by every structure) */
+typedef void *(*BoundFunc)(void *tree, const void *data,
+                           int (*compare)(const void *, const void *));
+typedef void *(*StepFunc)(void *node);
+
+/* Operation counters of a library built with TREE_STATS, laid out as its
+   TreeStats: ten 64-bit counters in this order */
+enum {
+  COUNT_SINGLE_ROTATIONS,
+  COUNT_DOUBLE_ROTATIONS,
+  COUNT_RECOLORINGS,
+  COUNT_COMPARISONS,
+  COUNT_SEARCHES,
+  COUNT_SEARCH_VISITS,
+  COUNT_INSERTS,
+  COUNT_INSERT_VISITS,
+  COUNT_DELETES,
+  COUNT_DELETE_VISITS,
+  COUNTERS
+};
+
+typedef struct {
+  uint64_t value[COUNTERS];
+} Counters;
+
+typedef bool (*CountersFunc)(Counters *counters);
+
+#define SYMBOLS 8
+#define REQUIRED_SYMBOLS 4
+
+typedef struct {
+  const char *name;
+  const char *path;      // library built next to the harness
+  const char *file_name; // fallback, found by the dynamic loader
+  // insert, search, delete, destroy, then the optional lower bound,
+  // next and data of a cursor and the operation counters
+  const char *symbols[SYMBOLS];
+  void *handle;
+  InsertFunc insert;
+  SearchFunc search;
+  DeleteFunc remove;
+  DestroyFunc destroy;
+  BoundFunc lower_bound;
+  StepFunc next;
+  StepFunc data;
+  CountersFunc counters; // NULL unless built with TREE_STATS
+} Structure;
+
+static Structure structures[] = {
+    {.name = "avl",
+     .path = TREE_BENCH_AVL,
+     .file_name = TREE_BENCH_AVL_NAME,
+     .symbols = {"tree_insert_sorted", "tree_search", "node_delete", "tree_delete",
+                 "tree_lower_bound", "iter_next", "tree_get_data", "tree_stats"}},
+    {.name = "bicolor",
+     .path = TREE_BENCH_BICOLOR,
+     .file_name = TREE_BENCH_BICOLOR_NAME,
+     .symbols = {"tree_insert_sorted", "tree_search", "node_delete", "tree_delete",
+                 "tree_lower_bound", "iter_next", "tree_get_data", "tree_stats"}},
+    {.name = "btree",
+     .path = TREE_BENCH_BTREE,
+     .file_name = TREE_BENCH_BTREE_NAME,
+     .symbols = {"btree_insert_sorted", "btree_search", "btree_node_delete", "btree_delete"}},
+};
+
+#define STRUCTURES (sizeof(structures) / sizeof(structures[0]))
+
+typedef enum { OP_INSERT, OP_SEARCH, OP_DELETE, OP_UPDATE, OP_SCAN, OPS } Operation;
+
+static const char *operation_names[OPS] = {"insert", "search", "delete", "update", "scan"};
+
+typedef enum { DIST_SORTED, DIST_SHUFFLED, DIST_UNIFORM, DIST_CLUSTERED, DISTS } Distribution;
+
+static const char *distribution_names[DISTS] = {"sorted", "shuffled", "uniform", "clustered"};
+
+/* YCSB core workloads, over records already loaded; "load" times the
+   insertion, search and deletion of every key instead */
+typedef enum { WORKLOAD_LOAD, WORKLOAD_A, WORKLOAD_B, WORKLOAD_C, WORKLOAD_E, WORKLOADS } Workload;
+
+static const char *workload_names[WORKLOADS] = {"load", "a", "b", "c", "e"};
+
+typedef struct {
+  unsigned search; // percentages, the rest of 100 is 'insert'
+  unsigned update;
+  unsigned scan;
+} Mix;
+
+static const Mix workload_mixes[WORKLOADS] = {
+    {0, 0, 0},   // load: not a mix
+    {50, 50, 0}, // A: update heavy
+    {95, 5, 0},  // B: read mostly
+    {100, 0, 0}, // C: read only
+    {0, 0, 95},  // E: short ranges, 5% inserts
+};
+
+#define SCAN_LENGTH 100 // scans read 1 to SCAN_LENGTH records
+
+typedef struct {
+  bool selected[STRUCTURES];
+  size_t *sizes;
+  size_t size_count;
+  unsigned repetitions;
+  unsigned warmup;
+  Distribution distribution;
+  bool strings;        // Hashmap payloads with string keys, else int
+  Workload workload;
+  bool zipfian;        // request distribution of the workloads
+  size_t operations;   // per workload run, 0 for the number of records
+  bool json;
+  const char *output;
+} Options;
+
+typedef struct {
+  char *data;   // 2n payloads: n loaded, n more for the inserts of workload E
+  size_t size;
+  int (*compare)(const void *, const void *);
+} Keys;
+
+#define KEY(keys, i) ((keys)->data + (i) * (keys)->size)
+
+typedef struct {
+  size_t count;  // operations measured, over every repetition
+  double total;  // seconds spent in them per run, median over the repetitions
+  double mean;   // nanoseconds per operation
+  double median;
+  double p99;
+  double stddev;
+  bool counted;  // the per operation counters below are known
+  double single_rotations;
+  double double_rotations;
+  double recolorings;
+  double comparisons;
+  double visits; // nodes visited by the search, insert and delete descents
+} Stats;
+
+/* Latencies of one operation over every measured repetition */
+typedef struct {
+  double *samples;
+  size_t count;
+  double *totals;    // time per repetition
+  Counters counters; // summed over the measured operations
+} Samples;
+
+/*--------------------------------------------------------------------*/
+/* Library loading */
+
+static bool load(Structure *s) {
+  s->handle = dlopen(s->path, RTLD_NOW | RTLD_LOCAL);
+  if (!s->handle)
+    s->handle = dlopen(s->file_name, RTLD_NOW | RTLD_LOCAL);
+  if (!s->handle) {
+    fprintf(stderr, "tree-bench: cannot load %s: %s\n", s->name, dlerror());
+    return false;
+  }
+
+  void *functions[SYMBOLS] = {NULL};
+  for (int i = 0; i < SYMBOLS; i++) {
+    if (s->symbols[i])
+      functions[i] = dlsym(s->handle, s->symbols[i]);
+    if (!functions[i] && i < REQUIRED_SYMBOLS) {
+      fprintf(stderr, "tree-bench: %s has no %s\n", s->name, s->symbols[i]);
+      return false;
+    }
+  }
+  s->insert = (InsertFunc)functions[0];
+  s->search = (SearchFunc)functions[1];
+  s->remove = (DeleteFunc)functions[2];
+  s->destroy = (DestroyFunc)functions[3];
+  s->lower_bound = (BoundFunc)functions[4];
+  s->next = (StepFunc)functions[5];
+  s->data = (StepFunc)functions[6];
+  s->counters = (CountersFunc)functions[7];
+  // tree_stats is always exported, but only counts with TREE_STATS
+  Counters probe;
+  if (s->counters && !s->counters(&probe))
+    s->counters = NULL;
+  return true;
+}
+
+static bool can_scan(const Structure *s) { return s->lower_bound && s->next && s->data; }
+
+/*--------------------------------------------------------------------*/
+/* Keys */
+
+static bool make_keys(const Options *o, size_t n, Keys *keys) {
+  size_t total = 2 * n;
+  if (o->strings) {
+    Hashmap *words = word_list(total);
+    if (words && o->distribution == DIST_SORTED)
+      qsort(words, n, sizeof(Hashmap), compare_dico);
+    keys->data = (char *)words;
+    keys->size = sizeof(Hashmap);
+    keys->compare = compare_dico;
+    return words != NULL;
+  }
+
+  int *values = NULL;
+  switch (o->distribution) {
+  case DIST_SORTED:
+  case DIST_SHUFFLED:
+    // Even keys are loaded, the odd ones in between are left for inserts
+    values = malloc(total * sizeof(int));
+    for (size_t i = 0; values && i < n; i++) {
+      values[i] = (int)(2 * i);
+      values[n + i] = (int)(2 * i + 1);
+    }
+    if (values && o->distribution == DIST_SHUFFLED) {
+      shuffle_list(values, n);
+      shuffle_list(values + n, n);
+    }
+    break;
+  case DIST_UNIFORM:
+    values = uniform_list(total);
+    break;
+  default:
+    values = clustered_list(total);
+  }
+  keys->data = (char *)values;
+  keys->size = sizeof(int);
+  keys->compare = compare_int;
+  return values != NULL;
+}
+
+/*--------------------------------------------------------------------*/
+/* Measurements: each operation is timed on its own, so that the tail is
+ * visible; the clock costs a few tens of nanoseconds per reading. */
+
+static double now(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// Record the operation that ended at 't' and started at '*previous'
+static void record(Samples *samples, bool measured, double *previous, double t) {
+  if (measured)
+    samples->samples[samples->count++] = (t - *previous) * 1e9;
+  samples->totals[0] += t - *previous;
+  *previous = t;
+}
+
+// Add what the operation just recorded moved the counters from '*last' by,
+// then restart the clock: reading the counters is not timed
+static void count_operation(const Structure *s, Samples *samples, bool measured,
+                            Counters *last, double *previous) {
+  if (!s->counters)
+    return;
+  Counters current;
+  s->counters(&current);
+  for (int c = 0; measured && c < COUNTERS; c++)
+    samples->counters.value[c] += current.value[c] - last->value[c];
+  *last = current;
+  *previous = now();
+}
+
+// Start a repetition: totals[0] accumulates it, end_run moves it to its slot
+static void begin_run(Samples samples[OPS]) {
+  for (int op = 0; op < OPS; op++)
+    samples[op].totals[0] = 0;
+}
+
+static void end_run(Samples samples[OPS], unsigned slot) {
+  for (int op = 0; op < OPS; op++)
+    samples[op].totals[slot] = samples[op].totals[0];
+}
+
+// A search must find a record equal to its key, else the timing measured a miss
+static bool found(const Keys *keys, const void *data, const void *key) {
+  return data && keys->compare(data, key) == 0;
+}
+
+// Load workload: build, search and empty a tree with the first n keys.
+// Returns the number of searches that missed a loaded key
+static size_t run_load(const Structure *s, const Keys *keys, size_t n, Samples samples[OPS],
+                       bool measured) {
+  size_t wrong = 0;
+  void *tree = NULL;
+  Counters last;
+  if (s->counters)
+    s->counters(&last);
+  double previous = now();
+
+  for (size_t i = 0; i < n; i++) {
+    s->insert(&tree, KEY(keys, i), keys->size, keys->compare);
+    record(&samples[OP_INSERT], measured, &previous, now());
+    count_operation(s, &samples[OP_INSERT], measured, &last, &previous);
+  }
+  for (size_t i = 0; i < n; i++) {
+    void *data = s->search(tree, KEY(keys, i), keys->compare);
+    record(&samples[OP_SEARCH], measured, &previous, now());
+    count_operation(s, &samples[OP_SEARCH], measured, &last, &previous);
+    wrong += !found(keys, data, KEY(keys, i)); // not timed
+    previous = now();
+  }
+  for (size_t i = 0; i < n; i++) {
+    s->remove(&tree, KEY(keys, i), NULL, keys->compare, keys->size);
+    record(&samples[OP_DELETE], measured, &previous, now());
+    count_operation(s, &samples[OP_DELETE], measured, &last, &previous);
+  }
+
+  s->destroy(tree, NULL);
+  return wrong;
+}
+
+// YCSB workload over a tree loaded (untimed) with the first n keys.
+// Returns the number of searches that missed a loaded key
+static size_t run_mix(const Structure *s, const Keys *keys, size_t n, size_t operations,
+                    const Mix *mix, Zipf *zipf, Samples samples[OPS], bool measured) {
+  void *tree = NULL;
+  for (size_t i = 0; i < n; i++)
+    s->insert(&tree, KEY(keys, i), keys->size, keys->compare);
+
+  uint64_t state = 0x853c49e6748fea9bu;
+  size_t inserted = 0, wrong = 0;
+  Counters last;
+  if (s->counters)
+    s->counters(&last);
+  double previous = now();
+  for (size_t i = 0; i < operations; i++) {
+    unsigned draw = (unsigned)(next_random(&state) % 100);
+    size_t index = zipf ? zipf_next(zipf) : next_random(&state) % n;
+    const char *key = KEY(keys, index);
+
+    Operation op;
+    void *data = NULL;
+    if (draw < mix->search) {
+      op = OP_SEARCH;
+      data = s->search(tree, key, keys->compare);
+    } else if (draw < mix->search + mix->update) {
+      // A set has no value to overwrite: rewrite the record in place of it
+      op = OP_UPDATE;
+      s->remove(&tree, (void *)key, NULL, keys->compare, keys->size);
+      s->insert(&tree, key, keys->size, keys->compare);
+    } else if (draw < mix->search + mix->update + mix->scan) {
+      op = OP_SCAN;
+      size_t length = 1 + next_random(&state) % SCAN_LENGTH;
+      volatile char sink = 0;
+      void *node = s->lower_bound(tree, key, keys->compare);
+      for (size_t k = 0; node && k < length; k++, node = s->next(node))
+        sink ^= *(char *)s->data(node);
+      (void)sink;
+    } else {
+      op = OP_INSERT;
+      s->insert(&tree, KEY(keys, n + inserted % n), keys->size, keys->compare);
+      inserted++;
+    }
+    record(&samples[op], measured, &previous, now());
+    count_operation(s, &samples[op], measured, &last, &previous);
+    // Updates rewrite their record: every loaded key stays in the tree.
+    // The check is not timed
+    if (op == OP_SEARCH) {
+      wrong += !found(keys, data, key);
+      previous = now();
+    }
+  }
+
+  s->destroy(tree, NULL);
+  return wrong;
+}
+
+static int compare_double(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile of sorted values
+static double percentile(const double *sorted, size_t count, double p) {
+  size_t rank = (size_t)ceil(p / 100.0 * count);
+  return sorted[rank ? rank - 1 : 0];
+}
+
+static void summarize(const Structure *s, Samples *samples, unsigned repetitions,
+                      Stats *stats) {
+  size_t count = samples->count;
+  stats->count = count;
+  stats->counted = s->counters != NULL;
+  if (count == 0)
+    return;
+
+  const uint64_t *c = samples->counters.value;
+  stats->single_rotations = (double)c[COUNT_SINGLE_ROTATIONS] / count;
+  stats->double_rotations = (double)c[COUNT_DOUBLE_ROTATIONS] / count;
+  stats->recolorings = (double)c[COUNT_RECOLORINGS] / count;
+  stats->comparisons = (double)c[COUNT_COMPARISONS] / count;
+  stats->visits =
+      (double)(c[COUNT_SEARCH_VISITS] + c[COUNT_INSERT_VISITS] + c[COUNT_DELETE_VISITS]) / count;
+
+  double sum = 0;
+  for (size_t i = 0; i < count; i++)
+    sum += samples->samples[i];
+  stats->mean = sum / count;
+  double squares = 0;
+  for (size_t i = 0; i < count; i++)
+    squares += (samples->samples[i] - stats->mean) * (samples->samples[i] - stats->mean);
+  stats->stddev = count > 1 ? sqrt(squares / (count - 1)) : 0;
+
+  qsort(samples->samples, count, sizeof(double), compare_double);
+  stats->median = percentile(samples->samples, count, 50);
+  stats->p99 = percentile(samples->samples, count, 99);
+  // totals[0] is the scratch slot, the repetitions are in 1 .. repetitions
+  qsort(samples->totals + 1, repetitions, sizeof(double), compare_double);
+  stats->total = percentile(samples->totals + 1, repetitions, 50);
+}
+
+static bool bench(const Structure *s, const Options *o, size_t n, Stats stats[OPS]) {
+  Keys keys;
+  Zipf zipf;
+  Samples samples[OPS];
+  size_t per_run = o->workload == WORKLOAD_LOAD ? n : (o->operations ? o->operations : n);
+  bool ok = make_keys(o, n, &keys);
+  size_t wrong = 0;
+  for (int op = 0; op < OPS; op++) {
+    samples[op].samples = malloc(per_run * o->repetitions * sizeof(double));
+    samples[op].totals = malloc((o->repetitions + 1) * sizeof(double));
+    samples[op].count = 0;
+    memset(&samples[op].counters, 0, sizeof(Counters));
+    ok = ok && samples[op].samples && samples[op].totals;
+  }
+
+  if (ok) {
+    if (o->workload != WORKLOAD_LOAD && o->zipfian)
+      zipf_init(&zipf, n, 0.99);
+    for (unsigned r = 0; r < o->warmup + o->repetitions; r++) {
+      bool measured = r >= o->warmup;
+      if (o->workload != WORKLOAD_LOAD && o->zipfian)
+        zipf.state = 0xbf58476d1ce4e5b9u + r; // same requests in every run but the seed
+      begin_run(samples);
+      if (o->workload == WORKLOAD_LOAD)
+        wrong += run_load(s, &keys, n, samples, measured);
+      else
+        wrong += run_mix(s, &keys, n, per_run, &workload_mixes[o->workload],
+                o->zipfian ? &zipf : NULL, samples, measured);
+      if (measured)
+        end_run(samples, r - o->warmup + 1);
+    }
+    for (int op = 0; op < OPS; op++)
+      summarize(s, &samples[op], o->repetitions, &stats[op]);
+  } else
+    fprintf(stderr, "tree-bench: out of memory for n=%zu\n", n);
+  if (wrong) {
+    fprintf(stderr, "tree-bench: %s: %zu searches missed a loaded key for n=%zu\n", s->name,
+            wrong, n);
+    ok = false;
+  }
+
+  for (int op = 0; op < OPS; op++) {
+    free(samples[op].samples);
+    free(samples[op].totals);
+  }
+  free(keys.data);
+  return ok;
+}
+
+/*--------------------------------------------------------------------*/
+/* Output: one record per structure, size and operation */
+
+static void print_header(FILE *out, const Options *o) {
+  if (o->json)
+    fprintf(out, "[");
+  else
+    fprintf(out, "structure,workload,distribution,keys,n,operation,operations,repetitions,"
+                 "total_time,mean_ns,median_ns,p99_ns,stddev_ns,single_rotations,"
+                 "double_rotations,recolorings,comparisons,visits\n");
+}
+
+// Per operation counter, "nan" in CSV and null in JSON when not counted
+static void print_counter(FILE *out, const Options *o, const char *name, const Stats *s,
+                          double value) {
+  if (o->json)
+    fprintf(out, ", \"%s\": ", name);
+  else
+    fprintf(out, ",");
+  if (s->counted)
+    fprintf(out, "%.3f", value);
+  else
+    fprintf(out, o->json ? "null" : "nan");
+}
+
+static void print_record(FILE *out, const Options *o, const char *name, size_t n, Operation op,
+                         const Stats *s, bool first) {
+  const char *workload = workload_names[o->workload];
+  const char *distribution = distribution_names[o->distribution];
+  const char *keys = o->strings ? "string" : "int";
+  if (o->json)
+    fprintf(out,
+            "%s\n  {\"structure\": \"%s\", \"workload\": \"%s\", \"distribution\": \"%s\", "
+            "\"keys\": \"%s\", \"n\": %zu, \"operation\": \"%s\", \"operations\": %zu, "
+            "\"repetitions\": %u, \"total_time\": %.9f, \"mean_ns\": %.1f, "
+            "\"median_ns\": %.1f, \"p99_ns\": %.1f, \"stddev_ns\": %.1f",
+            first ? "" : ",", name, workload, distribution, keys, n, operation_names[op],
+            s->count, o->repetitions, s->total, s->mean, s->median, s->p99, s->stddev);
+  else
+    fprintf(out, "%s,%s,%s,%s,%zu,%s,%zu,%u,%.9f,%.1f,%.1f,%.1f,%.1f", name, workload,
+            distribution, keys, n, operation_names[op], s->count, o->repetitions, s->total,
+            s->mean, s->median, s->p99, s->stddev);
+  print_counter(out, o, "single_rotations", s, s->single_rotations);
+  print_counter(out, o, "double_rotations", s, s->double_rotations);
+  print_counter(out, o, "recolorings", s, s->recolorings);
+  print_counter(out, o, "comparisons", s, s->comparisons);
+  print_counter(out, o, "visits", s, s->visits);
+  fprintf(out, o->json ? "}" : "\n");
+}
+
+static void print_footer(FILE *out, const Options *o) {
+  if (o->json)
+    fprintf(out, "\n]\n");
+}
+
+/*--------------------------------------------------------------------*/
+/* Command line */
+
+static void usage(FILE *out) {
+  fprintf(out,
+          "Usage: tree-bench [options]\n"
+          "  --structure LIST     avl,bicolor,btree (default: all)\n"
+          "  --sizes LIST         element counts (default: 1000,10000,100000,1000000)\n"
+          "  --repetitions N      measured runs per size (default: 5)\n"
+          "  --warmup N           unmeasured runs first (default: 1)\n"
+          "  --distribution NAME  sorted, shuffled, uniform or clustered keys\n"
+          "                       (default: shuffled; string keys: sorted or shuffled)\n"
+          "  --keys TYPE          int or string (default: int)\n"
+          "  --workload NAME      load (insert, search, delete every key) or YCSB\n"
+          "                       a (50%% search, 50%% update), b (95/5), c (search only),\n"
+          "                       e (95%% scans of 1-%d keys, 5%% inserts) (default: load)\n"
+          "  --request-distribution NAME\n"
+          "                       zipfian or uniform choice of the records a workload\n"
+          "                       touches (default: zipfian)\n"
+          "  --operations N       operations per workload run (default: n)\n"
+          "  --format FORMAT      csv or json (default: csv)\n"
+          "  --output FILE        write the results to FILE (default: stdout)\n"
+          "  --library NAME=PATH  load structure NAME from PATH\n",
+          SCAN_LENGTH);
+}
+
+static bool parse_count(const char *text, size_t *value) {
+  char *end;
+  errno = 0;
+  unsigned long long parsed = strtoull(text, &end, 10);
+  if (errno || end == text || *end || text[0] == '-')
+    return false;
+  *value = (size_t)parsed;
+  return true;
+}
+
+// Index of 'name' in 'names', -1 if absent
+static int find_name(const char *name, const char *const *names, int count) {
+  for (int i = 0; i < count; i++)
+    if (strcmp(name, names[i]) == 0)
+      return i;
+  return -1;
+}
+
+static Structure *find_structure(const char *name, size_t length) {
+  for (size_t i = 0; i < STRUCTURES; i++)
+    if (strlen(structures[i].name) == length && strncmp(structures[i].name, name, length) == 0)
+      return &structures[i];
+  return NULL;
+}
+
+static bool parse_structures(char *list, Options *o) {
+  memset(o->selected, 0, sizeof(o->selected));
+  for (char *name = strtok(list, ","); name; name = strtok(NULL, ",")) {
+    Structure *s = find_structure(name, strlen(name));
+    if (!s)
+      return false;
+    o->selected[s - structures] = true;
+  }
+  return true;
+}
+
+static bool parse_sizes(char *list, Options *o) {
+  o->size_count = 0;
+  for (char *c = list; *c; c++)
+    o->size_count += *c == ',';
+  o->size_count++;
+  o->sizes = malloc(o->size_count * sizeof(size_t));
+  if (!o->sizes)
+    return false;
+
+  size_t i = 0;
+  for (char *size = strtok(list, ","); size; size = strtok(NULL, ","))
+    if (!parse_count(size, &o->sizes[i++]) || o->sizes[i - 1] == 0)
+      return false;
+  o->size_count = i;
+  return i > 0;
+}
+
+static bool parse_options(int argc, char **argv, Options *o) {
+  static char default_sizes[] = "1000,10000,100000,1000000";
+  static const char *const key_types[] = {"int", "string"};
+  static const char *const request_distributions[] = {"uniform", "zipfian"};
+  static const char *const formats[] = {"csv", "json"};
+  size_t value;
+  int index;
+
+  for (size_t i = 0; i < STRUCTURES; i++)
+    o->selected[i] = true;
+  o->repetitions = 5;
+  o->warmup = 1;
+  o->distribution = DIST_SHUFFLED;
+  o->strings = false;
+  o->workload = WORKLOAD_LOAD;
+  o->zipfian = true;
+  o->operations = 0;
+  o->json = false;
+  o->output = NULL;
+  o->sizes = NULL;
+  bool sizes_given = false;
+
+  for (int i = 1; i < argc; i++) {
+    const char *option = argv[i];
+    if (strcmp(option, "--help") == 0) {
+      usage(stdout);
+      exit(EXIT_SUCCESS);
+    }
+    if (i + 1 == argc) {
+      fprintf(stderr, "tree-bench: %s needs a value\n", option);
+      return false;
+    }
+    char *argument = argv[++i];
+
+    bool ok = true;
+    if (strcmp(option, "--structure") == 0)
+      ok = parse_structures(argument, o);
+    else if (strcmp(option, "--sizes") == 0) {
+      free(o->sizes);
+      ok = parse_sizes(argument, o);
+      sizes_given = true;
+    } else if (strcmp(option, "--repetitions") == 0) {
+      ok = parse_count(argument, &value) && value > 0 && value <= 1000;
+      o->repetitions = (unsigned)value;
+    } else if (strcmp(option, "--warmup") == 0) {
+      ok = parse_count(argument, &value) && value <= 1000;
+      o->warmup = (unsigned)value;
+    } else if (strcmp(option, "--distribution") == 0) {
+      ok = (index = find_name(argument, distribution_names, DISTS)) >= 0;
+      o->distribution = (Distribution)index;
+    } else if (strcmp(option, "--keys") == 0) {
+      ok = (index = find_name(argument, key_types, 2)) >= 0;
+      o->strings = index == 1;
+    } else if (strcmp(option, "--workload") == 0) {
+      ok = (index = find_name(argument, workload_names, WORKLOADS)) >= 0;
+      o->workload = (Workload)index;
+    } else if (strcmp(option, "--request-distribution") == 0) {
+      ok = (index = find_name(argument, request_distributions, 2)) >= 0;
+      o->zipfian = index == 1;
+    } else if (strcmp(option, "--operations") == 0) {
+      ok = parse_count(argument, &o->operations) && o->operations > 0;
+    } else if (strcmp(option, "--format") == 0) {
+      ok = (index = find_name(argument, formats, 2)) >= 0;
+      o->json = index == 1;
+    } else if (strcmp(option, "--output") == 0)
+      o->output = argument;
+    else if (strcmp(option, "--library") == 0) {
+      char *equal = strchr(argument, '=');
+      Structure *s = equal ? find_structure(argument, (size_t)(equal - argument)) : NULL;
+      ok = s != NULL;
+      if (s) {
+        s->path = equal + 1;
+        s->file_name = equal + 1;
+      }
+    } else
+      ok = false;
+
+    if (!ok) {
+      fprintf(stderr, "tree-bench: invalid option %s %s\n", option, argument);
+      return false;
+    }
+  }
+
+  if (o->strings && o->distribution != DIST_SORTED && o->distribution != DIST_SHUFFLED) {
+    fprintf(stderr, "tree-bench: string keys are sorted or shuffled\n");
+    return false;
+  }
+  return sizes_given || parse_sizes(default_sizes, o);
+}
+
+int main(int argc, char **argv) {
+  Options o;
+  if (!parse_options(argc, argv, &o)) {
+    usage(stderr);
+    return EXIT_FAILURE;
+  }
+
+  for (size_t i = 0; i < STRUCTURES; i++) {
+    if (o.selected[i] && !load(&structures[i]))
+      return EXIT_FAILURE;
+    if (o.selected[i] && o.workload == WORKLOAD_E && !can_scan(&structures[i])) {
+      fprintf(stderr, "tree-bench: %s has no cursor, skipped for workload e\n",
+              structures[i].name);
+      o.selected[i] = false;
+    }
+  }
+
+  FILE *out = o.output ? fopen(o.output, "w") : stdout;
+  if (!out) {
+    fprintf(stderr, "tree-bench: cannot write %s\n", o.output);
+    return EXIT_FAILURE;
+  }
+
+  int status = EXIT_SUCCESS;
+  bool first = true;
+  print_header(out, &o);
+  for (size_t i = 0; i < STRUCTURES && status == EXIT_SUCCESS; i++) {
+    if (!o.selected[i])
+      continue;
+    for (size_t k = 0; k < o.size_count; k++) {
+      Stats stats[OPS];
+      fprintf(stderr, "%s n=%zu\n", structures[i].name, o.sizes[k]);
+      if (!bench(&structures[i], &o, o.sizes[k], stats)) {
+        status = EXIT_FAILURE;
+        break;
+      }
+      for (int op = 0; op < OPS; op++) {
+        if (stats[op].count == 0)
+          continue;
+        print_record(out, &o, structures[i].name, o.sizes[k], (Operation)op, &stats[op], first);
+        first = false;
+      }
+    }
+  }
+  print_footer(out, &o);
+
+  if (o.output && fclose(out) != 0)
+    status = EXIT_FAILURE;
+  for (size_t i = 0; i < STRUCTURES; i++)
+    if (structures[i].handle)
+      dlclose(structures[i].handle);
+  free(o.sizes);
+  return status;
+}
@@ -0,0 +1,173 @@
+#include "test.h"
+#include "tree-ops.h"
+#include <errno.h>
+
+/*--------------------------------------------------------------------*/
+/* Side by side comparison: the libraries are linked into this program and
+ * reached through their TreeOps tables, so that every engine runs over the
+ * same key array in the same process. The engine that goes first changes
+ * with each repetition, none of them always meets a cold cache. */
+
+static const TreeOps *const engines[] = {&avl_tree_ops, &bicolor_tree_ops, &btree_tree_ops};
+
+#define ENGINES (sizeof(engines) / sizeof(engines[0]))
+
+typedef enum { PHASE_INSERT, PHASE_SEARCH, PHASE_DELETE, PHASES } Phase;
+
+typedef struct {
+  double *times[PHASES]; // seconds per repetition
+  size_t height;         // after the insertions
+  size_t errors;         // keys missing or left over
+} Measure;
+
+static double seconds_since(const struct timespec *start) {
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  return (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+// Insert, search and delete every key, timing each phase as a whole
+static void run(const TreeOps *ops, int *keys, size_t n, Measure *result, unsigned repetition) {
+  void *tree = NULL;
+  struct timespec start;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (size_t i = 0; i < n; i++)
+    ops->insert(&tree, &keys[i], sizeof(int), compare_int);
+  result->times[PHASE_INSERT][repetition] = seconds_since(&start);
+  result->height = ops->height(tree);
+  result->errors += ops->size(tree) != n;
+
+  size_t found = 0;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (size_t i = 0; i < n; i++)
+    found += ops->search(tree, &keys[i], compare_int) != NULL;
+  result->times[PHASE_SEARCH][repetition] = seconds_since(&start);
+  result->errors += n - found;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (size_t i = 0; i < n; i++)
+    ops->remove(&tree, &keys[i], NULL, compare_int, sizeof(int));
+  result->times[PHASE_DELETE][repetition] = seconds_since(&start);
+  result->errors += ops->size(tree);
+
+  ops->destroy(tree, NULL);
+}
+
+static int compare_double(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+static double median(double *values, unsigned count) {
+  qsort(values, count, sizeof(double), compare_double);
+  return count % 2 ? values[count / 2] : (values[count / 2 - 1] + values[count / 2]) / 2;
+}
+
+// Run every engine over the same shuffled keys, then write their medians
+static bool compare_engines(FILE *out, size_t n, unsigned repetitions) {
+  int *keys = unique_list(n);
+  Measure results[ENGINES];
+  bool ok = keys != NULL;
+  for (size_t e = 0; e < ENGINES; e++) {
+    results[e].errors = 0;
+    for (int p = 0; p < PHASES; p++) {
+      results[e].times[p] = malloc(repetitions * sizeof(double));
+      ok = ok && results[e].times[p];
+    }
+  }
+
+  if (ok) {
+    shuffle_list(keys, n);
+    for (unsigned r = 0; r < repetitions; r++)
+      for (size_t k = 0; k < ENGINES; k++) {
+        size_t e = (r + k) % ENGINES;
+        run(engines[e], keys, n, &results[e], r);
+      }
+
+    for (size_t e = 0; e < ENGINES; e++) {
+      fprintf(out, "%s,%zu,%u,%.10f,%.10f,%.10f,%zu,%zu\n", engines[e]->name, n, repetitions,
+              median(results[e].times[PHASE_INSERT], repetitions),
+              median(results[e].times[PHASE_SEARCH], repetitions),
+              median(results[e].times[PHASE_DELETE], repetitions), results[e].height,
+              results[e].errors);
+      ok = ok && results[e].errors == 0;
+    }
+  } else
+    fprintf(stderr, "tree-compare: out of memory for n=%zu\n", n);
+
+  for (size_t e = 0; e < ENGINES; e++)
+    for (int p = 0; p < PHASES; p++)
+      free(results[e].times[p]);
+  free(keys);
+  return ok;
+}
+
+/*--------------------------------------------------------------------*/
+/* Command line */
+
+static void usage(FILE *out) {
+  fprintf(out, "Usage: tree-compare [options]\n"
+               "  --sizes LIST         element counts (default: 1000,10000,100000,1000000)\n"
+               "  --repetitions N      runs per size, medians are written (default: 5)\n"
+               "  --output FILE        write the CSV to FILE (default: stdout)\n");
+}
+
+static bool parse_count(const char *text, size_t *value) {
+  char *end;
+  errno = 0;
+  unsigned long long parsed = strtoull(text, &end, 10);
+  if (errno || end == text || *end || text[0] == '-')
+    return false;
+  *value = (size_t)parsed;
+  return true;
+}
+
+int main(int argc, char **argv) {
+  char default_sizes[] = "1000,10000,100000,1000000";
+  char *sizes = default_sizes;
+  size_t repetitions = 5;
+  const char *output = NULL;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--help") == 0) {
+      usage(stdout);
+      return EXIT_SUCCESS;
+    }
+    bool ok = i + 1 < argc;
+    if (ok && strcmp(argv[i], "--sizes") == 0)
+      sizes = argv[++i];
+    else if (ok && strcmp(argv[i], "--repetitions") == 0)
+      ok = parse_count(argv[++i], &repetitions) && repetitions > 0 && repetitions <= 1000;
+    else if (ok && strcmp(argv[i], "--output") == 0)
+      output = argv[++i];
+    else
+      ok = false;
+    if (!ok) {
+      fprintf(stderr, "tree-compare: invalid option %s\n", argv[i]);
+      usage(stderr);
+      return EXIT_FAILURE;
+    }
+  }
+
+  FILE *out = output ? fopen(output, "w") : stdout;
+  if (!out) {
+    fprintf(stderr, "tree-compare: cannot write %s\n", output);
+    return EXIT_FAILURE;
+  }
+
+  int status = EXIT_SUCCESS;
+  fprintf(out, "structure,n,repetitions,insert_time,search_time,delete_time,height,errors\n");
+  for (char *size = strtok(sizes, ","); size && status == EXIT_SUCCESS; size = strtok(NULL, ",")) {
+    size_t n;
+    if (!parse_count(size, &n) || n == 0) {
+      fprintf(stderr, "tree-compare: invalid size %s\n", size);
+      status = EXIT_FAILURE;
+    } else if (!compare_engines(out, n, (unsigned)repetitions))
+      status = EXIT_FAILURE;
+  }
+
+  if (output && fclose(out) != 0)
+    status = EXIT_FAILURE;
+  return status;
+}
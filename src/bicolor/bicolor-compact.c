@@ -0,0 +1,397 @@
+#include "bicolor-tree.h"
+#include <string.h>
+
+/*--------------------------------------------------------------------*/
+/* Compact red-black tree: index-addressed pool, color packed in 'left' */
+
+#define NIL 0
+#define INDEX_MASK 0x7fffffffu
+#define RED_BIT 0x80000000u
+#define MAX_NODES INDEX_MASK
+#define MAX_DEPTH 96 // red-black height stays below 2 log2(2^31)
+#define FIRST_CAPACITY 64
+#define SEGMENT_SHIFT 16 // 2^16 slots per segment past the first
+#define SEGMENT_SLOTS ((uint32_t)1 << SEGMENT_SHIFT)
+#define SEGMENT_MASK (SEGMENT_SLOTS - 1)
+
+typedef struct {
+  uint32_t left; // child index in the low 31 bits, red flag on top
+  uint32_t right;
+} Links;
+
+struct _BicolorCompactTree {
+  char **segments; // segment k holds the slots from k << SEGMENT_SHIFT on;
+                   // slot 0 is never used so that index 0 can mean NIL
+  size_t segment_room; // entries of 'segments'
+  size_t size;     // payload size
+  size_t stride;   // bytes per slot: links followed by the payload
+  uint32_t root;
+  uint32_t count;
+  uint32_t used;   // slots handed out so far, including slot 0
+  uint32_t capacity;
+  uint32_t free_list; // released slots, linked through 'right'
+};
+
+#define LINKS(t, i)                                                            \
+  ((Links *)((t)->segments[(i) >> SEGMENT_SHIFT] + (size_t)((i) & SEGMENT_MASK) * (t)->stride))
+#define DATA(t, i) ((char *)LINKS(t, i) + sizeof(Links))
+#define LEFT(t, i) (LINKS(t, i)->left & INDEX_MASK)
+#define RIGHT(t, i) (LINKS(t, i)->right)
+// The NIL slot is never written, so NIL reads as black
+#define IS_RED(t, i) ((i) != NIL && (LINKS(t, i)->left & RED_BIT))
+
+static void set_left(CompactTree t, uint32_t i, uint32_t left) {
+  Links *l = LINKS(t, i);
+  l->left = (l->left & RED_BIT) | left;
+}
+
+static void set_color(CompactTree t, uint32_t i, Color color) {
+  if (i == NIL)
+    return;
+  Links *l = LINKS(t, i);
+  l->left = color == RED ? (l->left | RED_BIT) : (l->left & INDEX_MASK);
+}
+
+static Color get_color(CompactTree t, uint32_t i) {
+  return IS_RED(t, i) ? RED : BLACK;
+}
+
+// Make room for more slots. The first segment doubles up to SEGMENT_SLOTS;
+// past it whole segments are added and no slot moves, so the pool never
+// holds more than one segment of slack, nor a second copy while growing
+static bool pool_grow(CompactTree t) {
+  if (t->capacity < SEGMENT_SLOTS) {
+    char *first = realloc(t->segments[0], (size_t)t->capacity * 2 * t->stride);
+    if (!first)
+      return false;
+    t->segments[0] = first;
+    t->capacity *= 2;
+    return true;
+  }
+
+  size_t count = t->capacity >> SEGMENT_SHIFT;
+  if (count == t->segment_room) {
+    char **segments = realloc(t->segments, 2 * count * sizeof(char *));
+    if (!segments)
+      return false;
+    t->segments = segments;
+    t->segment_room = 2 * count;
+  }
+  char *segment = malloc((size_t)SEGMENT_SLOTS * t->stride);
+  if (!segment)
+    return false;
+  t->segments[count] = segment;
+  t->capacity += SEGMENT_SLOTS;
+  return true;
+}
+
+static uint32_t slot_alloc(CompactTree t) {
+  if (t->free_list != NIL) {
+    uint32_t i = t->free_list;
+    t->free_list = RIGHT(t, i);
+    return i;
+  }
+
+  if (t->used == MAX_NODES || (t->used == t->capacity && !pool_grow(t)))
+    return NIL;
+  return t->used++;
+}
+
+static void slot_free(CompactTree t, uint32_t i) {
+  RIGHT(t, i) = t->free_list;
+  t->free_list = i;
+}
+
+// Make 'parent' (or the root when NIL) point to 'new' instead of 'old'
+static void replace_child(CompactTree t, uint32_t parent, uint32_t old,
+                          uint32_t new) {
+  if (parent == NIL)
+    t->root = new;
+  else if (LEFT(t, parent) == old)
+    set_left(t, parent, new);
+  else
+    RIGHT(t, parent) = new;
+}
+
+// Rotate x under 'parent', return the node that took its place
+static uint32_t rotate_left(CompactTree t, uint32_t parent, uint32_t x) {
+  uint32_t y = RIGHT(t, x);
+  RIGHT(t, x) = LEFT(t, y);
+  set_left(t, y, x);
+  replace_child(t, parent, x, y);
+  return y;
+}
+
+static uint32_t rotate_right(CompactTree t, uint32_t parent, uint32_t x) {
+  uint32_t y = LEFT(t, x);
+  set_left(t, x, RIGHT(t, y));
+  RIGHT(t, y) = x;
+  replace_child(t, parent, x, y);
+  return y;
+}
+
+CompactTree compact_tree_new(size_t size) {
+  CompactTree tree = malloc(sizeof(struct _BicolorCompactTree));
+  if (!tree)
+    return NULL;
+
+  size_t align = size >= sizeof(uint64_t) ? sizeof(uint64_t) : sizeof(uint32_t);
+  tree->size = size;
+  tree->stride = (sizeof(Links) + size + align - 1) & ~(align - 1);
+  tree->segments = malloc(sizeof(char *));
+  char *first = tree->segments ? calloc(FIRST_CAPACITY, tree->stride) : NULL;
+  if (!first) {
+    free(tree->segments);
+    free(tree);
+    return NULL;
+  }
+  tree->segments[0] = first;
+  tree->segment_room = 1;
+  tree->root = NIL;
+  tree->count = 0;
+  tree->used = 1;
+  tree->capacity = FIRST_CAPACITY;
+  tree->free_list = NIL;
+  return tree;
+}
+
+static void delete_nodes(CompactTree t, uint32_t node, void (*delete)(void *)) {
+  if (node != NIL) {
+    delete_nodes(t, LEFT(t, node), delete);
+    delete_nodes(t, RIGHT(t, node), delete);
+    delete (DATA(t, node));
+  }
+}
+
+void compact_tree_delete(CompactTree tree, void (*delete)(void *)) {
+  if (tree) {
+    if (delete)
+      delete_nodes(tree, tree->root, delete);
+    size_t count = tree->capacity > SEGMENT_SLOTS ? tree->capacity >> SEGMENT_SHIFT : 1;
+    for (size_t k = 0; k < count; k++)
+      free(tree->segments[k]);
+    free(tree->segments);
+    free(tree);
+  }
+}
+
+bool compact_tree_insert_sorted(CompactTree tree, const void *data,
+                                int (*compare)(const void *, const void *)) {
+  if (!tree)
+    return false;
+
+  // path[0] is NIL so that path[i - 1] is always the parent of path[i]
+  uint32_t path[MAX_DEPTH + 2];
+  int depth = 0;
+  path[depth++] = NIL;
+
+  uint32_t cur = tree->root;
+  int cmp = 0;
+  while (cur != NIL) {
+    cmp = compare(data, DATA(tree, cur));
+    if (cmp == 0)
+      return false; // don't add duplicates
+    path[depth++] = cur;
+    cur = cmp < 0 ? LEFT(tree, cur) : RIGHT(tree, cur);
+  }
+
+  uint32_t node = slot_alloc(tree);
+  if (node == NIL)
+    return false;
+  LINKS(tree, node)->left = RED_BIT;
+  LINKS(tree, node)->right = NIL;
+  memcpy(DATA(tree, node), data, tree->size);
+  tree->count++;
+
+  uint32_t parent = path[depth - 1];
+  if (parent == NIL)
+    tree->root = node;
+  else if (cmp < 0)
+    set_left(tree, parent, node);
+  else
+    RIGHT(tree, parent) = node;
+  path[depth++] = node;
+
+  // path[depth - 1] is the red node, path[depth - 2] its parent
+  while (depth >= 3 && IS_RED(tree, path[depth - 2])) {
+    uint32_t x = path[depth - 1];
+    uint32_t p = path[depth - 2];
+    uint32_t g = path[depth - 3]; // exists, a red parent is never the root
+    bool left_side = (p == LEFT(tree, g));
+    uint32_t uncle = left_side ? RIGHT(tree, g) : LEFT(tree, g);
+
+    if (IS_RED(tree, uncle)) {
+      set_color(tree, p, BLACK);
+      set_color(tree, uncle, BLACK);
+      set_color(tree, g, RED);
+      depth -= 2;
+    } else {
+      if (left_side && x == RIGHT(tree, p))
+        p = rotate_left(tree, g, p);
+      else if (!left_side && x == LEFT(tree, p))
+        p = rotate_right(tree, g, p);
+
+      set_color(tree, p, BLACK);
+      set_color(tree, g, RED);
+      if (left_side)
+        rotate_right(tree, path[depth - 4], g);
+      else
+        rotate_left(tree, path[depth - 4], g);
+      break;
+    }
+  }
+
+  set_color(tree, tree->root, BLACK);
+  return true;
+}
+
+void compact_node_delete(CompactTree tree, void *data, void (*delete)(void *),
+                         int (*compare)(const void *, const void *)) {
+  if (!tree)
+    return;
+
+  // path[0] is NIL so that path[i - 1] is always the parent of path[i]
+  uint32_t path[MAX_DEPTH + 3];
+  int depth = 0;
+  path[depth++] = NIL;
+
+  uint32_t z = tree->root;
+  while (z != NIL) {
+    int cmp = compare(data, DATA(tree, z));
+    if (cmp == 0)
+      break;
+    path[depth++] = z;
+    z = cmp < 0 ? LEFT(tree, z) : RIGHT(tree, z);
+  }
+  if (z == NIL)
+    return;
+
+  if (delete)
+    delete (DATA(tree, z));
+
+  // Two children: the successor's payload moves into z, the successor goes
+  uint32_t victim = z;
+  if (LEFT(tree, z) != NIL && RIGHT(tree, z) != NIL) {
+    path[depth++] = z;
+    victim = RIGHT(tree, z);
+    while (LEFT(tree, victim) != NIL) {
+      path[depth++] = victim;
+      victim = LEFT(tree, victim);
+    }
+    memcpy(DATA(tree, z), DATA(tree, victim), tree->size);
+  }
+
+  uint32_t x = LEFT(tree, victim) != NIL ? LEFT(tree, victim)
+                                         : RIGHT(tree, victim);
+  uint32_t parent = path[depth - 1];
+  bool x_left = parent != NIL && LEFT(tree, parent) == victim;
+  Color removed = get_color(tree, victim);
+  replace_child(tree, parent, victim, x);
+  slot_free(tree, victim);
+  tree->count--;
+
+  if (removed == RED)
+    return;
+
+  // x carries an extra black, path[depth - 1] is its parent
+  while (depth > 1 && !IS_RED(tree, x)) {
+    uint32_t p = path[depth - 1];
+    uint32_t s = x_left ? RIGHT(tree, p) : LEFT(tree, p);
+
+    if (IS_RED(tree, s)) { // Case 1
+      set_color(tree, s, BLACK);
+      set_color(tree, p, RED);
+      if (x_left)
+        rotate_left(tree, path[depth - 2], p);
+      else
+        rotate_right(tree, path[depth - 2], p);
+      // s now sits between p and its old parent
+      path[depth - 1] = s;
+      path[depth++] = p;
+      s = x_left ? RIGHT(tree, p) : LEFT(tree, p);
+    }
+
+    if (!IS_RED(tree, LEFT(tree, s)) && !IS_RED(tree, RIGHT(tree, s))) {
+      set_color(tree, s, RED); // Case 2
+      x = p;
+      depth--;
+      x_left = depth > 1 && LEFT(tree, path[depth - 1]) == x;
+    } else {
+      if (x_left && !IS_RED(tree, RIGHT(tree, s))) { // Case 3
+        set_color(tree, LEFT(tree, s), BLACK);
+        set_color(tree, s, RED);
+        s = rotate_right(tree, p, s);
+      } else if (!x_left && !IS_RED(tree, LEFT(tree, s))) {
+        set_color(tree, RIGHT(tree, s), BLACK);
+        set_color(tree, s, RED);
+        s = rotate_left(tree, p, s);
+      }
+
+      // Case 4
+      set_color(tree, s, get_color(tree, p));
+      set_color(tree, p, BLACK);
+      if (x_left) {
+        set_color(tree, RIGHT(tree, s), BLACK);
+        rotate_left(tree, path[depth - 2], p);
+      } else {
+        set_color(tree, LEFT(tree, s), BLACK);
+        rotate_right(tree, path[depth - 2], p);
+      }
+      x = tree->root;
+      break;
+    }
+  }
+  set_color(tree, x, BLACK);
+}
+
+void *compact_tree_search(CompactTree tree, const void *data,
+                          int (*compare)(const void *, const void *)) {
+  if (!tree)
+    return NULL;
+
+  uint32_t cur = tree->root;
+  while (cur != NIL) {
+    int cmp = compare(data, DATA(tree, cur));
+    if (cmp == 0)
+      return DATA(tree, cur);
+    cur = cmp < 0 ? LEFT(tree, cur) : RIGHT(tree, cur);
+  }
+  return NULL;
+}
+
+static void in_order(CompactTree t, uint32_t node, void (*func)(void *, void *),
+                     void *extra_data) {
+  if (node != NIL) {
+    in_order(t, LEFT(t, node), func, extra_data);
+    func(DATA(t, node), extra_data);
+    in_order(t, RIGHT(t, node), func, extra_data);
+  }
+}
+
+void compact_tree_in_order(CompactTree tree, void (*func)(void *, void *),
+                           void *extra_data) {
+  if (tree)
+    in_order(tree, tree->root, func, extra_data);
+}
+
+static size_t height(CompactTree t, uint32_t node) {
+  if (node == NIL)
+    return 0;
+  size_t left = height(t, LEFT(t, node));
+  size_t right = height(t, RIGHT(t, node));
+  return 1 + (left > right ? left : right);
+}
+
+size_t compact_tree_height(CompactTree tree) {
+  return tree ? height(tree, tree->root) : 0;
+}
+
+size_t compact_tree_size(CompactTree tree) { return tree ? tree->count : 0; }
+
+size_t compact_tree_memory(CompactTree tree) {
+  if (tree)
+    return sizeof(struct _BicolorCompactTree) + (size_t)tree->capacity * tree->stride +
+           tree->segment_room * sizeof(char *);
+  else
+    return 0;
+}
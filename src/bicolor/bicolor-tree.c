@@ -1,7 +1,349 @@
+#define _POSIX_C_SOURCE 200112L // posix_memalign
+
 #include "bicolor-tree.h"
+#include "task-pool.h"
+#include <pthread.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <string.h>
 
+/* Child and root links are stored atomically (relaxed): the lock-free
+   searches of the concurrent tree load them while a writer relinks */
+#define SET_LINK(link, node) __atomic_store_n(&(link), (node), __ATOMIC_RELAXED)
+
+/*--------------------------------------------------------------------*/
+/* Node arena: one free list and bump pointer per payload size. Nodes are
+   carved from chunks aligned on their size, whose header names the class
+   of their nodes, so a node finds its arena without a pointer of its own.
+   Only a shared arena locks: the others belong to one thread at a time.
+   A tree started outside the user arenas gets a private one, which holds
+   its nodes and no others: tree_delete releases it in one step, and it
+   goes with the last node of the tree otherwise */
+
+#define ARENA_CHUNK ((size_t)1 << 16)
+#define ARENA_MAX_GROUP 64 // chunks per allocation, doubling from 1
+
+typedef struct _BicolorArenaClass {
+  struct _BicolorArenaClass *next;
+  TreeArena arena;
+  size_t size;      // payload size served by this class
+  size_t stride;    // bytes per node, pointer aligned
+  size_t per_chunk; // nodes per chunk, 0 if a node does not fit in one
+  void *free_list;  // released nodes, linked through their first word
+  char *cursor;     // bump pointer inside the current chunk
+  char *end;
+  char *spare;      // chunks allocated with the current one, not used yet
+  size_t spare_count;
+  size_t group;     // chunks of the next allocation
+} ArenaClass;
+
+// Start of every chunk
+typedef struct {
+  ArenaClass *arena_class; // class of the nodes of the chunk
+  void *next;              // previous allocation of the arena, in its first chunk
+} ChunkHeader;
+
+#define CHUNK_NODES(c) ((char *)(c) + sizeof(ChunkHeader))
+
+typedef enum {
+  ARENA_USER,    // tree_arena_new*: released by tree_arena_clear/delete
+  ARENA_PRIVATE, // the nodes of one tree, which holds no other node
+  ARENA_SPREAD,  // private nodes handed to other trees by split, join or a
+                 // set operation: locked, released with its last node
+} ArenaOwner;
+
+struct _BicolorTreeArena {
+  ArenaClass *classes;
+  void *chunks; // allocations of one or more chunks, newest first
+  size_t bytes; // held by 'chunks'
+  size_t live;  // nodes handed out and not given back
+  ArenaOwner owner;
+  bool shared;  // free lists and chunks under 'lock'
+  pthread_mutex_t lock;
+};
+
+static void arena_lock(TreeArena arena) {
+  if (arena->shared)
+    pthread_mutex_lock(&arena->lock);
+}
+
+static void arena_unlock(TreeArena arena) {
+  if (arena->shared)
+    pthread_mutex_unlock(&arena->lock);
+}
+
+static size_t node_stride(size_t size) {
+  size_t bytes = offsetof(struct _BicolorTreeNode, data) + size;
+  return (bytes + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+}
+
+// Class of the nodes of 'size' bytes of payload, created on first use
+static ArenaClass *class_of(TreeArena arena, size_t size) {
+  arena_lock(arena);
+  ArenaClass *c;
+  for (c = arena->classes; c; c = c->next) {
+    if (c->size == size)
+      break;
+  }
+
+  if (!c && (c = calloc(1, sizeof(ArenaClass)))) {
+    c->arena = arena;
+    c->size = size;
+    c->stride = node_stride(size);
+    c->per_chunk = (ARENA_CHUNK - sizeof(ChunkHeader)) / c->stride;
+    c->group = 1;
+    c->next = arena->classes;
+    arena->classes = c;
+  }
+  arena_unlock(arena);
+  return c;
+}
+
+// Class of a node carved from an arena
+static ArenaClass *class_of_node(Tree node) {
+  return ((ChunkHeader *)((uintptr_t)node & ~(uintptr_t)(ARENA_CHUNK - 1)))->arena_class;
+}
+
+// 'count' chunks back to back, the first one linked to the arena's list.
+// Call with the arena locked
+static char *chunks_alloc(ArenaClass *c, size_t count) {
+  void *chunks;
+  if (posix_memalign(&chunks, ARENA_CHUNK, count * ARENA_CHUNK) != 0)
+    return NULL;
+  // A node larger than a chunk spans the allocation: one header only
+  size_t headers = c->per_chunk ? count : 1;
+  for (size_t i = 0; i < headers; i++)
+    ((ChunkHeader *)((char *)chunks + i * ARENA_CHUNK))->arena_class = c;
+  ((ChunkHeader *)chunks)->next = c->arena->chunks;
+  c->arena->chunks = chunks;
+  c->arena->bytes += count * ARENA_CHUNK;
+  return chunks;
+}
+
+static Tree class_alloc(ArenaClass *c) {
+  Tree node = NULL;
+  arena_lock(c->arena);
+  if (c->free_list) {
+    node = c->free_list;
+    c->free_list = *(void **)node;
+  } else if (!c->per_chunk) {
+    // Too large for a chunk: an allocation of its own, reused once freed
+    char *chunks = chunks_alloc(c, (sizeof(ChunkHeader) + c->stride + ARENA_CHUNK - 1) / ARENA_CHUNK);
+    if (chunks)
+      node = (Tree)CHUNK_NODES(chunks);
+  } else {
+    if (c->cursor == c->end) {
+      if (!c->spare_count && (c->spare = chunks_alloc(c, c->group))) {
+        c->spare_count = c->group;
+        if (c->group < ARENA_MAX_GROUP)
+          c->group *= 2;
+      }
+      char *chunk = c->spare_count ? c->spare : NULL;
+      if (chunk) {
+        c->spare += ARENA_CHUNK;
+        c->spare_count--;
+        c->cursor = CHUNK_NODES(chunk);
+        c->end = c->cursor + c->per_chunk * c->stride;
+      }
+    }
+    if (c->cursor != c->end) {
+      node = (Tree)c->cursor;
+      c->cursor += c->stride;
+    }
+  }
+  if (node)
+    c->arena->live++;
+  arena_unlock(c->arena);
+  return node;
+}
+
+// Node from the class 'c', or from malloc if NULL
+static Tree node_alloc(ArenaClass *c, size_t size) {
+  Tree node = c ? class_alloc(c) : malloc(sizeof(struct _BicolorTreeNode) + size);
+  if (node)
+    node->in_arena = c != NULL;
+  return node;
+}
+
+// Give a node back to the free list of its class, or to free()
+static void node_free(Tree node) {
+  if (node->in_arena) {
+    ArenaClass *c = class_of_node(node);
+    TreeArena arena = c->arena;
+    arena_lock(arena);
+    *(void **)node = c->free_list;
+    c->free_list = node;
+    bool emptied = --arena->live == 0 && arena->owner != ARENA_USER;
+    arena_unlock(arena);
+    if (emptied)
+      tree_arena_delete(arena);
+  } else
+    free(node);
+}
+
+// Arena of the nodes of 'tree', NULL for tree_create nodes
+static TreeArena arena_of(Tree tree) {
+  return tree && tree->in_arena ? class_of_node(tree)->arena : NULL;
+}
+
+// Whether 'tree' holds every node of its private arena: only its root
+// does, a subtree shares the arena with its ancestors
+static bool owns_arena(Tree tree) {
+  TreeArena arena = arena_of(tree);
+  return arena && arena->owner == ARENA_PRIVATE && !tree->parent;
+}
+
+// Whether 'tree' has nodes whose class is only safe for one thread
+static bool single_threaded(Tree tree) {
+  TreeArena arena = arena_of(tree);
+  return arena && !arena->shared;
+}
+
+// The nodes of 'tree' are about to meet other trees: its private arena,
+// if any, starts locking and is only released with its last node
+static void arena_spread(Tree tree) {
+  TreeArena arena = arena_of(tree);
+  if (arena && arena->owner == ARENA_PRIVATE) {
+    arena->owner = ARENA_SPREAD;
+    arena->shared = true;
+  }
+}
+
+static TreeArena arena_new(ArenaOwner owner, bool shared) {
+  TreeArena arena = calloc(1, sizeof(struct _BicolorTreeArena));
+  if (arena && pthread_mutex_init(&arena->lock, NULL) != 0) {
+    free(arena);
+    return NULL;
+  }
+  if (arena) {
+    arena->owner = owner;
+    arena->shared = shared;
+  }
+  return arena;
+}
+
+// Class of a new private arena, for a tree started outside any arena
+static ArenaClass *private_class(size_t size) {
+  TreeArena arena = arena_new(ARENA_PRIVATE, false);
+  ArenaClass *c = arena ? class_of(arena, size) : NULL;
+  if (arena && !c)
+    tree_arena_delete(arena);
+  return c;
+}
+
+// Release the private arena of 'c' if no node came out of it
+static void class_drop_unused(ArenaClass *c) {
+  if (c && c->arena->owner != ARENA_USER && c->arena->live == 0)
+    tree_arena_delete(c->arena);
+}
+
+TreeArena tree_arena_new() { return arena_new(ARENA_USER, false); }
+
+TreeArena tree_arena_new_shared() { return arena_new(ARENA_USER, true); }
+
+void tree_arena_clear(TreeArena arena) {
+  if (arena) {
+    arena_lock(arena);
+    while (arena->chunks) {
+      void *next = ((ChunkHeader *)arena->chunks)->next;
+      free(arena->chunks);
+      arena->chunks = next;
+    }
+    for (ArenaClass *c = arena->classes; c; c = c->next) {
+      c->free_list = c->cursor = c->end = c->spare = NULL;
+      c->spare_count = 0;
+      c->group = 1;
+    }
+    arena->live = 0;
+    arena->bytes = 0;
+    arena_unlock(arena);
+  }
+}
+
+size_t tree_arena_memory(TreeArena arena) {
+  if (!arena)
+    return 0;
+  arena_lock(arena);
+  size_t bytes = arena->bytes;
+  arena_unlock(arena);
+  return bytes;
+}
+
+void tree_arena_delete(TreeArena arena) {
+  if (arena) {
+    tree_arena_clear(arena);
+    while (arena->classes) {
+      ArenaClass *next = arena->classes->next;
+      free(arena->classes);
+      arena->classes = next;
+    }
+    pthread_mutex_destroy(&arena->lock);
+    free(arena);
+  }
+}
+
+/*--------------------------------------------------------------------*/
+/* Operation statistics (TREE_STATS): counters of the calling thread. The
+   macros compile to nothing without the option */
+
+enum { OP_SEARCH, OP_INSERT, OP_DELETE };
+
+#ifdef TREE_STATS
+static __thread struct {
+  uint64_t rotations; // every left_rotate/right_rotate, double ones included
+  uint64_t double_rotations;
+  uint64_t recolorings;
+  uint64_t comparisons;
+  uint64_t operations[3];
+  uint64_t visits[3];
+} stats;
+
+#define STAT(field) ((void)stats.field++)
+#define STAT_ADD(field, n) ((void)(stats.field += (n)))
+#define STAT_OPERATION(op) ((void)stats.operations[op]++)
+#define STAT_VISIT(op) ((void)stats.visits[op]++)
+#define COMPARE(compare, a, b) (stats.comparisons++, (compare)(a, b))
+#else
+#define STAT(field) ((void)0)
+#define STAT_ADD(field, n) ((void)0)
+#define STAT_OPERATION(op) ((void)(op))
+#define STAT_VISIT(op) ((void)(op))
+#define COMPARE(compare, a, b) ((compare)(a, b))
+#endif
+
+bool tree_stats(TreeStats *out) {
+  if (!out)
+    return false;
+  memset(out, 0, sizeof(*out));
+#ifdef TREE_STATS
+  out->single_rotations = stats.rotations - 2 * stats.double_rotations;
+  out->double_rotations = stats.double_rotations;
+  out->recolorings = stats.recolorings;
+  out->comparisons = stats.comparisons;
+  out->searches = stats.operations[OP_SEARCH];
+  out->search_visits = stats.visits[OP_SEARCH];
+  out->inserts = stats.operations[OP_INSERT];
+  out->insert_visits = stats.visits[OP_INSERT];
+  out->deletes = stats.operations[OP_DELETE];
+  out->delete_visits = stats.visits[OP_DELETE];
+  return true;
+#else
+  return false;
+#endif
+}
+
+void tree_stats_reset(void) {
+#ifdef TREE_STATS
+  memset(&stats, 0, sizeof(stats));
+#endif
+}
+
+// Set the color of 'node' while rebalancing, counting the changes
+static void paint(Tree node, Color color) {
+  STAT_ADD(recolorings, node->color != color);
+  node->color = color;
+}
+
 // Add method to get grandparent / uncle / min tree
 
 static Tree get_grandparent(Tree n) {
@@ -17,11 +359,11 @@ static Tree get_uncle(Tree n) {
 
 static void replace_node(Tree *root, Tree oldn, Tree newn) {
   if (!oldn->parent)
-    *root = newn;
+    SET_LINK(*root, newn);
   else if (oldn == oldn->parent->left)
-    oldn->parent->left = newn;
+    SET_LINK(oldn->parent->left, newn);
   else
-    oldn->parent->right = newn;
+    SET_LINK(oldn->parent->right, newn);
   if (newn)
     newn->parent = oldn->parent;
 }
@@ -33,8 +375,8 @@ static void delete_fixup(Tree *root, Tree x, Tree parent) {
     Tree s = left_side ? parent->right : parent->left;
 
     if (s && s->color == RED) { // Case 1
-      s->color = BLACK;
-      parent->color = RED;
+      paint(s, BLACK);
+      paint(parent, RED);
       if (left_side)
         left_rotate(root, parent);
       else
@@ -45,31 +387,33 @@ static void delete_fixup(Tree *root, Tree x, Tree parent) {
     if ((!s->left || s->left->color == BLACK) &&
         (!s->right || s->right->color == BLACK)) { // Case 2
       if (s)
-        s->color = RED;
+        paint(s, RED);
       x = parent;
       parent = x ? x->parent : NULL;
     } else {
       if (left_side && (!s->right || s->right->color == BLACK)) { // Case 3
         if (s->left)
-          s->left->color = BLACK;
-        s->color = RED;
+          paint(s->left, BLACK);
+        paint(s, RED);
         right_rotate(root, s);
+        STAT(double_rotations); // with the case 4 rotation below
         s = parent->right;
       } else if (!left_side && (!s->left || s->left->color == BLACK)) {
         if (s->right)
-          s->right->color = BLACK;
-        s->color = RED;
+          paint(s->right, BLACK);
+        paint(s, RED);
         left_rotate(root, s);
+        STAT(double_rotations);
         s = parent->left;
       }
 
       // Case 4
-      s->color = parent->color;
-      parent->color = BLACK;
+      paint(s, parent->color);
+      paint(parent, BLACK);
       if (left_side && s->right)
-        s->right->color = BLACK;
+        paint(s->right, BLACK);
       else if (!left_side && s->left)
-        s->left->color = BLACK;
+        paint(s->left, BLACK);
 
       if (left_side)
         left_rotate(root, parent);
@@ -80,7 +424,7 @@ static void delete_fixup(Tree *root, Tree x, Tree parent) {
     }
   }
   if (x)
-    x->color = BLACK;
+    paint(x, BLACK);
 }
 
 static Tree tree_minimum(Tree n) {
@@ -91,71 +435,135 @@ static Tree tree_minimum(Tree n) {
 
 Tree tree_new() { return NULL; }
 
-void tree_delete(Tree tree, void (*delete)(void *)) {
+// Free the nodes of 'tree' one by one
+static void delete_nodes(Tree tree, void (*delete)(void *)) {
   if (tree) {
-    tree_delete(tree->left, delete);
-    tree_delete(tree->right, delete);
+    delete_nodes(tree->left, delete);
+    delete_nodes(tree->right, delete);
     if (delete)
       delete (tree->data);
-    free(tree);
+    node_free(tree);
+  }
+}
+
+// Call 'delete' on the data of every node, the nodes stay
+static void delete_data(Tree tree, void (*delete)(void *)) {
+  if (tree) {
+    delete_data(tree->left, delete);
+    delete_data(tree->right, delete);
+    delete (tree->data);
   }
 }
 
+void tree_delete(Tree tree, void (*delete)(void *)) {
+  if (owns_arena(tree)) {
+    // The arena holds the nodes of this whole tree only: release it at once
+    if (delete)
+      delete_data(tree, delete);
+    tree_arena_delete(arena_of(tree));
+  } else
+    delete_nodes(tree, delete);
+}
+
+/*--------------------------------------------------------------------*/
+/* Subtree counts (TREE_ORDER_STATISTICS): kept up to date by the rotations
+   and by the insert and remove paths, which recount from the changed node */
+
+#ifdef TREE_ORDER_STATISTICS
+static size_t count_of(Tree node) { return node ? node->count : 0; }
+
+static void update_count(Tree node) {
+  node->count = 1 + count_of(node->left) + count_of(node->right);
+}
+
+static void update_counts_up(Tree node) {
+  for (; node; node = node->parent)
+    update_count(node);
+}
+
+#define set_count(node, n) ((node)->count = (n))
+#else
+static size_t count_of(Tree node) { return tree_size(node); }
+
+#define update_count(node) ((void)0)
+#define update_counts_up(node) ((void)0)
+#define set_count(node, n) ((void)0)
+#endif
+
 void left_rotate(Tree *root, Tree x) {
   Tree y = x->right;
   if (!y)
     return;
+  STAT(rotations);
 
-  x->right = y->left;
+  SET_LINK(x->right, y->left);
   if (y->left)
     y->left->parent = x;
 
   y->parent = x->parent;
   if (!x->parent)
-    *root = y;
+    SET_LINK(*root, y);
   else if (x == x->parent->left)
-    x->parent->left = y;
+    SET_LINK(x->parent->left, y);
   else
-    x->parent->right = y;
+    SET_LINK(x->parent->right, y);
 
-  y->left = x;
+  SET_LINK(y->left, x);
   x->parent = y;
+  update_count(x);
+  update_count(y);
 }
 
 void right_rotate(Tree *root, Tree x) {
   Tree y = x->left;
   if (!y)
     return;
+  STAT(rotations);
 
-  x->left = y->right;
+  SET_LINK(x->left, y->right);
   if (y->right)
     y->right->parent = x;
 
   y->parent = x->parent;
   if (!x->parent)
-    *root = y;
+    SET_LINK(*root, y);
   else if (x == x->parent->right)
-    x->parent->right = y;
+    SET_LINK(x->parent->right, y);
   else
-    x->parent->left = y;
+    SET_LINK(x->parent->left, y);
 
-  y->right = x;
+  SET_LINK(y->right, x);
   x->parent = y;
+  update_count(x);
+  update_count(y);
+}
+
+// Class the insertions into 'tree' take their nodes from: the arena of
+// its root (not a tree_create node), or a new private one for an empty tree
+static ArenaClass *tree_class(Tree tree, size_t size) {
+  if (!tree)
+    return private_class(size);
+  ArenaClass *c = class_of_node(tree);
+  return c->size == size ? c : class_of(c->arena, size);
 }
 
-Tree tree_create(const void *data, size_t size) {
-  Tree tree = malloc(sizeof(struct _BicolorTreeNode) + size);
+// Node from the class 'c', or from malloc if NULL
+static Tree create_node(ArenaClass *c, const void *data, size_t size) {
+  Tree tree = node_alloc(c, size);
   if (tree) {
-    tree->left = NULL;
-    tree->right = NULL;
+    SET_LINK(tree->left, NULL);
+    SET_LINK(tree->right, NULL);
     tree->color = RED;
     tree->parent = NULL;
+    set_count(tree, 1);
     memcpy(tree->data, data, size);
   }
 
   return tree;
 }
 
+Tree tree_create(const void *data, size_t size) { return create_node(NULL, data, size); }
+
 Tree tree_get_left(Tree tree) {
   if (tree)
     return tree->left;
@@ -179,10 +587,13 @@ void *tree_get_data(Tree tree) {
 
 bool tree_set_left(Tree tree, Tree left) {
   if (tree) {
-    tree->left = left;
+    arena_spread(tree);
+    arena_spread(left);
+    SET_LINK(tree->left, left);
     if (left) {
       left->parent = tree;
     }
+    update_count(tree);
     return true;
   } else
     return false;
@@ -190,10 +601,13 @@ bool tree_set_left(Tree tree, Tree left) {
 
 bool tree_set_right(Tree tree, Tree right) {
   if (tree && right) {
-    tree->right = right;
+    arena_spread(tree);
+    arena_spread(right);
+    SET_LINK(tree->right, right);
     if (right) {
       right->parent = tree;
     }
+    update_count(tree);
     return true;
   } else
     return false;
@@ -207,29 +621,9 @@ bool tree_set_data(Tree tree, const void *data, size_t size) {
     return false;
 }
 
-// Insert at the right place if it violates the conditions of a red-black tree
-bool tree_insert_sorted(Tree *root, const void *data, size_t size,
-                        int (*compare)(const void *, const void *)) {
-  Tree parent = NULL, cur = *root;
-
-  while (cur) {
-    parent = cur;
-    int cmp = compare(data, cur->data);
-    if (cmp == 0)
-      return false;
-    cur = (cmp < 0) ? cur->left : cur->right;
-  }
-
-  Tree node = tree_create(data, size);
-  node->parent = parent;
-
-  if (!parent)
-    *root = node;
-  else if (compare(data, parent->data) < 0)
-    parent->left = node;
-  else
-    parent->right = node;
-
+// Restore the red-black properties above the red node 'node'.
+// Returns true if the black height of the tree grew.
+static bool insert_fixup(Tree *root, Tree node) {
   while (node != *root && node->parent->color == RED) {
     Tree g = get_grandparent(node);
     if (!g)
@@ -239,21 +633,23 @@ bool tree_insert_sorted(Tree *root, const void *data, size_t size,
     Tree uncle = get_uncle(node);
 
     if (uncle && uncle->color == RED) {
-      node->parent->color = BLACK;
-      uncle->color = BLACK;
-      g->color = RED;
+      paint(node->parent, BLACK);
+      paint(uncle, BLACK);
+      paint(g, RED);
       node = g;
     } else {
       if (left_side && node == node->parent->right) {
         node = node->parent;
         left_rotate(root, node);
+        STAT(double_rotations); // with the rotation of 'g' below
       } else if (!left_side && node == node->parent->left) {
         node = node->parent;
         right_rotate(root, node);
+        STAT(double_rotations);
       }
 
-      node->parent->color = BLACK;
-      g->color = RED;
+      paint(node->parent, BLACK);
+      paint(g, RED);
       if (left_side)
         right_rotate(root, g);
       else
@@ -261,22 +657,108 @@ bool tree_insert_sorted(Tree *root, const void *data, size_t size,
     }
   }
 
-  (*root)->color = BLACK;
-  return true;
+  bool grew = (*root)->color == RED;
+  paint(*root, BLACK);
+  return grew;
 }
 
-// Remove the element from the tree
-void node_delete(Tree *root, void *data, void (*del)(void *),
-                 int (*compare)(const void *, const void *), size_t size) {
-  Tree z = *root;
+// Descend from 'start' (NULL for the root) to the position of 'data' and
+// insert it there, in a node from 'c' or else from the arena of the root
+// (from malloc if the root is a tree_create node).
+// Returns the node holding 'data', new or already present, or NULL if
+// allocation fails.
+static Tree insert_from(Tree *root, Tree start, const void *data, size_t size,
+                        int (*compare)(const void *, const void *), ArenaClass *c,
+                        bool *inserted) {
+  *inserted = false;
+  STAT_OPERATION(OP_INSERT);
+  Tree parent = start ? start->parent : NULL;
+  Tree cur = start ? start : *root;
+  int cmp = 0;
+
+  while (cur) {
+    STAT_VISIT(OP_INSERT);
+    parent = cur;
+    cmp = COMPARE(compare, data, cur->data);
+    if (cmp == 0)
+      return cur;
+    cur = (cmp < 0) ? cur->left : cur->right;
+  }
+
+  if (!c && (!*root || (*root)->in_arena) && !(c = tree_class(*root, size)))
+    return NULL;
+  Tree node = create_node(c, data, size);
+  if (!node) {
+    class_drop_unused(c);
+    return NULL;
+  }
+  node->parent = parent;
+
+  if (!parent)
+    SET_LINK(*root, node);
+  else if (cmp < 0)
+    SET_LINK(parent->left, node);
+  else
+    SET_LINK(parent->right, node);
+  update_counts_up(parent);
+
+  insert_fixup(root, node);
+  *inserted = true;
+  return node;
+}
+
+// Insert at the right place if it violates the conditions of a red-black tree
+bool tree_insert_sorted(Tree *root, const void *data, size_t size,
+                        int (*compare)(const void *, const void *)) {
+  bool inserted;
+  insert_from(root, NULL, data, size, compare, NULL, &inserted);
+  return inserted;
+}
+
+bool tree_arena_insert(TreeArena arena, Tree *root, const void *data, size_t size,
+                       int (*compare)(const void *, const void *)) {
+  if (!root)
+    return false;
+
+  // 'arena' only starts a tree: the others keep to the arena of their root
+  ArenaClass *c = NULL;
+  if (arena && !*root && !(c = class_of(arena, size)))
+    return false;
+  bool inserted;
+  insert_from(root, NULL, data, size, compare, c, &inserted);
+  return inserted;
+}
+
+// Descend from 'start' looking for 'data', '*last' gets the last node seen.
+// 'op' (OP_SEARCH or OP_DELETE) is the operation counted by TREE_STATS
+static Tree find_from(Tree start, const void *data,
+                      int (*compare)(const void *, const void *), Tree *last, int op) {
+  STAT_OPERATION(op);
+  Tree z = start;
+  *last = start;
   while (z) {
-    int cmp = compare(data, z->data);
+    STAT_VISIT(op);
+    *last = z;
+    int cmp = COMPARE(compare, data, z->data);
     if (cmp == 0)
       break;
     z = (cmp < 0) ? z->left : z->right;
   }
-  if (!z)
-    return;
+  return z;
+}
+
+// Unlink z from the tree and restore the red-black properties.
+// Returns the in-order successor of z, if any.
+static Tree remove_node(Tree *root, Tree z, void (*del)(void *)) {
+  Tree next;
+  if (z->right) {
+    next = tree_minimum(z->right);
+  } else {
+    next = z;
+    while (next->parent && next == next->parent->right)
+      next = next->parent;
+    next = next->parent;
+  }
 
   Tree y = z;
   Color orig = y->color;
@@ -297,12 +779,12 @@ void node_delete(Tree *root, void *data, void (*del)(void *),
     parent = (y->parent == z) ? y : y->parent;
     if (y->parent != z) {
       replace_node(root, y, y->right);
-      y->right = z->right;
+      SET_LINK(y->right, z->right);
       if (y->right)
         y->right->parent = y;
     }
     replace_node(root, z, y);
-    y->left = z->left;
+    SET_LINK(y->left, z->left);
     if (y->left)
       y->left->parent = y;
     y->color = z->color;
@@ -310,10 +792,39 @@ void node_delete(Tree *root, void *data, void (*del)(void *),
 
   if (del)
     del(z->data);
-  free(z);
+  node_free(z);
+  update_counts_up(parent);
 
   if (orig == BLACK)
     delete_fixup(root, x, parent);
+  return next;
+}
+
+// Remove the element from the tree
+void node_delete(Tree *root, void *data, void (*del)(void *),
+                 int (*compare)(const void *, const void *), size_t size) {
+  (void)size; // nodes are relinked, never copied
+  Tree last;
+  Tree z = find_from(*root, data, compare, &last, OP_DELETE);
+  if (z)
+    remove_node(root, z, del);
+}
+
+Tree tree_insert_handle(Tree *root, const void *data, size_t size,
+                        int (*compare)(const void *, const void *),
+                        bool *inserted) {
+  bool done = false;
+  Tree node = root ? insert_from(root, NULL, data, size, compare, NULL, &done) : NULL;
+  if (inserted)
+    *inserted = done;
+  return node;
+}
+
+Tree tree_erase_handle(Tree *root, Tree node, void (*del)(void *)) {
+  if (!root || !node)
+    return NULL;
+  STAT_OPERATION(OP_DELETE);
+  return remove_node(root, node, del);
 }
 
 void tree_pre_order(Tree tree, void (*func)(void *, void *), void *extra_data) {
@@ -341,19 +852,1148 @@ void tree_post_order(Tree tree, void (*func)(void *, void *),
   }
 }
 
+static void *search(Tree tree, const void *data,
+                    int (*compare)(const void *, const void *)) {
+  if (tree) {
+    STAT_VISIT(OP_SEARCH);
+    int cmp = COMPARE(compare, data, tree->data);
+    if (cmp < 0)
+      return search(tree->left, data, compare);
+    if (cmp > 0)
+      return search(tree->right, data, compare);
+    return tree->data;
+  } else
+    return NULL;
+}
+
 void *tree_search(Tree tree, const void *data,
                   int (*compare)(const void *, const void *)) {
+  STAT_OPERATION(OP_SEARCH);
+  return search(tree, data, compare);
+}
+
+size_t tree_height(Tree tree) {
   if (tree) {
-    switch (compare(data, tree->data)) {
-    case -1:
-      return tree_search(tree->left, data, compare);
-    case 0:
-      return tree->data;
-    case 1:
-      return tree_search(tree->right, data, compare);
-    default:
+    size_t left = tree_height(tree->left);
+    size_t right = tree_height(tree->right);
+    return 1 + (left > right ? left : right);
+  } else
+    return 0;
+}
+
+size_t tree_size(Tree tree) {
+#ifdef TREE_ORDER_STATISTICS
+  return tree ? tree->count : 0;
+#else
+  if (tree)
+    return 1 + tree_size(tree->left) + tree_size(tree->right);
+  else
+    return 0;
+#endif
+}
+
+/* tree_sort: the nodes hold an element followed by the indices of the
+   first and last later elements equal to it, chained in input order in a
+   side buffer, so that equal elements are all kept and stay in order.
+   'compare' only reads the element at the start of each payload */
+
+#define SORT_NONE SIZE_MAX
+
+typedef struct {
+  char *out;         // next slot of the array
+  size_t size;
+  const char *equal; // equal elements, each followed by the index of the next one
+} SortOutput;
+
+// In-order callback copying a node's element, then its equal ones
+static void sort_copy(void *node, void *context) {
+  SortOutput *o = context;
+  const char *data = ((Tree)node)->data;
+  size_t entry = o->size + sizeof(size_t);
+  size_t k;
+  memcpy(o->out, data, o->size);
+  o->out += o->size;
+  for (memcpy(&k, data + o->size, sizeof k); k != SORT_NONE;
+       memcpy(&k, o->equal + k * entry + o->size, sizeof k)) {
+    memcpy(o->out, o->equal + k * entry, o->size);
+    o->out += o->size;
+  }
+}
+
+int tree_sort(void *array, size_t length, size_t size,
+              int (*compare)(const void *, const void *)) {
+  if (!array)
+    return false;
+
+  // Input already in order needs no tree at all
+  char *bytes = array;
+  size_t i = 1;
+  while (i < length && COMPARE(compare, bytes + (i - 1) * size, bytes + i * size) <= 0)
+    i++;
+  if (i >= length)
+    return true;
+
+  size_t entry = size + sizeof(size_t);
+  size_t chain[2]; // first and last equal elements of a node
+  char *probe = malloc(size + sizeof chain);
+  char *equal = NULL;
+  size_t equal_count = 0, equal_capacity = 0;
+  Tree tree = tree_new();
+  bool ok = probe != NULL;
+  for (i = 0; i < length && ok; i++) {
+    memcpy(probe, bytes + i * size, size);
+    chain[0] = chain[1] = SORT_NONE;
+    memcpy(probe + size, chain, sizeof chain);
+    bool inserted;
+    Tree node = tree_insert_handle(&tree, probe, size + sizeof chain, compare, &inserted);
+    if (!node || inserted) {
+      ok = node != NULL;
+      continue;
+    }
+
+    // Equal to the element of 'node': append it to the node's chain
+    if (equal_count == equal_capacity) {
+      size_t capacity = equal_capacity ? 2 * equal_capacity : 64;
+      char *grown = realloc(equal, capacity * entry);
+      if (!grown) {
+        ok = false;
+        continue;
+      }
+      equal = grown;
+      equal_capacity = capacity;
+    }
+    size_t next = SORT_NONE;
+    char *e = equal + equal_count * entry;
+    memcpy(e, bytes + i * size, size);
+    memcpy(e + size, &next, sizeof next);
+    memcpy(chain, node->data + size, sizeof chain);
+    if (chain[0] == SORT_NONE)
+      chain[0] = equal_count;
+    else
+      memcpy(equal + chain[1] * entry + size, &equal_count, sizeof(size_t));
+    chain[1] = equal_count++;
+    memcpy(node->data + size, chain, sizeof chain);
+  }
+
+  if (ok) {
+    SortOutput o = {bytes, size, equal};
+    tree_in_order(tree, sort_copy, &o);
+  }
+  tree_delete(tree, NULL); // the private arena goes at once
+  free(equal);
+  free(probe);
+  return ok;
+}
+
+/*--------------------------------------------------------------------*/
+/* Linear-time construction from sorted data */
+
+typedef struct {
+  const char *array;
+  size_t size;
+  ArenaClass *arena_class; // class of the nodes
+  char *block;        // chunks of contiguous nodes, NULL for nodes too large for a chunk
+  size_t red_depth;   // depth of the incomplete last level, colored red
+  bool failed;
+} SortedBuild;
+
+// Node holding element 'mid', its children are left for the caller
+static Tree build_node(SortedBuild *b, size_t mid, Tree parent) {
+  const char *data = b->array + mid * b->size;
+  Tree node;
+
+  if (b->block) {
+    size_t per_chunk = b->arena_class->per_chunk;
+    node = (Tree)(CHUNK_NODES(b->block + mid / per_chunk * ARENA_CHUNK) +
+                  mid % per_chunk * b->arena_class->stride);
+    node->in_arena = true;
+    memcpy(node->data, data, b->size);
+  } else {
+    node = create_node(b->arena_class, data, b->size);
+    if (!node) {
+      __atomic_store_n(&b->failed, true, __ATOMIC_RELAXED);
       return NULL;
     }
+  }
+  node->parent = parent;
+  return node;
+}
+
+// Build elements [lo, lo + count) with the middle one as root. Levels
+// above red_depth are complete, so coloring only the last one red keeps
+// the same number of black nodes on every path.
+static Tree build_sorted(SortedBuild *b, size_t lo, size_t count, Tree parent,
+                         size_t depth) {
+  if (count == 0 || __atomic_load_n(&b->failed, __ATOMIC_RELAXED))
+    return NULL;
+
+  size_t left_count = (count - 1) / 2;
+  size_t mid = lo + left_count;
+  Tree node = build_node(b, mid, parent);
+  if (!node)
+    return NULL;
+  node->color = (depth == b->red_depth) ? RED : BLACK;
+  SET_LINK(node->left, build_sorted(b, lo, left_count, node, depth + 1));
+  SET_LINK(node->right, build_sorted(b, mid + 1, count - 1 - left_count, node, depth + 1));
+  set_count(node, count);
+  return node;
+}
+
+#define PARALLEL_GRAIN 4096 // smaller ranges are built by a single thread
+
+typedef struct {
+  SortedBuild *b;
+  size_t lo;
+  size_t count;
+  Tree parent;
+  size_t depth;
+  int forks;
+  Tree result;
+} BuildTask;
+
+static void build_task(void *arg);
+
+// build_sorted, forking the right half while this thread builds the left one
+static Tree build_parallel(SortedBuild *b, size_t lo, size_t count, Tree parent, size_t depth,
+                           int forks) {
+  if (forks == 0 || count < PARALLEL_GRAIN)
+    return build_sorted(b, lo, count, parent, depth);
+  if (__atomic_load_n(&b->failed, __ATOMIC_RELAXED))
+    return NULL;
+
+  size_t left_count = (count - 1) / 2;
+  size_t mid = lo + left_count;
+  Tree node = build_node(b, mid, parent);
+  if (!node)
+    return NULL;
+  node->color = (depth == b->red_depth) ? RED : BLACK;
+
+  BuildTask right = {b, mid + 1, count - 1 - left_count, node, depth + 1, forks - 1, NULL};
+  Task task = {build_task, &right, 0};
+  task_spawn(&task);
+  SET_LINK(node->left, build_parallel(b, lo, left_count, node, depth + 1, forks - 1));
+  task_wait(&task);
+  SET_LINK(node->right, right.result);
+  set_count(node, count);
+  return node;
+}
+
+static void build_task(void *arg) {
+  BuildTask *t = arg;
+  t->result = build_parallel(t->b, t->lo, t->count, t->parent, t->depth, t->forks);
+}
+
+static Tree from_sorted(TreeArena arena, const void *array, size_t length, size_t size,
+                        bool parallel) {
+  if (!array || length == 0)
+    return NULL;
+
+  // Number of complete levels: floor(log2(length + 1))
+  size_t full_levels = 0;
+  for (size_t n = length + 1; n > 1; n >>= 1)
+    full_levels++;
+
+  // Without an arena the tree gets a private one
+  SortedBuild b = {array, size, arena ? class_of(arena, size) : private_class(size), NULL,
+                   full_levels, false};
+  if (!b.arena_class)
+    return NULL;
+  // Nodes too large for a chunk come from the class one by one
+  if (b.arena_class->per_chunk) {
+    arena = b.arena_class->arena;
+    arena_lock(arena);
+    b.block = chunks_alloc(b.arena_class,
+                           (length + b.arena_class->per_chunk - 1) / b.arena_class->per_chunk);
+    if (b.block)
+      arena->live += length;
+    arena_unlock(arena);
+    if (!b.block) {
+      class_drop_unused(b.arena_class);
+      return NULL;
+    }
+  }
+
+  // The class of an unshared arena takes one thread at a time
+  Tree tree;
+  if (parallel && b.block && length >= PARALLEL_GRAIN && task_pool_enter()) {
+    tree = build_parallel(&b, 0, length, NULL, 0, task_pool_fork_depth());
+    task_pool_leave();
   } else
+    tree = build_sorted(&b, 0, length, NULL, 0);
+  if (b.failed) {
+    if (tree)
+      tree_delete(tree, NULL);
+    else
+      class_drop_unused(b.arena_class);
     return NULL;
-}
\ No newline at end of file
+  }
+  return tree;
+}
+
+Tree tree_from_sorted(const void *array, size_t length, size_t size) {
+  return from_sorted(NULL, array, length, size, false);
+}
+
+Tree tree_arena_from_sorted(TreeArena arena, const void *array, size_t length,
+                            size_t size) {
+  return from_sorted(arena, array, length, size, false);
+}
+
+Tree tree_parallel_from_sorted(const void *array, size_t length, size_t size) {
+  return from_sorted(NULL, array, length, size, true);
+}
+
+/*--------------------------------------------------------------------*/
+/* Linear-time construction from data read once, in order */
+
+typedef struct {
+  size_t size;
+  bool (*next)(void *, void *);
+  void *context;
+  char *buffer;       // element being read
+  ArenaClass *arena_class; // class of the nodes, in a private arena
+  size_t red_depth;   // as in SortedBuild
+  bool failed;
+} StreamBuild;
+
+// Same shape and colors as build_sorted, but the left subtree is built
+// before its root so that elements are consumed in order. On failure the
+// nodes built so far stay linked under the returned root for the caller.
+static Tree build_stream(StreamBuild *s, size_t count, size_t depth) {
+  if (count == 0 || s->failed)
+    return NULL;
+
+  size_t left_count = (count - 1) / 2;
+  Tree left = build_stream(s, left_count, depth + 1);
+  if (s->failed)
+    return left;
+  Tree node = s->next(s->buffer, s->context) ? create_node(s->arena_class, s->buffer, s->size) : NULL;
+  if (!node) {
+    s->failed = true;
+    return left;
+  }
+  node->color = (depth == s->red_depth) ? RED : BLACK;
+  SET_LINK(node->left, left);
+  if (left)
+    left->parent = node;
+  SET_LINK(node->right, build_stream(s, count - 1 - left_count, depth + 1));
+  if (node->right)
+    node->right->parent = node;
+  set_count(node, count);
+  return node;
+}
+
+Tree tree_from_stream(size_t length, size_t size, bool (*next)(void *data, void *context),
+                      void *context) {
+  if (!next || length == 0 || size == 0)
+    return NULL;
+
+  size_t full_levels = 0;
+  for (size_t n = length + 1; n > 1; n >>= 1)
+    full_levels++;
+
+  StreamBuild s = {size, next, context, malloc(size), private_class(size), full_levels, false};
+  if (!s.buffer || !s.arena_class) {
+    free(s.buffer);
+    class_drop_unused(s.arena_class);
+    return NULL;
+  }
+  Tree tree = build_stream(&s, length, 0);
+  free(s.buffer);
+  if (s.failed) {
+    if (tree)
+      tree_delete(tree, NULL);
+    else
+      class_drop_unused(s.arena_class);
+    return NULL;
+  }
+  return tree;
+}
+
+/*--------------------------------------------------------------------*/
+/* Batch operations: keys are visited in ascending order and each descent
+   starts from the node reached by the previous key instead of the root */
+
+// Sort idx[0..count) by the keys they designate (stable merge sort)
+static void merge_sort(size_t *idx, size_t *tmp, size_t count,
+                       const char *data, size_t size,
+                       int (*compare)(const void *, const void *)) {
+  if (count < 2)
+    return;
+
+  size_t half = count / 2;
+  merge_sort(idx, tmp, half, data, size, compare);
+  merge_sort(idx + half, tmp, count - half, data, size, compare);
+  if (COMPARE(compare, data + idx[half - 1] * size, data + idx[half] * size) <= 0)
+    return;
+
+  memcpy(tmp, idx, half * sizeof(size_t));
+  size_t i = 0, j = half, k = 0;
+  while (i < half && j < count) {
+    if (COMPARE(compare, data + tmp[i] * size, data + idx[j] * size) <= 0)
+      idx[k++] = tmp[i++];
+    else
+      idx[k++] = idx[j++];
+  }
+  while (i < half)
+    idx[k++] = tmp[i++];
+}
+
+// Visiting order of a batch, NULL when it is already ascending.
+// '*ordered' is false if the order could not be allocated.
+static size_t *batch_order(const void *data, size_t count, size_t size,
+                           int (*compare)(const void *, const void *),
+                           bool *ordered) {
+  const char *bytes = data;
+  size_t i = 1;
+  while (i < count && COMPARE(compare, bytes + (i - 1) * size, bytes + i * size) <= 0)
+    i++;
+  *ordered = true;
+  if (i >= count)
+    return NULL;
+
+  size_t *idx = malloc(count * sizeof(size_t));
+  size_t *tmp = malloc((count / 2 + 1) * sizeof(size_t));
+  if (!idx || !tmp) {
+    free(idx);
+    free(tmp);
+    *ordered = false;
+    return NULL;
+  }
+  for (i = 0; i < count; i++)
+    idx[i] = i;
+  merge_sort(idx, tmp, count, bytes, size, compare);
+  free(tmp);
+  return idx;
+}
+
+// Lowest ancestor of 'finger' whose subtree may hold 'data', given that
+// 'data' is not smaller than the key whose descent ended on 'finger'
+static Tree climb_from(Tree finger, const void *data,
+                       int (*compare)(const void *, const void *)) {
+  Tree cur = finger;
+  for (;;) {
+    // Right children share the upper bound of their parent
+    Tree top = cur;
+    while (top->parent && top == top->parent->right)
+      top = top->parent;
+    if (!top->parent || COMPARE(compare, data, top->parent->data) < 0)
+      return cur;
+    cur = top->parent;
+  }
+}
+
+// Mirror of climb_from for 'data' not greater than the key of 'finger'
+static Tree climb_back(Tree finger, const void *data,
+                       int (*compare)(const void *, const void *)) {
+  Tree cur = finger;
+  for (;;) {
+    // Left children share the lower bound of their parent
+    Tree top = cur;
+    while (top->parent && top == top->parent->left)
+      top = top->parent;
+    if (!top->parent || COMPARE(compare, data, top->parent->data) > 0)
+      return cur;
+    cur = top->parent;
+  }
+}
+
+size_t tree_insert_batch(Tree *ptree, const void *data, size_t count,
+                         size_t size,
+                         int (*compare)(const void *, const void *),
+                         bool *inserted) {
+  if (!ptree || !data)
+    return 0;
+
+  bool ordered;
+  size_t *order = batch_order(data, count, size, compare, &ordered);
+  Tree finger = NULL;
+  size_t total = 0;
+
+  for (size_t k = 0; k < count; k++) {
+    size_t i = order ? order[k] : k;
+    const char *key = (const char *)data + i * size;
+    Tree start = (ordered && finger) ? climb_from(finger, key, compare) : NULL;
+
+    bool done;
+    Tree node = insert_from(ptree, start, key, size, compare, NULL, &done);
+    if (node)
+      finger = node;
+    if (inserted)
+      inserted[i] = done;
+    total += done;
+  }
+
+  free(order);
+  return total;
+}
+
+size_t tree_search_batch(Tree tree, const void *data, size_t count,
+                         size_t size,
+                         int (*compare)(const void *, const void *),
+                         void **found) {
+  if (!data)
+    return 0;
+
+  bool ordered;
+  size_t *order = batch_order(data, count, size, compare, &ordered);
+  Tree finger = NULL;
+  size_t total = 0;
+
+  for (size_t k = 0; k < count; k++) {
+    size_t i = order ? order[k] : k;
+    const char *key = (const char *)data + i * size;
+    Tree start = (ordered && finger) ? climb_from(finger, key, compare) : tree;
+
+    Tree node = find_from(start, key, compare, &finger, OP_SEARCH);
+    if (found)
+      found[i] = node ? node->data : NULL;
+    total += node != NULL;
+  }
+
+  free(order);
+  return total;
+}
+
+size_t tree_delete_batch(Tree *ptree, const void *data, size_t count,
+                         size_t size, void (*delete)(void *),
+                         int (*compare)(const void *, const void *),
+                         bool *deleted) {
+  if (!ptree || !data)
+    return 0;
+
+  bool ordered;
+  size_t *order = batch_order(data, count, size, compare, &ordered);
+  Tree finger = NULL;
+  size_t total = 0;
+
+  for (size_t k = 0; k < count; k++) {
+    size_t i = order ? order[k] : k;
+    const char *key = (const char *)data + i * size;
+    Tree start = (ordered && finger) ? climb_from(finger, key, compare) : *ptree;
+
+    Tree node = find_from(start, key, compare, &finger, OP_DELETE);
+    if (node)
+      finger = remove_node(ptree, node, delete); // successor, if any
+    if (deleted)
+      deleted[i] = node != NULL;
+    total += node != NULL;
+  }
+
+  free(order);
+  return total;
+}
+
+/*--------------------------------------------------------------------*/
+/* Finger hints: like the batch operations, but the finger is kept by the
+   caller between calls and the next key may lie on either side of it */
+
+// Lowest ancestor of 'finger' whose subtree may hold 'data'
+static Tree climb_toward(Tree finger, const void *data,
+                         int (*compare)(const void *, const void *)) {
+  if (COMPARE(compare, data, finger->data) < 0)
+    return climb_back(finger, data, compare);
+  return climb_from(finger, data, compare);
+}
+
+void *tree_search_hint(Tree tree, Tree *hint, const void *data,
+                       int (*compare)(const void *, const void *)) {
+  Tree finger = hint ? *hint : NULL;
+  Tree start = finger ? climb_toward(finger, data, compare) : tree;
+
+  Tree node = find_from(start, data, compare, &finger, OP_SEARCH);
+  if (hint)
+    *hint = node ? node : finger;
+  return node ? node->data : NULL;
+}
+
+bool tree_insert_hint(Tree *root, Tree *hint, const void *data, size_t size,
+                      int (*compare)(const void *, const void *)) {
+  if (!root)
+    return false;
+
+  Tree finger = hint ? *hint : NULL;
+  Tree start = finger ? climb_toward(finger, data, compare) : NULL;
+
+  bool inserted;
+  Tree node = insert_from(root, start, data, size, compare, NULL, &inserted);
+  if (hint && node)
+    *hint = node;
+  return inserted;
+}
+
+/*--------------------------------------------------------------------*/
+/* Parallel walks: the right subtree is forked while the calling thread
+   walks the left one, down to task_pool_fork_depth() levels */
+
+typedef enum {
+  WALK_PRE_ORDER,
+  WALK_IN_ORDER,
+  WALK_POST_ORDER,
+  WALK_SIZE,
+  WALK_DELETE,
+  WALK_DELETE_DATA // 'delete' on every payload, the nodes stay
+} WalkOrder;
+
+typedef struct {
+  WalkOrder order;
+  void (*func)(void *, void *);
+  void *extra_data;
+  void (*delete)(void *);
+} Walk;
+
+typedef struct {
+  const Walk *walk;
+  Tree tree;
+  int forks;
+  size_t count;
+} WalkTask;
+
+// Walk a whole subtree on this thread, returns its size for WALK_SIZE
+static size_t walk_sequential(const Walk *w, Tree tree) {
+  switch (w->order) {
+  case WALK_PRE_ORDER:
+    tree_pre_order(tree, w->func, w->extra_data);
+    break;
+  case WALK_IN_ORDER:
+    tree_in_order(tree, w->func, w->extra_data);
+    break;
+  case WALK_POST_ORDER:
+    tree_post_order(tree, w->func, w->extra_data);
+    break;
+  case WALK_SIZE:
+    return tree_size(tree);
+  case WALK_DELETE:
+    delete_nodes(tree, w->delete);
+    break;
+  case WALK_DELETE_DATA:
+    delete_data(tree, w->delete);
+    break;
+  }
+  return 0;
+}
+
+static void walk_task(void *arg);
+
+static size_t walk(const Walk *w, Tree tree, int forks) {
+  if (!tree || forks == 0)
+    return walk_sequential(w, tree);
+
+  if (w->order == WALK_PRE_ORDER)
+    w->func(tree, w->extra_data);
+
+  WalkTask right = {w, tree->right, forks - 1, 0};
+  Task task = {walk_task, &right, 0};
+  task_spawn(&task);
+  size_t count = walk(w, tree->left, forks - 1);
+  if (w->order == WALK_IN_ORDER)
+    w->func(tree, w->extra_data);
+  task_wait(&task);
+  count += right.count + 1;
+
+  if (w->order == WALK_POST_ORDER)
+    w->func(tree, w->extra_data);
+  else if (w->order == WALK_DELETE) {
+    if (w->delete)
+      w->delete (tree->data);
+    node_free(tree);
+  } else if (w->order == WALK_DELETE_DATA)
+    w->delete (tree->data);
+  return count;
+}
+
+static void walk_task(void *arg) {
+  WalkTask *t = arg;
+  t->count = walk(t->walk, t->tree, t->forks);
+}
+
+static size_t walk_parallel(const Walk *w, Tree tree) {
+  // The free lists of an unshared arena take one thread at a time
+  if (!tree || (w->order == WALK_DELETE && single_threaded(tree)) || !task_pool_enter())
+    return walk_sequential(w, tree);
+
+  size_t count = walk(w, tree, task_pool_fork_depth());
+  task_pool_leave();
+  return count;
+}
+
+void tree_parallel_threads(unsigned threads) { task_pool_resize(threads); }
+
+size_t tree_parallel_size(Tree tree) {
+  Walk w = {WALK_SIZE, NULL, NULL, NULL};
+  return walk_parallel(&w, tree);
+}
+
+void tree_parallel_pre_order(Tree tree, void (*func)(void *, void *), void *extra_data) {
+  Walk w = {WALK_PRE_ORDER, func, extra_data, NULL};
+  walk_parallel(&w, tree);
+}
+
+void tree_parallel_in_order(Tree tree, void (*func)(void *, void *), void *extra_data) {
+  Walk w = {WALK_IN_ORDER, func, extra_data, NULL};
+  walk_parallel(&w, tree);
+}
+
+void tree_parallel_post_order(Tree tree, void (*func)(void *, void *), void *extra_data) {
+  Walk w = {WALK_POST_ORDER, func, extra_data, NULL};
+  walk_parallel(&w, tree);
+}
+
+void tree_parallel_delete(Tree tree, void (*delete)(void *)) {
+  // A private arena goes at once, after the callbacks
+  if (owns_arena(tree)) {
+    TreeArena arena = arena_of(tree);
+    if (delete) {
+      Walk w = {WALK_DELETE_DATA, NULL, NULL, delete};
+      walk_parallel(&w, tree);
+    }
+    tree_arena_delete(arena);
+    return;
+  }
+  Walk w = {WALK_DELETE, NULL, NULL, delete};
+  walk_parallel(&w, tree);
+}
+
+/*--------------------------------------------------------------------*/
+/* Split and join. The rank of a tree is its black height, counted once
+   per call and then derived for each subtree */
+
+static int rank_of(Tree tree) {
+  int black = 0;
+  for (; tree; tree = tree->left)
+    black += tree->color == BLACK;
+  return black;
+}
+
+// Black height of one child of 'tree', whose black height is 'rank'
+static int child_rank(Tree tree, int rank, bool left) {
+  (void)left;
+  return rank - (tree->color == BLACK);
+}
+
+static void reset_node(Tree node) {
+  node->parent = NULL;
+  SET_LINK(node->left, NULL);
+  SET_LINK(node->right, NULL);
+  node->color = RED;
+  set_count(node, 1);
+}
+
+// Make 'node' the root of 'left' and 'right'
+static void join_node(Tree node, Tree left, Tree right, Color color) {
+  SET_LINK(node->left, left);
+  SET_LINK(node->right, right);
+  node->color = color;
+  if (left)
+    left->parent = node;
+  if (right)
+    right->parent = node;
+  update_count(node);
+}
+
+// Join detached trees with left < node < right: 'node' is hung red on the
+// spine of the tree with more black levels, above the first black node of
+// the other tree's black height, then fixed up like an insertion
+static Tree join_ranked(Tree left, int left_rank, Tree node, Tree right, int right_rank,
+                        int *rank) {
+  // A red root of a subtree that is now on its own turns black
+  if (left && left->color == RED) {
+    left->color = BLACK;
+    left_rank++;
+  }
+  if (right && right->color == RED) {
+    right->color = BLACK;
+    right_rank++;
+  }
+
+  if (left_rank > right_rank) {
+    Tree parent = NULL, spine = left;
+    int black = left_rank;
+    while (spine && (spine->color == RED || black > right_rank)) {
+      black -= spine->color == BLACK;
+      parent = spine;
+      spine = spine->right;
+    }
+    join_node(node, spine, right, RED);
+    node->parent = parent;
+    SET_LINK(parent->right, node);
+    update_counts_up(parent);
+    *rank = left_rank + insert_fixup(&left, node);
+    return left;
+  }
+
+  if (right_rank > left_rank) {
+    Tree parent = NULL, spine = right;
+    int black = right_rank;
+    while (spine && (spine->color == RED || black > left_rank)) {
+      black -= spine->color == BLACK;
+      parent = spine;
+      spine = spine->left;
+    }
+    join_node(node, left, spine, RED);
+    node->parent = parent;
+    SET_LINK(parent->left, node);
+    update_counts_up(parent);
+    *rank = right_rank + insert_fixup(&right, node);
+    return right;
+  }
+
+  join_node(node, left, right, BLACK);
+  node->parent = NULL;
+  *rank = left_rank + 1;
+  return node;
+}
+
+// Detach 'tree' from its parent so that it can be joined on its own
+static Tree detach(Tree tree) {
+  if (tree)
+    tree->parent = NULL;
+  return tree;
+}
+
+// Split 'tree' around 'data': smaller keys go to 'left', larger ones to
+// 'right', and the node holding 'data', if any, is returned detached
+static Tree split_ranked(Tree tree, int rank, const void *data,
+                         int (*compare)(const void *, const void *),
+                         Tree *left, int *left_rank, Tree *right, int *right_rank) {
+  if (!tree) {
+    *left = *right = NULL;
+    *left_rank = *right_rank = 0;
+    return NULL;
+  }
+
+  Tree l = detach(tree->left), r = detach(tree->right);
+  int rl = child_rank(tree, rank, true), rr = child_rank(tree, rank, false);
+  int cmp = COMPARE(compare, data, tree->data);
+  Tree found;
+  if (cmp < 0) {
+    Tree rest;
+    int rest_rank;
+    found = split_ranked(l, rl, data, compare, left, left_rank, &rest, &rest_rank);
+    *right = join_ranked(rest, rest_rank, tree, r, rr, right_rank);
+  } else if (cmp > 0) {
+    Tree rest;
+    int rest_rank;
+    found = split_ranked(r, rr, data, compare, &rest, &rest_rank, right, right_rank);
+    *left = join_ranked(l, rl, tree, rest, rest_rank, left_rank);
+  } else {
+    *left = l;
+    *left_rank = rl;
+    *right = r;
+    *right_rank = rr;
+    found = tree;
+    reset_node(found);
+  }
+  return found;
+}
+
+// Take the largest node out of 'tree' (not empty), the rest goes to 'rest'
+static Tree split_last(Tree tree, int rank, Tree *rest, int *rest_rank) {
+  Tree l = detach(tree->left);
+  int rl = child_rank(tree, rank, true);
+  if (!tree->right) {
+    *rest = l;
+    *rest_rank = rl;
+    reset_node(tree);
+    return tree;
+  }
+
+  Tree r;
+  int rr;
+  Tree last = split_last(detach(tree->right), child_rank(tree, rank, false), &r, &rr);
+  *rest = join_ranked(l, rl, tree, r, rr, rest_rank);
+  return last;
+}
+
+// Join two trees without a middle node
+static Tree join2_ranked(Tree left, int left_rank, Tree right, int right_rank, int *rank) {
+  if (!left) {
+    *rank = right_rank;
+    return right;
+  }
+  if (!right) {
+    *rank = left_rank;
+    return left;
+  }
+  Tree rest;
+  int rest_rank;
+  Tree last = split_last(left, left_rank, &rest, &rest_rank);
+  return join_ranked(rest, rest_rank, last, right, right_rank, rank);
+}
+
+Tree tree_split(Tree tree, const void *data, int (*compare)(const void *, const void *),
+                Tree *left, Tree *right) {
+  Tree l = NULL, r = NULL, found = NULL;
+  int rl, rr;
+  arena_spread(tree);
+  if (compare)
+    found = split_ranked(detach(tree), rank_of(tree), data, compare, &l, &rl, &r, &rr);
+  if (left)
+    *left = l;
+  if (right)
+    *right = r;
+  return found;
+}
+
+Tree tree_join(Tree left, Tree node, Tree right) {
+  int rank;
+  arena_spread(left);
+  arena_spread(node);
+  arena_spread(right);
+  if (!node)
+    return join2_ranked(detach(left), rank_of(left), detach(right), rank_of(right), &rank);
+  reset_node(node);
+  return join_ranked(detach(left), rank_of(left), node, detach(right), rank_of(right), &rank);
+}
+
+/* Union, intersection and difference: split one tree by the root of the
+   other, recurse on both sides (forked near the top) and join the results */
+
+typedef enum { SET_UNION, SET_INTERSECTION, SET_DIFFERENCE } SetOp;
+
+typedef struct {
+  SetOp op;
+  void (*delete)(void *);
+  int (*compare)(const void *, const void *);
+} SetOps;
+
+typedef struct {
+  const SetOps *ops;
+  Tree a, b;
+  int rank_a, rank_b;
+  int forks;
+  Tree result;
+  int rank;
+} SetTask;
+
+// Release a node left out of the result
+static void drop_node(const SetOps *s, Tree node) {
+  if (s->delete)
+    s->delete (node->data);
+  node_free(node);
+}
+
+static void drop_tree(const SetOps *s, Tree tree) {
+  if (tree) {
+    drop_tree(s, tree->left);
+    drop_tree(s, tree->right);
+    drop_node(s, tree);
+  }
+}
+
+static Tree set_run(const SetOps *s, Tree a, int rank_a, Tree b, int rank_b, int forks,
+                    int *rank);
+
+static void set_task(void *arg) {
+  SetTask *t = arg;
+  t->result = set_run(t->ops, t->a, t->rank_a, t->b, t->rank_b, t->forks, &t->rank);
+}
+
+// Run the operation on both pairs of halves, the second one forked
+static void set_halves(SetTask *low, SetTask *high, bool fork) {
+  if (fork) {
+    Task task = {set_task, high, 0};
+    task_spawn(&task);
+    set_task(low);
+    task_wait(&task);
+  } else {
+    set_task(low);
+    set_task(high);
+  }
+}
+
+static Tree set_run(const SetOps *s, Tree a, int rank_a, Tree b, int rank_b, int forks,
+                    int *rank) {
+  if (!a || !b) {
+    // Union keeps the other tree, difference keeps 'a', intersection nothing
+    Tree kept = NULL;
+    if (s->op == SET_UNION)
+      kept = a ? a : b;
+    else if (s->op == SET_DIFFERENCE)
+      kept = a;
+    drop_tree(s, kept == a ? b : a);
+    *rank = kept == a ? rank_a : rank_b;
+    return kept;
+  }
+
+  // Difference splits the left operand, so that every node it keeps is its own
+  Tree pivot = s->op == SET_DIFFERENCE ? b : a;
+  Tree other = s->op == SET_DIFFERENCE ? a : b;
+  int pivot_rank = s->op == SET_DIFFERENCE ? rank_b : rank_a;
+  int other_rank = s->op == SET_DIFFERENCE ? rank_a : rank_b;
+
+  Tree pivot_low = detach(pivot->left), pivot_high = detach(pivot->right);
+  int pivot_low_rank = child_rank(pivot, pivot_rank, true);
+  int pivot_high_rank = child_rank(pivot, pivot_rank, false);
+  Tree other_low, other_high;
+  int other_low_rank, other_high_rank;
+  Tree found = split_ranked(other, other_rank, pivot->data, s->compare,
+                            &other_low, &other_low_rank, &other_high, &other_high_rank);
+
+  int child_forks = forks > 0 ? forks - 1 : 0;
+  SetTask low, high;
+  if (s->op == SET_DIFFERENCE) {
+    low = (SetTask){s, other_low, pivot_low, other_low_rank, pivot_low_rank, child_forks, NULL, 0};
+    high = (SetTask){s, other_high, pivot_high, other_high_rank, pivot_high_rank, child_forks, NULL, 0};
+  } else {
+    low = (SetTask){s, pivot_low, other_low, pivot_low_rank, other_low_rank, child_forks, NULL, 0};
+    high = (SetTask){s, pivot_high, other_high, pivot_high_rank, other_high_rank, child_forks, NULL, 0};
+  }
+  set_halves(&low, &high, forks > 0);
+
+  bool keep_pivot = s->op == SET_UNION || (s->op == SET_INTERSECTION && found);
+  if (found)
+    drop_node(s, found);
+  if (keep_pivot) {
+    reset_node(pivot);
+    return join_ranked(low.result, low.rank, pivot, high.result, high.rank, rank);
+  }
+  drop_node(s, pivot);
+  return join2_ranked(low.result, low.rank, high.result, high.rank, rank);
+}
+
+static Tree set_operation(SetOp op, Tree a, Tree b, void (*delete)(void *),
+                          int (*compare)(const void *, const void *), size_t size) {
+  if (!compare)
+    return a;
+
+  (void)size; // the dropped nodes find their arena from their chunk
+  SetOps s = {op, delete, compare};
+  int rank;
+  a = detach(a);
+  b = detach(b);
+  arena_spread(a);
+  arena_spread(b);
+  // Dropped nodes go back to the free lists of their arena: an unshared
+  // one takes them from a single thread
+  if (a && b && !single_threaded(a) && !single_threaded(b) && task_pool_enter()) {
+    Tree result = set_run(&s, a, rank_of(a), b, rank_of(b), task_pool_fork_depth(), &rank);
+    task_pool_leave();
+    return result;
+  }
+  return set_run(&s, a, rank_of(a), b, rank_of(b), 0, &rank);
+}
+
+Tree tree_union(Tree a, Tree b, void (*delete)(void *),
+                int (*compare)(const void *, const void *), size_t size) {
+  return set_operation(SET_UNION, a, b, delete, compare, size);
+}
+
+Tree tree_intersection(Tree a, Tree b, void (*delete)(void *),
+                       int (*compare)(const void *, const void *), size_t size) {
+  return set_operation(SET_INTERSECTION, a, b, delete, compare, size);
+}
+
+Tree tree_difference(Tree a, Tree b, void (*delete)(void *),
+                     int (*compare)(const void *, const void *), size_t size) {
+  return set_operation(SET_DIFFERENCE, a, b, delete, compare, size);
+}
+
+/*--------------------------------------------------------------------*/
+/* Order statistics: one descent, each step costs count_of() */
+
+// Number of keys below 'data', or up to it when 'inclusive'
+static size_t count_below(Tree tree, const void *data,
+                          int (*compare)(const void *, const void *), bool inclusive) {
+  size_t below = 0;
+  while (tree) {
+    int cmp = COMPARE(compare, data, tree->data);
+    if (cmp == 0)
+      return below + count_of(tree->left) + inclusive;
+    if (cmp < 0) {
+      tree = tree->left;
+    } else {
+      below += count_of(tree->left) + 1;
+      tree = tree->right;
+    }
+  }
+  return below;
+}
+
+size_t tree_rank(Tree tree, const void *data,
+                 int (*compare)(const void *, const void *)) {
+  return compare ? count_below(tree, data, compare, false) : 0;
+}
+
+void *tree_select(Tree tree, size_t index) {
+  while (tree) {
+    size_t left = count_of(tree->left);
+    if (index == left)
+      return tree->data;
+    if (index < left) {
+      tree = tree->left;
+    } else {
+      index -= left + 1;
+      tree = tree->right;
+    }
+  }
+  return NULL;
+}
+
+size_t tree_count_range(Tree tree, const void *low, const void *high,
+                        int (*compare)(const void *, const void *)) {
+  if (!compare || COMPARE(compare, low, high) > 0)
+    return 0;
+  return count_below(tree, high, compare, true) - count_below(tree, low, compare, false);
+}
+
+/*--------------------------------------------------------------------*/
+/* Ordered iteration: cursors are nodes, stepped through the parents */
+
+Tree tree_first(Tree tree) {
+  while (tree && tree->left)
+    tree = tree->left;
+  return tree;
+}
+
+Tree tree_last(Tree tree) {
+  while (tree && tree->right)
+    tree = tree->right;
+  return tree;
+}
+
+// Leftmost node whose key is above 'data', or at least 'data' when 'inclusive'
+static Tree bound(Tree tree, const void *data,
+                  int (*compare)(const void *, const void *), bool inclusive) {
+  Tree found = NULL;
+  while (tree) {
+    int cmp = COMPARE(compare, data, tree->data);
+    if (cmp < 0 || (inclusive && cmp == 0)) {
+      found = tree;
+      tree = tree->left;
+    } else {
+      tree = tree->right;
+    }
+  }
+  return found;
+}
+
+Tree tree_lower_bound(Tree tree, const void *data,
+                      int (*compare)(const void *, const void *)) {
+  return compare ? bound(tree, data, compare, true) : NULL;
+}
+
+Tree tree_upper_bound(Tree tree, const void *data,
+                      int (*compare)(const void *, const void *)) {
+  return compare ? bound(tree, data, compare, false) : NULL;
+}
+
+Tree iter_next(Tree node) {
+  if (!node)
+    return NULL;
+  if (node->right)
+    return tree_first(node->right);
+  while (node->parent && node == node->parent->right)
+    node = node->parent;
+  return node->parent;
+}
+
+Tree iter_prev(Tree node) {
+  if (!node)
+    return NULL;
+  if (node->left)
+    return tree_last(node->left);
+  while (node->parent && node == node->parent->left)
+    node = node->parent;
+  return node->parent;
+}
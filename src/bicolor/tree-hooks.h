@@ -0,0 +1,20 @@
+#ifndef TREE_HOOKS_H
+#define TREE_HOOKS_H
+
+/*
+ * Per-library side of the modules of src/common. They only use the public
+ * tree API, and each tree library compiles them against its own header,
+ * found through this file.
+ */
+#include "bicolor-tree.h"
+
+/* Tag of an opaque type of the header: TREE_STRUCT(TreeSnapshot) is struct _BicolorTreeSnapshot */
+#define TREE_STRUCT(name) struct _Bicolor##name
+
+/* Kind written in and required from a tree file header */
+#define TREE_FILE_KIND TREE_FILE_BICOLOR
+
+/* Value stored in the balance field of a tree file record */
+#define TREE_FILE_BALANCE(node) ((node)->color)
+
+#endif
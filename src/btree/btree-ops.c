@@ -0,0 +1,40 @@
+#include "btree-tree.h"
+#include "tree-ops.h"
+
+/*--------------------------------------------------------------------*/
+/* Dispatch table: the B+-tree functions with the void * trees of TreeOps.
+ * There is no cursor API, the cursor entries are NULL. */
+
+static bool insert(void *root, const void *data, size_t size,
+                   int (*compare)(const void *, const void *)) {
+  return btree_insert_sorted(root, data, size, compare);
+}
+
+static void *search(void *tree, const void *data,
+                    int (*compare)(const void *, const void *)) {
+  return btree_search(tree, data, compare);
+}
+
+static void remove_data(void *root, void *data, void (*delete)(void *),
+                        int (*compare)(const void *, const void *), size_t size) {
+  btree_node_delete(root, data, delete, compare, size);
+}
+
+static void destroy(void *tree, void (*delete)(void *)) { btree_delete(tree, delete); }
+
+static size_t size_of(void *tree) { return btree_size(tree); }
+
+static size_t height(void *tree) { return btree_height(tree); }
+
+const TreeOps btree_tree_ops = {
+    .name = "btree",
+    .insert = insert,
+    .search = search,
+    .remove = remove_data,
+    .destroy = destroy,
+    .size = size_of,
+    .height = height,
+    .lower_bound = NULL,
+    .next = NULL,
+    .data = NULL,
+};
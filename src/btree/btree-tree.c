@@ -0,0 +1,398 @@
+#include "btree-tree.h"
+#include "min-max.h"
+#include <stddef.h>
+#include <string.h>
+
+/*--------------------------------------------------------------------*/
+/* Node layout: header, then children (inner nodes only), then payloads.
+ * Every node keeps room for one payload (and child) more than its
+ * capacity, so that a full node takes the insertion before being split. */
+
+#define CACHE_LINE 64
+#define MIN_CAPACITY 4
+#define MAX_HEIGHT 64 // fanout >= 5, far more than any 64-bit count needs
+
+typedef struct _BTreeNode {
+  struct _BTreeNode *next; // leaves: right sibling, NULL for the last leaf
+  uint32_t count;          // payloads held by the node
+  uint32_t leaf;
+  char body[];
+} Node;
+
+struct _BTree {
+  Node *root;
+  size_t size;       // payload size
+  size_t count;
+  size_t height;
+  size_t leaf_cap;   // payloads per leaf
+  size_t inner_cap;  // separators per inner node, children: inner_cap + 1
+  size_t node_bytes;
+};
+
+#define CHILDREN(n) ((Node **)(n)->body)
+
+static char *key_at(BTree t, Node *n, size_t i) {
+  if (n->leaf)
+    return n->body + i * t->size;
+  return n->body + (t->inner_cap + 2) * sizeof(Node *) + i * t->size;
+}
+
+static BTree tree_create(size_t size) {
+  BTree t = malloc(sizeof(struct _BTree));
+  if (!t)
+    return NULL;
+
+  size_t bytes = offsetof(Node, body) + (MIN_CAPACITY + 2) * sizeof(Node *) +
+                 (MIN_CAPACITY + 1) * size;
+  bytes = MAX(bytes, (size_t)BTREE_NODE_BYTES);
+  t->node_bytes = (bytes + CACHE_LINE - 1) & ~(size_t)(CACHE_LINE - 1);
+
+  size_t room = t->node_bytes - offsetof(Node, body);
+  t->leaf_cap = room / size - 1;
+  t->inner_cap = (room - sizeof(Node *)) / (sizeof(Node *) + size) - 1;
+  t->size = size;
+  t->count = 0;
+  t->height = 1;
+
+  t->root = malloc(t->node_bytes);
+  if (!t->root) {
+    free(t);
+    return NULL;
+  }
+  t->root->next = NULL;
+  t->root->count = 0;
+  t->root->leaf = 1;
+  return t;
+}
+
+BTree btree_new() { return NULL; }
+
+static void delete_nodes(BTree t, Node *node, void (*delete)(void *)) {
+  if (node->leaf) {
+    if (delete)
+      for (size_t i = 0; i < node->count; i++)
+        delete (key_at(t, node, i));
+  } else {
+    for (size_t i = 0; i <= node->count; i++)
+      delete_nodes(t, CHILDREN(node)[i], delete);
+  }
+  free(node);
+}
+
+void btree_delete(BTree tree, void (*delete)(void *)) {
+  if (tree) {
+    delete_nodes(tree, tree->root, delete);
+    free(tree);
+  }
+}
+
+// First payload of the node that is not below 'data'
+static size_t lower_bound(BTree t, Node *n, const void *data,
+                          int (*compare)(const void *, const void *)) {
+  size_t lo = 0, hi = n->count;
+  while (lo < hi) {
+    size_t mid = (lo + hi) / 2;
+    if (compare(data, key_at(t, n, mid)) > 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+// Child of an inner node whose range holds 'data': separators <= data
+static size_t child_index(BTree t, Node *n, const void *data,
+                          int (*compare)(const void *, const void *)) {
+  size_t lo = 0, hi = n->count;
+  while (lo < hi) {
+    size_t mid = (lo + hi) / 2;
+    if (compare(data, key_at(t, n, mid)) >= 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+static void insert_key(BTree t, Node *n, size_t i, const void *data) {
+  char *slot = key_at(t, n, i);
+  memmove(slot + t->size, slot, (n->count - i) * t->size);
+  memcpy(slot, data, t->size);
+  n->count++;
+}
+
+static void remove_key(BTree t, Node *n, size_t i) {
+  char *slot = key_at(t, n, i);
+  memmove(slot, slot + t->size, (n->count - i - 1) * t->size);
+  n->count--;
+}
+
+// Call after insert_key: the node then has n->count children before this one
+static void insert_child(Node *n, size_t i, Node *child) {
+  memmove(&CHILDREN(n)[i + 1], &CHILDREN(n)[i], (n->count - i) * sizeof(Node *));
+  CHILDREN(n)[i] = child;
+}
+
+// Call after remove_key: the node then has n->count + 2 children
+static void remove_child(Node *n, size_t i) {
+  memmove(&CHILDREN(n)[i], &CHILDREN(n)[i + 1], (n->count + 1 - i) * sizeof(Node *));
+}
+
+// Move the payloads from 'mid' on to the empty leaf 'right'
+static void split_leaf(BTree t, Node *node, Node *right, size_t mid) {
+  right->leaf = 1;
+  right->count = node->count - mid;
+  memcpy(key_at(t, right, 0), key_at(t, node, mid), right->count * t->size);
+  right->next = node->next;
+  node->next = right;
+  node->count = mid;
+}
+
+// Split an overfull inner node around its middle separator, which is
+// returned: it stays readable in 'node' until 'node' is modified again
+static const char *split_inner(BTree t, Node *node, Node *right) {
+  size_t mid = node->count / 2;
+  right->leaf = 0;
+  right->next = NULL;
+  right->count = node->count - mid - 1;
+  memcpy(key_at(t, right, 0), key_at(t, node, mid + 1), right->count * t->size);
+  memcpy(CHILDREN(right), &CHILDREN(node)[mid + 1],
+         (right->count + 1) * sizeof(Node *));
+  node->count = mid;
+  return key_at(t, node, mid);
+}
+
+bool btree_insert_sorted(BTree *ptree, const void *data, size_t size,
+                         int (*compare)(const void *, const void *)) {
+  if (!*ptree) {
+    *ptree = tree_create(size);
+    if (!*ptree)
+      return false;
+  }
+  BTree t = *ptree;
+
+  Node *path[MAX_HEIGHT];
+  size_t slot[MAX_HEIGHT];
+  size_t depth = 0;
+  Node *node = t->root;
+  while (!node->leaf) {
+    size_t i = child_index(t, node, data, compare);
+    path[depth] = node;
+    slot[depth++] = i;
+    node = CHILDREN(node)[i];
+  }
+
+  size_t pos = lower_bound(t, node, data, compare);
+  if (pos < node->count && compare(data, key_at(t, node, pos)) == 0)
+    return false; // don't add duplicates
+
+  // Reserve a sibling for each full node on the way up, and a new root if
+  // they all split, so that running out of memory leaves the tree intact
+  Node *spare[MAX_HEIGHT + 1];
+  size_t needed = 0;
+  if (node->count == t->leaf_cap) {
+    needed = 1;
+    for (size_t d = depth; d > 0 && path[d - 1]->count == t->inner_cap; d--)
+      needed++;
+    if (needed == depth + 1)
+      needed++;
+  }
+  for (size_t k = 0; k < needed; k++) {
+    spare[k] = malloc(t->node_bytes);
+    if (!spare[k]) {
+      while (k--)
+        free(spare[k]);
+      return false;
+    }
+  }
+
+  insert_key(t, node, pos, data);
+  t->count++;
+  if (node->count <= t->leaf_cap)
+    return true;
+
+  // Appending to the last leaf (ascending insertions) keeps it full
+  size_t used = 0;
+  Node *right = spare[used++];
+  split_leaf(t, node, right,
+             (pos == t->leaf_cap && !node->next) ? pos : node->count / 2);
+  const char *separator = key_at(t, right, 0);
+
+  while (depth > 0) {
+    Node *parent = path[--depth];
+    size_t i = slot[depth];
+    insert_key(t, parent, i, separator);
+    insert_child(parent, i + 1, right);
+    if (parent->count <= t->inner_cap)
+      return true;
+    right = spare[used++];
+    separator = split_inner(t, parent, right);
+    node = parent;
+  }
+
+  Node *root = spare[used];
+  root->next = NULL;
+  root->leaf = 0;
+  root->count = 0;
+  insert_key(t, root, 0, separator);
+  CHILDREN(root)[0] = node;
+  CHILDREN(root)[1] = right;
+  t->root = root;
+  t->height++;
+  return true;
+}
+
+// Merge child i + 1 of 'parent' into child i
+static void merge_children(BTree t, Node *parent, size_t i) {
+  Node *left = CHILDREN(parent)[i];
+  Node *right = CHILDREN(parent)[i + 1];
+
+  if (left->leaf) {
+    left->next = right->next;
+  } else {
+    insert_key(t, left, left->count, key_at(t, parent, i));
+    memcpy(&CHILDREN(left)[left->count], CHILDREN(right),
+           (right->count + 1) * sizeof(Node *));
+  }
+  memcpy(key_at(t, left, left->count), key_at(t, right, 0),
+         right->count * t->size);
+  left->count += right->count;
+
+  remove_key(t, parent, i);
+  remove_child(parent, i + 1);
+  free(right);
+}
+
+// Refill child i of 'parent', which fell under half its capacity.
+// Returns true if it was merged, leaving 'parent' one child short.
+static bool fix_underflow(BTree t, Node *parent, size_t i) {
+  Node *child = CHILDREN(parent)[i];
+  Node *left = i > 0 ? CHILDREN(parent)[i - 1] : NULL;
+  Node *right = i < parent->count ? CHILDREN(parent)[i + 1] : NULL;
+  size_t min = (child->leaf ? t->leaf_cap : t->inner_cap) / 2;
+
+  if (left && left->count > min) { // borrow the last payload of 'left'
+    if (child->leaf) {
+      insert_key(t, child, 0, key_at(t, left, left->count - 1));
+      memcpy(key_at(t, parent, i - 1), key_at(t, child, 0), t->size);
+    } else {
+      insert_key(t, child, 0, key_at(t, parent, i - 1));
+      insert_child(child, 0, CHILDREN(left)[left->count]);
+      memcpy(key_at(t, parent, i - 1), key_at(t, left, left->count - 1), t->size);
+    }
+    left->count--;
+    return false;
+  }
+
+  if (right && right->count > min) { // borrow the first payload of 'right'
+    if (child->leaf) {
+      insert_key(t, child, child->count, key_at(t, right, 0));
+      remove_key(t, right, 0);
+      memcpy(key_at(t, parent, i), key_at(t, right, 0), t->size);
+    } else {
+      insert_key(t, child, child->count, key_at(t, parent, i));
+      CHILDREN(child)[child->count] = CHILDREN(right)[0];
+      memcpy(key_at(t, parent, i), key_at(t, right, 0), t->size);
+      remove_key(t, right, 0);
+      remove_child(right, 0);
+    }
+    return false;
+  }
+
+  merge_children(t, parent, left ? i - 1 : i);
+  return true;
+}
+
+void btree_node_delete(BTree *ptree, void *data, void (*delete)(void *),
+                       int (*compare)(const void *, const void *), size_t size) {
+  (void)size; // fixed by the first insertion
+  BTree t = *ptree;
+  if (!t)
+    return;
+
+  Node *path[MAX_HEIGHT];
+  size_t slot[MAX_HEIGHT];
+  size_t depth = 0;
+  Node *node = t->root;
+  while (!node->leaf) {
+    size_t i = child_index(t, node, data, compare);
+    path[depth] = node;
+    slot[depth++] = i;
+    node = CHILDREN(node)[i];
+  }
+
+  size_t pos = lower_bound(t, node, data, compare);
+  if (pos == node->count || compare(data, key_at(t, node, pos)) != 0)
+    return;
+
+  // The first payload of a leaf may also be the separator before it in
+  // the lowest ancestor that is not entered by its first child: copy the
+  // next payload over it before 'delete' releases what 'compare' reads
+  if (pos == 0)
+    for (size_t d = depth; d > 0; d--)
+      if (slot[d - 1] > 0) {
+        char *separator = key_at(t, path[d - 1], slot[d - 1] - 1);
+        if (compare(data, separator) == 0 && (node->count > 1 || node->next))
+          memcpy(separator, node->count > 1 ? key_at(t, node, 1) : key_at(t, node->next, 0),
+                 t->size);
+        break;
+      }
+
+  if (delete)
+    delete (key_at(t, node, pos));
+  remove_key(t, node, pos);
+  t->count--;
+
+  size_t min = t->leaf_cap / 2;
+  while (depth > 0 && node->count < min) {
+    node = path[--depth];
+    if (!fix_underflow(t, node, slot[depth]))
+      break;
+    min = t->inner_cap / 2;
+  }
+
+  if (!t->root->leaf && t->root->count == 0) {
+    Node *old = t->root;
+    t->root = CHILDREN(old)[0];
+    t->height--;
+    free(old);
+  } else if (t->root->leaf && t->root->count == 0) {
+    btree_delete(t, NULL);
+    *ptree = NULL;
+  }
+}
+
+void *btree_search(BTree tree, const void *data,
+                   int (*compare)(const void *, const void *)) {
+  if (!tree)
+    return NULL;
+
+  Node *node = tree->root;
+  while (!node->leaf)
+    node = CHILDREN(node)[child_index(tree, node, data, compare)];
+
+  size_t pos = lower_bound(tree, node, data, compare);
+  if (pos < node->count && compare(data, key_at(tree, node, pos)) == 0)
+    return key_at(tree, node, pos);
+  return NULL;
+}
+
+void btree_in_order(BTree tree, void (*func)(void *, void *), void *extra_data) {
+  if (!tree)
+    return;
+
+  Node *leaf = tree->root;
+  while (!leaf->leaf)
+    leaf = CHILDREN(leaf)[0];
+  for (; leaf; leaf = leaf->next)
+    for (size_t i = 0; i < leaf->count; i++)
+      func(key_at(tree, leaf, i), extra_data);
+}
+
+size_t btree_height(BTree tree) { return tree ? tree->height : 0; }
+
+size_t btree_size(BTree tree) { return tree ? tree->count : 0; }
+
+size_t btree_leaf_capacity(BTree tree) { return tree ? tree->leaf_cap : 0; }
+
+size_t btree_inner_capacity(BTree tree) { return tree ? tree->inner_cap : 0; }
@@ -0,0 +1,259 @@
+#include "task-pool.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/*--------------------------------------------------------------------*/
+/* Work-stealing pool: one locked ring-buffer deque per participant */
+
+#define FIRST_DEQUE 64
+#define TASKS_PER_PARTICIPANT_LOG 3
+
+typedef struct {
+  pthread_mutex_t lock;
+  Task **items;
+  size_t head;     // thieves take the oldest task here
+  size_t tail;     // the owner pushes and pops here
+  size_t capacity; // power of two
+} Deque;
+
+typedef struct {
+  unsigned wanted;   // requested participants, 0 for one per core
+  unsigned count;    // participants, the calling thread included
+  unsigned allocated; // deques allocated by pool_start
+  bool started;
+  bool stop;
+  Deque *deques;     // deques[0] belongs to the calling thread
+  pthread_t *threads;
+  unsigned pending;  // tasks queued and not taken yet
+  pthread_mutex_t sleep_lock;
+  pthread_cond_t wake;
+  pthread_mutex_t enter_lock; // held by the outside thread inside a section
+} Pool;
+
+static Pool pool = {
+    .sleep_lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+    .enter_lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static __thread int self = -1;       // participant index, -1 outside the pool
+static __thread unsigned nesting = 0; // task_pool_enter calls not left yet
+
+static void push(Deque *d, Task *task) {
+  pthread_mutex_lock(&d->lock);
+  if (d->tail - d->head == d->capacity) {
+    Task **items = malloc(2 * d->capacity * sizeof(Task *));
+    if (!items) {
+      // Out of memory: run it now, the waiter will find it done
+      pthread_mutex_unlock(&d->lock);
+      task->run(task->arg);
+      __atomic_store_n(&task->done, 1, __ATOMIC_RELEASE);
+      return;
+    }
+    for (size_t i = d->head; i != d->tail; i++)
+      items[i & (2 * d->capacity - 1)] = d->items[i & (d->capacity - 1)];
+    free(d->items);
+    d->items = items;
+    d->capacity *= 2;
+  }
+  d->items[d->tail & (d->capacity - 1)] = task;
+  d->tail++;
+  __atomic_add_fetch(&pool.pending, 1, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&d->lock);
+}
+
+static Task *pop(Deque *d) {
+  Task *task = NULL;
+  pthread_mutex_lock(&d->lock);
+  if (d->tail != d->head) {
+    d->tail--;
+    task = d->items[d->tail & (d->capacity - 1)];
+    __atomic_sub_fetch(&pool.pending, 1, __ATOMIC_RELAXED);
+  }
+  pthread_mutex_unlock(&d->lock);
+  return task;
+}
+
+static Task *steal(Deque *d) {
+  Task *task = NULL;
+  pthread_mutex_lock(&d->lock);
+  if (d->tail != d->head) {
+    task = d->items[d->head & (d->capacity - 1)];
+    d->head++;
+    __atomic_sub_fetch(&pool.pending, 1, __ATOMIC_RELAXED);
+  }
+  pthread_mutex_unlock(&d->lock);
+  return task;
+}
+
+// Own deque first (most recent fork), then the oldest task of the others
+static Task *find_task(unsigned me) {
+  Task *task = pop(&pool.deques[me]);
+  for (unsigned i = 1; !task && i < pool.count; i++)
+    task = steal(&pool.deques[(me + i) % pool.count]);
+  return task;
+}
+
+static void run_task(Task *task) {
+  task->run(task->arg);
+  __atomic_store_n(&task->done, 1, __ATOMIC_RELEASE);
+}
+
+static void *worker_main(void *arg) {
+  self = (int)(intptr_t)arg;
+  for (;;) {
+    Task *task = find_task((unsigned)self);
+    if (task) {
+      run_task(task);
+      continue;
+    }
+
+    pthread_mutex_lock(&pool.sleep_lock);
+    while (!pool.stop && __atomic_load_n(&pool.pending, __ATOMIC_ACQUIRE) == 0)
+      pthread_cond_wait(&pool.wake, &pool.sleep_lock);
+    bool stop = pool.stop;
+    pthread_mutex_unlock(&pool.sleep_lock);
+    if (stop)
+      return NULL;
+  }
+}
+
+static unsigned wanted_count(void) {
+  if (pool.wanted)
+    return pool.wanted;
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  return cores > 0 ? (unsigned)cores : 1;
+}
+
+// Called with enter_lock held
+static void pool_start(void) {
+  pool.started = true;
+  pool.count = 1;
+  unsigned count = wanted_count();
+  if (count < 2)
+    return;
+
+  Deque *deques = calloc(count, sizeof(Deque));
+  pthread_t *threads = calloc(count, sizeof(pthread_t));
+  unsigned ready = 0; // deques fully initialized
+  for (; deques && threads && ready < count; ready++) {
+    Deque *d = &deques[ready];
+    d->capacity = FIRST_DEQUE;
+    d->items = malloc(FIRST_DEQUE * sizeof(Task *));
+    if (!d->items || pthread_mutex_init(&d->lock, NULL) != 0) {
+      free(d->items);
+      break;
+    }
+  }
+  if (ready < count) {
+    // Out of memory: undo what was set up, the pool stays single-threaded
+    for (unsigned i = 0; i < ready; i++) {
+      free(deques[i].items);
+      pthread_mutex_destroy(&deques[i].lock);
+    }
+    free(deques);
+    free(threads);
+    return;
+  }
+
+  pool.deques = deques;
+  pool.threads = threads;
+  pool.allocated = count;
+  pool.count = count;
+  for (unsigned i = 1; i < count; i++) {
+    if (pthread_create(&pool.threads[i], NULL, worker_main, (void *)(intptr_t)i) != 0) {
+      pool.count = i; // participants 0 .. i - 1 only
+      break;
+    }
+  }
+}
+
+// Called with enter_lock held
+static void pool_stop(void) {
+  if (!pool.started)
+    return;
+
+  pthread_mutex_lock(&pool.sleep_lock);
+  pool.stop = true;
+  pthread_cond_broadcast(&pool.wake);
+  pthread_mutex_unlock(&pool.sleep_lock);
+  for (unsigned i = 1; i < pool.count; i++)
+    pthread_join(pool.threads[i], NULL);
+
+  for (unsigned i = 0; i < pool.allocated; i++) {
+    free(pool.deques[i].items);
+    pthread_mutex_destroy(&pool.deques[i].lock);
+  }
+  free(pool.deques);
+  free(pool.threads);
+  pool.deques = NULL;
+  pool.threads = NULL;
+  pool.allocated = 0;
+  pool.stop = false;
+  pool.started = false;
+  pool.count = 1;
+}
+
+bool task_pool_enter(void) {
+  if (self >= 0) {
+    nesting++;
+    return true;
+  }
+
+  pthread_mutex_lock(&pool.enter_lock);
+  if (!pool.started)
+    pool_start();
+  if (pool.count < 2) {
+    pthread_mutex_unlock(&pool.enter_lock);
+    return false;
+  }
+  self = 0;
+  nesting = 1;
+  return true;
+}
+
+void task_pool_leave(void) {
+  if (--nesting == 0 && self == 0) {
+    self = -1;
+    pthread_mutex_unlock(&pool.enter_lock);
+  }
+}
+
+void task_spawn(Task *task) {
+  task->done = 0;
+  push(&pool.deques[self], task);
+  pthread_mutex_lock(&pool.sleep_lock);
+  pthread_cond_signal(&pool.wake);
+  pthread_mutex_unlock(&pool.sleep_lock);
+}
+
+void task_wait(Task *task) {
+  while (!__atomic_load_n(&task->done, __ATOMIC_ACQUIRE)) {
+    Task *other = find_task((unsigned)self);
+    if (other)
+      run_task(other);
+    else
+      sched_yield();
+  }
+}
+
+unsigned task_pool_size(void) {
+  return pool.started ? pool.count : wanted_count();
+}
+
+void task_pool_resize(unsigned threads) {
+  pthread_mutex_lock(&pool.enter_lock);
+  pool_stop();
+  pool.wanted = threads;
+  pthread_mutex_unlock(&pool.enter_lock);
+}
+
+int task_pool_fork_depth(void) {
+  int depth = TASKS_PER_PARTICIPANT_LOG;
+  for (unsigned count = task_pool_size(); count > 1; count >>= 1)
+    depth++;
+  return depth;
+}
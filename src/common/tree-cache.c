@@ -0,0 +1,201 @@
+#include "tree-hooks.h"
+#include <stdint.h>
+
+/*--------------------------------------------------------------------*/
+/* Front cache: open addressing with linear probing over the payloads of
+   the tree nodes, CLOCK eviction when bounded */
+
+#define MIN_SLOTS 16
+
+typedef struct {
+  void *data;      // payload inside a tree node, NULL for a free slot
+  size_t hash;
+  bool referenced; // CLOCK bit, set by every hit
+} CacheEntry;
+
+TREE_STRUCT(TreeCache) {
+  CacheEntry *slots;
+  size_t mask;     // slot count - 1, a power of two
+  size_t count;
+  size_t capacity; // 0: complete, every key of the tree is indexed
+  size_t hand;     // CLOCK hand
+  size_t hits;
+  size_t misses;
+  size_t (*hash)(const void *);
+  int (*compare)(const void *, const void *);
+};
+
+// Smallest power of two slot count keeping 'count' entries at most half full
+static size_t slots_for(size_t count) {
+  size_t slots = MIN_SLOTS;
+  while (slots < 2 * count)
+    slots *= 2;
+  return slots;
+}
+
+static CacheEntry *find_slot(TreeCache cache, const void *data, size_t hash) {
+  for (size_t i = hash & cache->mask;; i = (i + 1) & cache->mask) {
+    CacheEntry *entry = &cache->slots[i];
+    if (!entry->data ||
+        (entry->hash == hash && cache->compare(data, entry->data) == 0))
+      return entry;
+  }
+}
+
+// Free slot 'i' and shift back the entries of its probe run
+static void remove_slot(TreeCache cache, size_t i) {
+  size_t j = i;
+  for (;;) {
+    cache->slots[i].data = NULL;
+    do {
+      j = (j + 1) & cache->mask;
+      if (!cache->slots[j].data) {
+        cache->count--;
+        return;
+      }
+      // The entry at j may move to i unless its home lies in (i, j]
+    } while (((j - (cache->slots[j].hash & cache->mask)) & cache->mask) <
+             ((j - i) & cache->mask));
+    cache->slots[i] = cache->slots[j];
+    i = j;
+  }
+}
+
+static bool grow(TreeCache cache) {
+  size_t slots = 2 * (cache->mask + 1);
+  CacheEntry *old = cache->slots, *table = calloc(slots, sizeof(CacheEntry));
+  if (!table)
+    return false;
+
+  size_t old_slots = cache->mask + 1;
+  cache->slots = table;
+  cache->mask = slots - 1;
+  for (size_t i = 0; i < old_slots; i++)
+    if (old[i].data) {
+      size_t j = old[i].hash & cache->mask;
+      while (table[j].data)
+        j = (j + 1) & cache->mask;
+      table[j] = old[i];
+    }
+  free(old);
+  return true;
+}
+
+// Unset CLOCK bits as the hand passes, evict the first entry without one
+static void evict(TreeCache cache) {
+  for (;; cache->hand = (cache->hand + 1) & cache->mask) {
+    CacheEntry *entry = &cache->slots[cache->hand];
+    if (!entry->data)
+      continue;
+    if (!entry->referenced) {
+      remove_slot(cache, cache->hand);
+      return;
+    }
+    entry->referenced = false;
+  }
+}
+
+// Index the payload 'data' of a tree node, evicting or growing if full
+static void admit(TreeCache cache, void *data, size_t hash) {
+  if (!cache->capacity && 2 * (cache->count + 1) > cache->mask + 1 && !grow(cache))
+    cache->capacity = cache->count; // out of memory: go on as a bounded cache
+  if (cache->capacity && cache->count >= cache->capacity)
+    evict(cache);
+
+  CacheEntry *entry = find_slot(cache, data, hash);
+  if (!entry->data)
+    cache->count++;
+  entry->data = data;
+  entry->hash = hash;
+  entry->referenced = false;
+}
+
+static void drop(TreeCache cache, const void *data) {
+  CacheEntry *entry = find_slot(cache, data, cache->hash(data));
+  if (entry->data)
+    remove_slot(cache, (size_t)(entry - cache->slots));
+}
+
+TreeCache tree_cache_new(Tree tree, size_t capacity,
+                         size_t (*hash)(const void *),
+                         int (*compare)(const void *, const void *)) {
+  TreeCache cache = malloc(sizeof(TREE_STRUCT(TreeCache)));
+  if (!cache)
+    return NULL;
+
+  size_t slots = slots_for(capacity ? capacity : tree_size(tree));
+  cache->slots = calloc(slots, sizeof(CacheEntry));
+  if (!cache->slots) {
+    free(cache);
+    return NULL;
+  }
+  cache->mask = slots - 1;
+  cache->count = 0;
+  cache->capacity = capacity;
+  cache->hand = 0;
+  cache->hits = 0;
+  cache->misses = 0;
+  cache->hash = hash;
+  cache->compare = compare;
+
+  if (!capacity)
+    for (Tree node = tree_first(tree); node; node = iter_next(node)) {
+      void *data = tree_get_data(node);
+      admit(cache, data, hash(data));
+    }
+  return cache;
+}
+
+void tree_cache_delete(TreeCache cache) {
+  if (cache) {
+    free(cache->slots);
+    free(cache);
+  }
+}
+
+void *tree_cache_search(TreeCache cache, Tree tree, const void *data) {
+  size_t hash = cache->hash(data);
+  CacheEntry *entry = find_slot(cache, data, hash);
+  if (entry->data) {
+    entry->referenced = true;
+    cache->hits++;
+    return entry->data;
+  }
+
+  cache->misses++;
+  if (!cache->capacity)
+    return NULL; // complete: a key missing here is not in the tree
+
+  void *found = tree_search(tree, data, cache->compare);
+  if (found)
+    admit(cache, found, hash);
+  return found;
+}
+
+bool tree_cache_insert(TreeCache cache, Tree *ptree, const void *data, size_t size) {
+  bool inserted;
+  Tree node = tree_insert_handle(ptree, data, size, cache->compare, &inserted);
+  if (!inserted)
+    return false;
+  if (!cache->capacity) {
+    void *payload = tree_get_data(node);
+    admit(cache, payload, cache->hash(payload));
+  }
+  return true;
+}
+
+void tree_cache_remove(TreeCache cache, Tree *ptree, void *data, void (*delete)(void *),
+                       size_t size) {
+  if (!ptree)
+    return;
+  // node_delete relinks the nodes: the other payloads stay where they are
+  drop(cache, data);
+  node_delete(ptree, data, delete, cache->compare, size);
+}
+
+size_t tree_cache_size(TreeCache cache) { return cache->count; }
+
+double tree_cache_hit_rate(TreeCache cache) {
+  size_t lookups = cache->hits + cache->misses;
+  return lookups ? (double)cache->hits / lookups : 0.0;
+}
@@ -0,0 +1,322 @@
+#include "tree-hooks.h"
+#include <pthread.h>
+#include <string.h>
+
+/*--------------------------------------------------------------------*/
+/* Concurrent tree: the key range is cut into partitions, each a subtree
+   with its own writer lock and sequence counter (seqlock). Searches take
+   no lock and only retry when a writer changed their own partition.
+   A partition past PARTITION_SPLIT keys is split at its root, and the new
+   partition list (the router) is published as a whole. Each partition
+   allocates from its own arena; nodes, partitions and routers are only
+   released with the tree, so a reader racing a writer never touches freed
+   memory. */
+
+#define OPTIMISTIC_TRIES 16
+#define MAX_DEPTH 128 // deeper than any valid tree: a torn read looped
+#define PARTITION_SPLIT 4096
+#define MAX_PARTITIONS 64
+#define CACHE_LINE 64
+
+typedef struct {
+  Tree root;
+  size_t count;          // keys, under 'lock'
+  TreeArena arena;       // nodes inserted here, type-stable until the end
+  pthread_mutex_t lock;
+  unsigned seq;          // odd while a writer is changing the partition
+  char pad[CACHE_LINE];  // keeps two partitions off a shared cache line
+} Partition;
+
+typedef struct _Router {
+  struct _Router *previous; // replaced routers, readers may still hold them
+  size_t count;
+  Partition **parts;        // in key order
+  char *bounds;             // parts[i + 1] holds the keys >= bound i
+} Router;
+
+TREE_STRUCT(ConcurrentTree) {
+  Router *router;   // replaced when a partition splits
+  size_t size;      // payload size
+  pthread_mutex_t split_lock; // serializes router changes
+};
+
+static Partition *partition_new(void) {
+  Partition *part = malloc(sizeof(Partition));
+  if (!part)
+    return NULL;
+  part->arena = tree_arena_new_shared(); // split nodes are freed from other partitions
+  if (!part->arena || pthread_mutex_init(&part->lock, NULL) != 0) {
+    tree_arena_delete(part->arena);
+    free(part);
+    return NULL;
+  }
+  part->root = NULL;
+  part->count = 0;
+  part->seq = 0;
+  return part;
+}
+
+static void partition_delete(Partition *part) {
+  tree_arena_delete(part->arena);
+  pthread_mutex_destroy(&part->lock);
+  free(part);
+}
+
+static Router *router_new(size_t count, size_t size) {
+  Router *router = malloc(sizeof(Router));
+  if (!router)
+    return NULL;
+  router->parts = malloc(count * sizeof(Partition *));
+  router->bounds = malloc((count - 1) * size + 1);
+  if (!router->parts || !router->bounds) {
+    free(router->parts);
+    free(router->bounds);
+    free(router);
+    return NULL;
+  }
+  router->previous = NULL;
+  router->count = count;
+  return router;
+}
+
+ConcurrentTree concurrent_tree_new(size_t size) {
+  ConcurrentTree tree = malloc(sizeof(TREE_STRUCT(ConcurrentTree)));
+  if (!tree)
+    return NULL;
+
+  tree->router = router_new(1, size);
+  Partition *part = partition_new();
+  if (!tree->router || !part || pthread_mutex_init(&tree->split_lock, NULL) != 0) {
+    if (part)
+      partition_delete(part);
+    if (tree->router) {
+      free(tree->router->parts);
+      free(tree->router->bounds);
+      free(tree->router);
+    }
+    free(tree);
+    return NULL;
+  }
+  tree->router->parts[0] = part;
+  tree->size = size;
+  return tree;
+}
+
+void concurrent_tree_delete(ConcurrentTree tree, void (*delete)(void *)) {
+  if (!tree)
+    return;
+
+  Router *router = tree->router;
+  for (size_t i = 0; i < router->count; i++) {
+    Partition *part = router->parts[i];
+    // The arenas hold every node: only walk them for the callback
+    if (delete)
+      tree_delete(part->root, delete);
+  }
+  // Split nodes keep their arena: release them once every tree is walked
+  for (size_t i = 0; i < router->count; i++)
+    partition_delete(router->parts[i]);
+  while (router) {
+    Router *previous = router->previous;
+    free(router->parts);
+    free(router->bounds);
+    free(router);
+    router = previous;
+  }
+  pthread_mutex_destroy(&tree->split_lock);
+  free(tree);
+}
+
+// Partition of 'router' whose key range holds 'data'
+static Partition *route(ConcurrentTree tree, Router *router, const void *data,
+                        int (*compare)(const void *, const void *)) {
+  size_t lo = 0, hi = router->count - 1;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (compare(data, router->bounds + mid * tree->size) < 0)
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
+  return router->parts[lo];
+}
+
+// Lock the partition holding 'data', retrying if it was split meanwhile
+static Partition *lock_partition(ConcurrentTree tree, const void *data,
+                                 int (*compare)(const void *, const void *)) {
+  for (;;) {
+    Router *router = __atomic_load_n(&tree->router, __ATOMIC_ACQUIRE);
+    Partition *part = route(tree, router, data, compare);
+    pthread_mutex_lock(&part->lock);
+    // A split takes the partition lock: an unchanged router keeps its range
+    if (__atomic_load_n(&tree->router, __ATOMIC_ACQUIRE) == router)
+      return part;
+    pthread_mutex_unlock(&part->lock);
+  }
+}
+
+// Make the sequence odd, before any node of the locked partition changes
+static void write_begin(Partition *part) {
+  __atomic_store_n(&part->seq, part->seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+// Make the sequence even again once every node change is visible
+static void write_end(Partition *part) {
+  __atomic_store_n(&part->seq, part->seq + 1, __ATOMIC_RELEASE);
+}
+
+// Move the keys from the root of the locked 'part' up to a new partition,
+// unless the router is full or memory runs out
+static void split_partition(ConcurrentTree tree, Partition *part,
+                            int (*compare)(const void *, const void *)) {
+  pthread_mutex_lock(&tree->split_lock);
+  Router *old = tree->router;
+  Router *router = NULL;
+  Partition *upper = NULL;
+  if (old->count < MAX_PARTITIONS) {
+    router = router_new(old->count + 1, tree->size);
+    upper = partition_new();
+  }
+  if (!router || !upper) {
+    if (router) {
+      free(router->parts);
+      free(router->bounds);
+      free(router);
+    }
+    if (upper)
+      partition_delete(upper);
+    pthread_mutex_unlock(&tree->split_lock);
+    return;
+  }
+
+  size_t size = tree->size, at = 0;
+  while (old->parts[at] != part)
+    at++;
+  memcpy(router->parts, old->parts, (at + 1) * sizeof(Partition *));
+  router->parts[at + 1] = upper;
+  memcpy(router->parts + at + 2, old->parts + at + 1,
+         (old->count - at - 1) * sizeof(Partition *));
+  memcpy(router->bounds, old->bounds, at * size);
+  memcpy(router->bounds + at * size, part->root->data, size);
+  memcpy(router->bounds + (at + 1) * size, old->bounds + at * size,
+         (old->count - at - 1) * size);
+  router->previous = old;
+
+  write_begin(part);
+  Tree lower, higher;
+  Tree middle = tree_split(part->root, router->bounds + at * size, compare, &lower, &higher);
+  upper->root = tree_join(NULL, middle, higher);
+  upper->count = tree_size(upper->root);
+  __atomic_store_n(&part->root, lower, __ATOMIC_RELAXED);
+  part->count -= upper->count;
+  __atomic_store_n(&tree->router, router, __ATOMIC_RELEASE);
+  write_end(part);
+  pthread_mutex_unlock(&tree->split_lock);
+}
+
+// Node holding 'data' below 'node', NULL if none. The links are loaded
+// atomically: the lock-free searches and the locked writers share it
+static Tree find(Tree node, const void *data, int (*compare)(const void *, const void *)) {
+  for (int depth = 0; node && depth < MAX_DEPTH; depth++) {
+    int cmp = compare(data, node->data);
+    if (cmp == 0)
+      return node;
+    node = cmp < 0 ? __atomic_load_n(&node->left, __ATOMIC_RELAXED)
+                   : __atomic_load_n(&node->right, __ATOMIC_RELAXED);
+  }
+  return NULL;
+}
+
+bool concurrent_tree_insert_sorted(ConcurrentTree tree, const void *data,
+                                   int (*compare)(const void *, const void *)) {
+  if (!tree)
+    return false;
+
+  Partition *part = lock_partition(tree, data, compare);
+  // A duplicate leaves the partition, and its readers, alone
+  bool inserted = false;
+  if (!find(part->root, data, compare)) {
+    write_begin(part);
+    inserted = tree_arena_insert(part->arena, &part->root, data, tree->size, compare);
+    write_end(part);
+    part->count += inserted;
+    // Once the router is full, no split can happen: leave the global lock alone
+    if (part->count > PARTITION_SPLIT &&
+        __atomic_load_n(&tree->router, __ATOMIC_ACQUIRE)->count < MAX_PARTITIONS)
+      split_partition(tree, part, compare);
+  }
+  pthread_mutex_unlock(&part->lock);
+  return inserted;
+}
+
+void concurrent_node_delete(ConcurrentTree tree, void *data, void (*delete)(void *),
+                            int (*compare)(const void *, const void *)) {
+  if (!tree)
+    return;
+
+  Partition *part = lock_partition(tree, data, compare);
+  Tree node = find(part->root, data, compare);
+  if (node) {
+    write_begin(part);
+    tree_erase_handle(&part->root, node, delete);
+    write_end(part);
+    part->count--;
+  }
+  pthread_mutex_unlock(&part->lock);
+}
+
+// Descend without locking, the caller validates the result with 'seq'
+static bool optimistic_find(ConcurrentTree tree, Partition *part, const void *data,
+                            int (*compare)(const void *, const void *), void *out) {
+  Tree node = find(__atomic_load_n(&part->root, __ATOMIC_RELAXED), data, compare);
+  if (node)
+    memcpy(out, node->data, tree->size);
+  return node != NULL;
+}
+
+bool concurrent_tree_search(ConcurrentTree tree, const void *data,
+                            int (*compare)(const void *, const void *), void *out) {
+  if (!tree)
+    return false;
+
+  for (int attempt = 0; attempt < OPTIMISTIC_TRIES; attempt++) {
+    Router *router = __atomic_load_n(&tree->router, __ATOMIC_ACQUIRE);
+    Partition *part = route(tree, router, data, compare);
+    unsigned start = __atomic_load_n(&part->seq, __ATOMIC_ACQUIRE);
+    if (start & 1)
+      continue; // a writer is inside
+    bool found = optimistic_find(tree, part, data, compare, out);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    // A split moves keys out of the partition before it publishes the router
+    if (__atomic_load_n(&part->seq, __ATOMIC_RELAXED) == start &&
+        __atomic_load_n(&tree->router, __ATOMIC_RELAXED) == router)
+      return found;
+  }
+
+  // Writers kept getting in the way: search under the partition lock
+  Partition *part = lock_partition(tree, data, compare);
+  Tree node = find(part->root, data, compare);
+  if (node)
+    memcpy(out, node->data, tree->size);
+  pthread_mutex_unlock(&part->lock);
+  return node != NULL;
+}
+
+size_t concurrent_tree_size(ConcurrentTree tree) {
+  if (!tree)
+    return 0;
+
+  // A split moves keys between partitions: sum again if one happened
+  for (;;) {
+    Router *router = __atomic_load_n(&tree->router, __ATOMIC_ACQUIRE);
+    size_t size = 0;
+    for (size_t i = 0; i < router->count; i++) {
+      pthread_mutex_lock(&router->parts[i]->lock);
+      size += router->parts[i]->count;
+      pthread_mutex_unlock(&router->parts[i]->lock);
+    }
+    if (__atomic_load_n(&tree->router, __ATOMIC_ACQUIRE) == router)
+      return size;
+  }
+}
@@ -0,0 +1,168 @@
+#define _POSIX_C_SOURCE 200112L // posix_fallocate
+#include "tree-hooks.h"
+#include "tree-file.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*--------------------------------------------------------------------*/
+/* Tree file: pre-order records linked by file offsets, read in place */
+
+#define MAX_DEPTH 128 // deeper than any valid tree: a corrupt file looped
+
+TREE_STRUCT(TreeFile) {
+  const char *base; // read-only mapping of the whole file
+  size_t length;
+  size_t size;      // payload size
+  size_t count;
+  size_t node_size;
+  uint64_t root;
+};
+
+// Copy the subtree of 'node' from offset *next on, return its offset
+static uint64_t fill(char *base, Tree node, size_t size, size_t node_size, uint64_t *next) {
+  if (!node)
+    return 0;
+
+  uint64_t offset = *next;
+  *next += node_size;
+  TreeFileNode *record = (TreeFileNode *)(base + offset);
+  record->balance = TREE_FILE_BALANCE(node);
+  memcpy(record + 1, node->data, size);
+  record->left = fill(base, node->left, size, node_size, next);
+  record->right = fill(base, node->right, size, node_size, next);
+  return offset;
+}
+
+// Write the file at 'path' through a shared mapping of its reserved blocks
+static bool write_mapped(const char *path, Tree tree, size_t size) {
+  size_t count = tree_size(tree);
+  size_t node_size = (size_t)tree_file_node_size(size);
+  if (count > (SIZE_MAX - sizeof(TreeFileHeader)) / node_size)
+    return false;
+  size_t length = sizeof(TreeFileHeader) + count * node_size;
+
+  int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+    return false;
+  // Reserve the blocks: a full disk fails here instead of faulting the mapping
+  if (posix_fallocate(fd, 0, (off_t)length) != 0) {
+    close(fd);
+    return false;
+  }
+  char *base = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED)
+    return false;
+
+  TreeFileHeader *header = (TreeFileHeader *)base;
+  memcpy(header->magic, TREE_FILE_MAGIC, sizeof(header->magic));
+  header->version = TREE_FILE_VERSION;
+  header->byte_order = TREE_FILE_BYTE_ORDER;
+  header->kind = TREE_FILE_KIND;
+  header->payload_size = size;
+  header->count = count;
+  header->node_size = node_size;
+  uint64_t next = sizeof(TreeFileHeader);
+  header->root = fill(base, tree, size, node_size, &next);
+
+  bool synced = msync(base, length, MS_SYNC) == 0;
+  munmap(base, length);
+  return synced;
+}
+
+bool tree_file_write(Tree tree, size_t size, const char *path) {
+  if (!path || size == 0)
+    return false;
+
+  // Readers of 'path' keep the old file until the new one is complete
+  size_t path_length = strlen(path);
+  char *temporary = malloc(path_length + sizeof(".tmp"));
+  if (!temporary)
+    return false;
+  memcpy(temporary, path, path_length);
+  memcpy(temporary + path_length, ".tmp", sizeof(".tmp"));
+
+  bool written = write_mapped(temporary, tree, size) && rename(temporary, path) == 0;
+  if (!written)
+    unlink(temporary);
+  free(temporary);
+  return written;
+}
+
+static bool valid_header(const TreeFileHeader *header, size_t length, size_t size) {
+  if (memcmp(header->magic, TREE_FILE_MAGIC, sizeof(header->magic)) != 0 ||
+      header->version != TREE_FILE_VERSION || header->byte_order != TREE_FILE_BYTE_ORDER ||
+      header->kind != TREE_FILE_KIND || header->payload_size != size ||
+      header->node_size != tree_file_node_size(size))
+    return false;
+  if (header->count > (length - sizeof(TreeFileHeader)) / header->node_size ||
+      length != sizeof(TreeFileHeader) + header->count * header->node_size)
+    return false;
+  return header->root == (header->count ? sizeof(TreeFileHeader) : 0);
+}
+
+TreeFile tree_file_open(const char *path, size_t size) {
+  if (!path || size == 0)
+    return NULL;
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(TreeFileHeader) ||
+      (uint64_t)st.st_size > SIZE_MAX) {
+    close(fd);
+    return NULL;
+  }
+  size_t length = (size_t)st.st_size;
+  char *base = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED)
+    return NULL;
+
+  const TreeFileHeader *header = (const TreeFileHeader *)base;
+  TreeFile file = valid_header(header, length, size) ? malloc(sizeof(TREE_STRUCT(TreeFile))) : NULL;
+  if (!file) {
+    munmap(base, length);
+    return NULL;
+  }
+  file->base = base;
+  file->length = length;
+  file->size = size;
+  file->count = (size_t)header->count;
+  file->node_size = (size_t)header->node_size;
+  file->root = header->root;
+  return file;
+}
+
+void tree_file_close(TreeFile file) {
+  if (file) {
+    munmap((void *)file->base, file->length);
+    free(file);
+  }
+}
+
+void *tree_file_search(TreeFile file, const void *data,
+                       int (*compare)(const void *, const void *)) {
+  if (!file || !compare)
+    return NULL;
+
+  uint64_t offset = file->root;
+  for (int depth = 0; offset && depth < MAX_DEPTH; depth++) {
+    // A link out of the file or off the 8-byte grid: corrupt, give up
+    if (offset > file->length - file->node_size || (offset & 7))
+      return NULL;
+    const TreeFileNode *record = (const TreeFileNode *)(file->base + offset);
+    int cmp = compare(data, record + 1);
+    if (cmp == 0)
+      return (void *)(record + 1);
+    offset = cmp < 0 ? record->left : record->right;
+  }
+  return NULL;
+}
+
+size_t tree_file_size(TreeFile file) { return file ? file->count : 0; }
@@ -0,0 +1,118 @@
+#include "tree-hooks.h"
+#include <stdint.h>
+#include <string.h>
+
+/*--------------------------------------------------------------------*/
+/* Search snapshot: payloads in Eytzinger order, slot 0 unused */
+
+#define CACHE_LINE 64
+
+#if defined(__GNUC__)
+#define PREFETCH(p) __builtin_prefetch(p)
+#else
+#define PREFETCH(p) ((void)(p))
+#endif
+
+TREE_STRUCT(TreeSnapshot) {
+  char *block;  // allocation, 'slots' is its first cache-line boundary
+  char *slots;  // slot k starts at slots + k * size
+  size_t size;  // payload size
+  size_t count;
+  size_t ahead; // 2^levels prefetched: the descendants of k fill one line
+};
+
+#define SLOT(s, k) ((s)->slots + (k) * (s)->size)
+
+static Tree first_node(Tree node) {
+  while (node->left)
+    node = node->left;
+  return node;
+}
+
+static Tree next_node(Tree node) {
+  if (node->right)
+    return first_node(node->right);
+  while (node->parent && node == node->parent->right)
+    node = node->parent;
+  return node->parent;
+}
+
+// First Eytzinger slot in sorted order: the leftmost one
+static size_t first_slot(size_t count) {
+  size_t k = 1;
+  while (2 * k <= count)
+    k = 2 * k;
+  return k;
+}
+
+// Next Eytzinger slot in sorted order, 0 after the last one
+static size_t next_slot(size_t k, size_t count) {
+  if (2 * k + 1 <= count) {
+    k = 2 * k + 1;
+    while (2 * k <= count)
+      k = 2 * k;
+    return k;
+  }
+  while (k & 1)
+    k >>= 1;
+  return k >> 1;
+}
+
+TreeSnapshot tree_snapshot_new(Tree tree, size_t size) {
+  TreeSnapshot snapshot = malloc(sizeof(TREE_STRUCT(TreeSnapshot)));
+  if (!snapshot)
+    return NULL;
+
+  snapshot->size = size;
+  snapshot->count = tree_size(tree);
+  snapshot->block = malloc((snapshot->count + 1) * size + CACHE_LINE);
+  if (!snapshot->block) {
+    free(snapshot);
+    return NULL;
+  }
+  snapshot->slots = (char *)(((uintptr_t)snapshot->block + CACHE_LINE - 1) &
+                             ~(uintptr_t)(CACHE_LINE - 1));
+
+  snapshot->ahead = 2;
+  while (snapshot->ahead * 2 * size <= CACHE_LINE)
+    snapshot->ahead *= 2;
+
+  // Walk the tree and the Eytzinger slots together, both in sorted order
+  size_t k = first_slot(snapshot->count);
+  for (Tree node = tree ? first_node(tree) : NULL; node; node = next_node(node)) {
+    memcpy(SLOT(snapshot, k), node->data, size);
+    k = next_slot(k, snapshot->count);
+  }
+  return snapshot;
+}
+
+void tree_snapshot_delete(TreeSnapshot snapshot) {
+  if (snapshot) {
+    free(snapshot->block);
+    free(snapshot);
+  }
+}
+
+void *tree_snapshot_search(TreeSnapshot snapshot, const void *data,
+                           int (*compare)(const void *, const void *)) {
+  if (!snapshot)
+    return NULL;
+
+  size_t k = 1;
+  while (k <= snapshot->count) {
+    PREFETCH(SLOT(snapshot, k * snapshot->ahead));
+    k = 2 * k + (compare(data, SLOT(snapshot, k)) > 0);
+  }
+
+  // Undo the right turns taken after the last slot not below 'data'
+  while (k & 1)
+    k >>= 1;
+  k >>= 1;
+  if (k == 0 || compare(data, SLOT(snapshot, k)) != 0)
+    return NULL;
+  return SLOT(snapshot, k);
+}
+
+size_t tree_snapshot_size(TreeSnapshot snapshot) {
+  return snapshot ? snapshot->count : 0;
+}
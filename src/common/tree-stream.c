@@ -0,0 +1,233 @@
+#define _POSIX_C_SOURCE 200112L // fileno
+#include "tree-hooks.h"
+#include "tree-file.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+/*--------------------------------------------------------------------*/
+/* Tree stream: in-order payloads in bounded chunks, one buffer each way */
+
+static bool codec_fits(TreeStreamCodec codec, size_t size) {
+  if (codec == TREE_STREAM_RAW)
+    return size > 0 && size <= TREE_STREAM_CHUNK;
+  return codec == TREE_STREAM_DELTA_VARINT && (size == 4 || size == 8);
+}
+
+// int32 and int64 payloads widened to 64 bits
+static int64_t load_int(const void *data, size_t size) {
+  if (size == 4) {
+    int32_t value;
+    memcpy(&value, data, 4);
+    return value;
+  }
+  int64_t value;
+  memcpy(&value, data, 8);
+  return value;
+}
+
+static void store_int(void *data, size_t size, int64_t value) {
+  if (size == 4) {
+    int32_t narrow = (int32_t)value;
+    memcpy(data, &narrow, 4);
+  } else {
+    memcpy(data, &value, 8);
+  }
+}
+
+typedef struct {
+  FILE *out;
+  TreeStreamCodec codec;
+  size_t size;
+  uint64_t previous; // last payload, for the deltas
+  TreeStreamChunk chunk;
+  unsigned char body[TREE_STREAM_CHUNK];
+} StreamWriter;
+
+static bool flush_chunk(StreamWriter *w) {
+  if (w->chunk.count == 0)
+    return true;
+  bool ok = fwrite(&w->chunk, sizeof(w->chunk), 1, w->out) == 1 &&
+            fwrite(w->body, 1, w->chunk.bytes, w->out) == w->chunk.bytes;
+  w->chunk.bytes = 0;
+  w->chunk.count = 0;
+  return ok;
+}
+
+static bool put(StreamWriter *w, const void *data) {
+  size_t room = w->codec == TREE_STREAM_RAW ? w->size : TREE_STREAM_VARINT_MAX;
+  if (w->chunk.bytes + room > TREE_STREAM_CHUNK && !flush_chunk(w))
+    return false;
+
+  unsigned char *cursor = w->body + w->chunk.bytes;
+  if (w->codec == TREE_STREAM_RAW) {
+    memcpy(cursor, data, w->size);
+    cursor += w->size;
+  } else {
+    uint64_t value = (uint64_t)load_int(data, w->size);
+    uint64_t delta = value - w->previous;
+    uint64_t zigzag = (delta << 1) ^ (0 - (delta >> 63));
+    w->previous = value;
+    while (zigzag >= 0x80) {
+      *cursor++ = (unsigned char)(zigzag | 0x80);
+      zigzag >>= 7;
+    }
+    *cursor++ = (unsigned char)zigzag;
+  }
+  w->chunk.bytes = (uint32_t)(cursor - w->body);
+  w->chunk.count++;
+  return true;
+}
+
+static bool write_stream(FILE *out, Tree tree, size_t size, TreeStreamCodec codec) {
+  TreeStreamHeader header = {.version = TREE_STREAM_VERSION,
+                             .byte_order = TREE_FILE_BYTE_ORDER,
+                             .codec = codec,
+                             .payload_size = size,
+                             .count = tree_size(tree)};
+  memcpy(header.magic, TREE_STREAM_MAGIC, sizeof(header.magic));
+  if (fwrite(&header, sizeof(header), 1, out) != 1)
+    return false;
+
+  StreamWriter *w = malloc(sizeof(StreamWriter));
+  if (!w)
+    return false;
+  w->out = out;
+  w->codec = codec;
+  w->size = size;
+  w->previous = 0;
+  w->chunk.bytes = 0;
+  w->chunk.count = 0;
+
+  bool ok = true;
+  for (Tree node = tree_first(tree); ok && node; node = iter_next(node))
+    ok = put(w, node->data);
+  ok = ok && flush_chunk(w);
+  free(w);
+  return ok;
+}
+
+bool tree_stream_write(Tree tree, size_t size, const char *path, TreeStreamCodec codec) {
+  if (!path || !codec_fits(codec, size))
+    return false;
+
+  // As tree_file_write: build next to 'path', rename once synced
+  size_t path_length = strlen(path);
+  char *temporary = malloc(path_length + sizeof(".tmp"));
+  if (!temporary)
+    return false;
+  memcpy(temporary, path, path_length);
+  memcpy(temporary + path_length, ".tmp", sizeof(".tmp"));
+
+  FILE *out = fopen(temporary, "wb");
+  bool written = out && write_stream(out, tree, size, codec) && fflush(out) == 0 &&
+                 fsync(fileno(out)) == 0;
+  if (out && fclose(out) != 0)
+    written = false;
+  written = written && rename(temporary, path) == 0;
+  if (!written)
+    unlink(temporary);
+  free(temporary);
+  return written;
+}
+
+typedef struct {
+  FILE *in;
+  TreeStreamCodec codec;
+  size_t size;
+  uint64_t previous;
+  bool started;      // a payload was decoded: 'previous' holds it
+  uint32_t left;     // payloads not read yet in the current chunk
+  uint32_t bytes;    // bytes of the current chunk
+  uint32_t position;
+  unsigned char body[TREE_STREAM_CHUNK];
+} StreamReader;
+
+static bool next_chunk(StreamReader *r) {
+  TreeStreamChunk chunk;
+  if (fread(&chunk, sizeof(chunk), 1, r->in) != 1 || chunk.count == 0 ||
+      chunk.bytes > TREE_STREAM_CHUNK || fread(r->body, 1, chunk.bytes, r->in) != chunk.bytes)
+    return false;
+  r->left = chunk.count;
+  r->bytes = chunk.bytes;
+  r->position = 0;
+  return true;
+}
+
+// Element source of tree_from_stream
+static bool get(void *data, void *context) {
+  StreamReader *r = context;
+  if (r->left == 0 && !next_chunk(r))
+    return false;
+
+  if (r->codec == TREE_STREAM_RAW) {
+    if (r->bytes - r->position < r->size)
+      return false;
+    memcpy(data, r->body + r->position, r->size);
+    r->position += (uint32_t)r->size;
+  } else {
+    uint64_t zigzag = 0;
+    for (unsigned shift = 0;; shift += 7) {
+      if (r->position == r->bytes || shift >= 64)
+        return false; // truncated or overlong varint
+      unsigned char byte = r->body[r->position++];
+      zigzag |= (uint64_t)(byte & 0x7f) << shift;
+      if (!(byte & 0x80))
+        break;
+    }
+    int64_t value = (int64_t)(r->previous + ((zigzag >> 1) ^ (0 - (zigzag & 1))));
+    // Keys strictly ascend within the payload range, or the stream is damaged:
+    // tree_from_stream would build an invalid search tree from it
+    if ((r->started && value <= (int64_t)r->previous) ||
+        (r->size == 4 && (value < INT32_MIN || value > INT32_MAX)))
+      return false;
+    r->previous = (uint64_t)value;
+    r->started = true;
+    store_int(data, r->size, value);
+  }
+  r->left--;
+  return true;
+}
+
+bool tree_stream_read(const char *path, size_t size, Tree *out) {
+  if (!out)
+    return false;
+  *out = NULL;
+  FILE *in = path ? fopen(path, "rb") : NULL;
+  if (!in)
+    return false;
+
+  TreeStreamHeader header;
+  StreamReader *r = NULL;
+  if (fread(&header, sizeof(header), 1, in) == 1 &&
+      memcmp(header.magic, TREE_STREAM_MAGIC, sizeof(header.magic)) == 0 &&
+      header.version == TREE_STREAM_VERSION && header.byte_order == TREE_FILE_BYTE_ORDER &&
+      header.payload_size == size && header.count <= SIZE_MAX &&
+      codec_fits((TreeStreamCodec)header.codec, size))
+    r = malloc(sizeof(StreamReader));
+  if (!r) {
+    fclose(in);
+    return false;
+  }
+  r->in = in;
+  r->codec = (TreeStreamCodec)header.codec;
+  r->size = size;
+  r->previous = 0;
+  r->started = false;
+  r->left = 0;
+  r->bytes = 0;
+  r->position = 0;
+
+  Tree tree = tree_from_stream((size_t)header.count, size, get, r);
+  // An empty stream builds the empty tree; every chunk must have been used
+  // up, and nothing may follow
+  bool ok = (tree || header.count == 0) && r->left == 0 && r->position == r->bytes &&
+            fgetc(in) == EOF;
+  if (ok)
+    *out = tree;
+  else
+    tree_delete(tree, NULL);
+  free(r);
+  fclose(in);
+  return ok;
+}
@@ -0,0 +1,154 @@
+#include "tree-hooks.h"
+#include "wide-rank.h"
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+/*--------------------------------------------------------------------*/
+/* Wide int snapshot: implicit static B-tree of 16-key nodes.
+ * The children of node k are nodes k * 17 + 1 ... k * 17 + 17. */
+
+#define CACHE_LINE 64
+#define FANOUT (WIDE_KEYS + 1)
+
+TREE_STRUCT(TreeWide) {
+  char *block;  // allocation, 'keys' is its first cache-line boundary
+  int *keys;    // node k holds keys[k * WIDE_KEYS ... + WIDE_KEYS - 1]
+  size_t count;
+  size_t nodes;
+  bool has_max; // INT_MAX pads the last slots, tell it from a real key
+};
+
+// The default kernel is chosen once; tree_wide_use_kernel may switch it while
+// other threads search, hence the atomic accesses
+static pthread_once_t kernel_once = PTHREAD_ONCE_INIT;
+static WideRankFunc rank_func = wide_rank_scalar;
+static WideKernel rank_kernel = WIDE_SCALAR;
+
+static void set_kernel(WideRankFunc func, WideKernel kernel) {
+  __atomic_store_n(&rank_func, func, __ATOMIC_RELAXED);
+  __atomic_store_n(&rank_kernel, kernel, __ATOMIC_RELAXED);
+}
+
+static void select_kernel(void) {
+  if (wide_rank_avx2_supported())
+    set_kernel(wide_rank_avx2, WIDE_AVX2);
+  else if (wide_rank_sse2_supported())
+    set_kernel(wide_rank_sse2, WIDE_SSE2);
+  else
+    set_kernel(wide_rank_scalar, WIDE_SCALAR);
+}
+
+WideKernel tree_wide_kernel(void) {
+  pthread_once(&kernel_once, select_kernel);
+  return __atomic_load_n(&rank_kernel, __ATOMIC_RELAXED);
+}
+
+bool tree_wide_use_kernel(WideKernel kernel) {
+  // Run the default choice first so that it cannot override this one later
+  pthread_once(&kernel_once, select_kernel);
+  switch (kernel) {
+  case WIDE_AVX2:
+    if (!wide_rank_avx2_supported())
+      return false;
+    set_kernel(wide_rank_avx2, WIDE_AVX2);
+    break;
+  case WIDE_SSE2:
+    if (!wide_rank_sse2_supported())
+      return false;
+    set_kernel(wide_rank_sse2, WIDE_SSE2);
+    break;
+  default:
+    set_kernel(wide_rank_scalar, WIDE_SCALAR);
+  }
+  return true;
+}
+
+static Tree first_node(Tree node) {
+  while (node->left)
+    node = node->left;
+  return node;
+}
+
+static Tree next_node(Tree node) {
+  if (node->right)
+    return first_node(node->right);
+  while (node->parent && node == node->parent->right)
+    node = node->parent;
+  return node->parent;
+}
+
+// Fill the subtree of node k in sorted order, taking keys from 'cursor'
+static void fill(TreeWide wide, size_t k, Tree *cursor) {
+  if (k >= wide->nodes)
+    return;
+
+  int *keys = wide->keys + k * WIDE_KEYS;
+  for (size_t i = 0; i < WIDE_KEYS; i++) {
+    fill(wide, k * FANOUT + i + 1, cursor);
+    if (*cursor) {
+      memcpy(&keys[i], (*cursor)->data, sizeof(int));
+      *cursor = next_node(*cursor);
+    } else {
+      keys[i] = INT_MAX;
+    }
+  }
+  fill(wide, k * FANOUT + FANOUT, cursor);
+}
+
+TreeWide tree_wide_new(Tree tree) {
+  TreeWide wide = malloc(sizeof(TREE_STRUCT(TreeWide)));
+  if (!wide)
+    return NULL;
+
+  wide->count = tree_size(tree);
+  wide->nodes = (wide->count + WIDE_KEYS - 1) / WIDE_KEYS;
+  wide->block = malloc(wide->nodes * WIDE_KEYS * sizeof(int) + CACHE_LINE);
+  if (!wide->block) {
+    free(wide);
+    return NULL;
+  }
+  wide->keys = (int *)(((uintptr_t)wide->block + CACHE_LINE - 1) &
+                       ~(uintptr_t)(CACHE_LINE - 1));
+
+  Tree cursor = tree ? first_node(tree) : NULL;
+  fill(wide, 0, &cursor);
+
+  wide->has_max = false;
+  if (tree) {
+    Tree last = tree;
+    while (last->right)
+      last = last->right;
+    int max;
+    memcpy(&max, last->data, sizeof(int));
+    wide->has_max = max == INT_MAX;
+  }
+  return wide;
+}
+
+void tree_wide_delete(TreeWide wide) {
+  if (wide) {
+    free(wide->block);
+    free(wide);
+  }
+}
+
+const int *tree_wide_search(TreeWide wide, int key) {
+  if (!wide)
+    return NULL;
+  pthread_once(&kernel_once, select_kernel);
+  WideRankFunc rank = __atomic_load_n(&rank_func, __ATOMIC_RELAXED);
+
+  size_t k = 0;
+  while (k < wide->nodes) {
+    const int *keys = wide->keys + k * WIDE_KEYS;
+    unsigned i = rank(keys, key);
+    if (i < WIDE_KEYS && keys[i] == key)
+      return (key != INT_MAX || wide->has_max) ? &keys[i] : NULL;
+    k = k * FANOUT + i + 1;
+  }
+  return NULL;
+}
+
+size_t tree_wide_size(TreeWide wide) { return wide ? wide->count : 0; }
@@ -5,6 +5,43 @@ import os
 import numpy as np
 from matplotlib.ticker import LogLocator
 
+
+def plot_bench(path):
+    """Plot tree-bench output (CSV or JSON): per-operation latency by structure"""
+    df = pd.read_json(path) if path.endswith(".json") else pd.read_csv(path)
+    operations = list(dict.fromkeys(df["operation"]))
+    fig, axes = plt.subplots(1, len(operations), figsize=(6 * len(operations), 6), squeeze=False)
+    for ax, operation in zip(axes[0], operations):
+        rows = df[df["operation"] == operation]
+        # Several workloads in one file: one line per structure and workload
+        columns = ["structure", "workload"] if "workload" in rows and rows["workload"].nunique() > 1 else ["structure"]
+        for key, data in rows.groupby(columns, sort=False):
+            name = " ".join(str(k).upper() for k in (key if isinstance(key, tuple) else (key,)))
+            data = data.sort_values("n")
+            line, = ax.plot(data["n"], data["median_ns"], marker='o', label=f"{name} median")
+            # Band up to the 99th percentile: the tail of each structure
+            ax.fill_between(data["n"], data["median_ns"], data["p99_ns"], color=line.get_color(),
+                            alpha=0.2, label=f"{name} p99")
+        ax.set_xscale("log")
+        ax.set_yscale("log")
+        ax.set_title(operation.capitalize())
+        ax.set_xlabel("Number of elements (n)")
+        ax.set_ylabel("Time per operation (ns)")
+        ax.grid(True, which="both", ls="--", lw=0.5)
+        ax.legend()
+    distributions = ", ".join(dict.fromkeys(df["distribution"]))
+    workloads = ", ".join(dict.fromkeys(df["workload"])) if "workload" in df else "load"
+    fig.suptitle(f"tree-bench, workload {workloads}, {distributions} keys")
+    fig.tight_layout()
+    fig.savefig(os.path.splitext(path)[0] + ".png")
+    plt.show()
+
+
+# tree-bench output: python3 plot_results.py <results.csv|results.json>
+if len(sys.argv) == 2:
+    plot_bench(sys.argv[1])
+    sys.exit(0)
+
 csv_path = sys.argv[1]
 tree_type = sys.argv[2]
 png_path = os.path.join(os.path.dirname(csv_path), f"time_complexity_of_{tree_type}.png")
@@ -17,6 +54,9 @@ n_values = df["n"].values
 insert_times = np.maximum(df["insert_time"].values, 1e-6)
 search_times = np.maximum(df["search_time"].values, 1e-6)
 delete_times = np.maximum(df["delete_time"].values, 1e-6)
+has_snapshot = "snapshot_search_time" in df.columns
+if has_snapshot:
+    snapshot_times = np.maximum(df["snapshot_search_time"].values, 1e-6)
 
 # f(x) = x (normalized)
 ref_line = insert_times[-1] * (n_values / n_values[-1])
@@ -26,6 +66,8 @@ plt.figure(figsize=(12, 7))
 plt.plot(n_values, insert_times, marker='o', label="Insertion", color='blue')
 plt.plot(n_values, delete_times, marker='x', label="Deletion", color='red')
 plt.plot(n_values, search_times, marker='*', label="Searching", color='green')
+if has_snapshot:
+    plt.plot(n_values, snapshot_times, marker='s', label="Searching (snapshot)", color='orange')
 plt.plot(n_values, ref_line, linestyle='--', color='gray', label="f(n) = n")
 
 plt.xscale("log")
@@ -43,4 +85,70 @@ plt.grid(True, which="both", ls="--", lw=0.5)
 
 plt.tight_layout()
 plt.savefig(png_path)
+
+# Hardware counters per operation, written with -DTREE_PERF_COUNTERS=ON
+COUNTERS = ("cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses", "dtlb_misses")
+OPERATIONS = (("insert", "Insertion"), ("search", "Searching"), ("delete", "Deletion"))
+
+
+def has_counters(data):
+    return all(f"{op}_{counter}" in data.columns for op, _ in OPERATIONS for counter in COUNTERS)
+
+
+if has_counters(df):
+    fig, axes = plt.subplots(2, 3, figsize=(18, 10))
+    for ax, counter in zip(axes.flat, COUNTERS):
+        for op, label in OPERATIONS:
+            ax.plot(n_values, df[f"{op}_{counter}"].values, marker='o', label=label)
+        ax.set_xscale("log")
+        ax.set_title(counter.replace("_", " ").capitalize())
+        ax.set_xlabel("Number of elements (n)")
+        ax.set_ylabel("Count per operation")
+        ax.grid(True, which="both", ls="--", lw=0.5)
+        ax.legend()
+    fig.suptitle(f"Hardware counters of {tree_type.upper()} Tree operations")
+    fig.tight_layout()
+    fig.savefig(os.path.join(os.path.dirname(csv_path), f"perf_counters_of_{tree_type}.png"))
+
+# Head-to-head comparison of every tree whose results are already written
+result_dir = os.path.dirname(csv_path)
+compared = {}
+for name in ("avl", "bicolor", "btree"):
+    path = os.path.join(result_dir, f"results_{name}.csv")
+    if os.path.exists(path):
+        compared[name] = pd.read_csv(path)
+
+if len(compared) > 1:
+    fig, axes = plt.subplots(1, 3, figsize=(18, 6))
+    for ax, column, title in zip(axes, ("insert_time", "search_time", "delete_time"),
+                                 ("Insertion", "Searching", "Deletion")):
+        for name, data in compared.items():
+            ax.plot(data["n"], np.maximum(data[column].values, 1e-6), marker='o', label=name.upper())
+        ax.set_xscale("log")
+        ax.set_yscale("log")
+        ax.set_title(title)
+        ax.set_xlabel("Number of elements (n)")
+        ax.set_ylabel("Time (seconds)")
+        ax.grid(True, which="both", ls="--", lw=0.5)
+        ax.legend()
+    fig.tight_layout()
+    fig.savefig(os.path.join(result_dir, "comparison.png"))
+
+    # Same for the counters: one row per counter, one column per operation
+    counted = {name: data for name, data in compared.items() if has_counters(data)}
+    if len(counted) > 1:
+        fig, axes = plt.subplots(len(COUNTERS), 3, figsize=(18, 4 * len(COUNTERS)), squeeze=False)
+        for row, counter in zip(axes, COUNTERS):
+            for ax, (op, label) in zip(row, OPERATIONS):
+                for name, data in counted.items():
+                    ax.plot(data["n"], data[f"{op}_{counter}"].values, marker='o', label=name.upper())
+                ax.set_xscale("log")
+                ax.set_title(f"{label}: {counter.replace('_', ' ')}")
+                ax.set_xlabel("Number of elements (n)")
+                ax.set_ylabel("Count per operation")
+                ax.grid(True, which="both", ls="--", lw=0.5)
+                ax.legend()
+        fig.tight_layout()
+        fig.savefig(os.path.join(result_dir, "comparison_perf_counters.png"))
+
 plt.show()
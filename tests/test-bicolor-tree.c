@@ -1,5 +1,18 @@
 #include "test.h"
+#include <pthread.h>
+#include <unistd.h>
 #include "bicolor-tree.h"
+#include "bicolor-typed.h"
+
+/* Dictionary entries kept out of line: the nodes hold a TYPED_STR_PREFIX
+   byte prefix of the word and a pointer to the entry */
+#define TYPED_NAME rb_dico
+#define TYPED_KEY TypedStrKey
+#define TYPED_CMP(a, b) TYPED_CMP_STR(a, b)
+#define TYPED_VALUE Hashmap
+#define TYPED_KEY_OF(v) typed_str_key((v)->word)
+#define TYPED_TIE(a, b) strcmp((a)->word, (b)->word)
+#include "bicolor-typed-impl.h"
 
 // Write our results into a csv file
 #ifdef _WIN32
@@ -10,6 +23,15 @@ const char* result_path_cmd = "mkdir -p ../../result";
 const char* python_cmd = "python3 ../../src/plot_results.py ../../result/results_bicolor.csv bicolor";
 #endif
 
+// Key counts of test_int, one CSV row each
+const size_t int_sizes[NB_TESTS] = {10, 50, 100, 500, 1000, 5000, 10000,
+                                    50000, 100000, 500000, 1000000, 5000000, 10000000,
+                                    20000000, 50000000, 100000000};
+
+// test_compact stops there: past it, its three timed passes and the
+// pointer tree it measures against add minutes to every test run
+#define COMPACT_MAX_KEYS 10000000
+
 void print_bicolor_tree(Tree tree, void (*print)(void *), int depth) {
   if (!tree)
     return;
@@ -26,20 +48,25 @@ void print_bicolor_tree(Tree tree, void (*print)(void *), int depth) {
 void test_int()
 {
   // add n values and delete n values
-  size_t sizes[] = {10, 50, 100, 500, 1000, 5000, 10000,
-                  50000, 100000, 500000, 1000000 , 5000000, 10000000,
-                  20000000, 50000000, 100000000};
   Result results[NB_TESTS];
 
   for (int i = 0; i < NB_TESTS; i++) {
-    size_t n = sizes[i];
+    size_t n = int_sizes[i];
     int *values = unique_list(n);
     Tree root = NULL;
 
     results[i].n = n;
     results[i].insert_time = test_insert_complexity(&root, values, n, (InsertFunc)tree_insert_sorted);
+    results[i].insert_perf = perf_last();
     results[i].search_time = test_search_complexity(&root, values, n, (SearchFunc)tree_search);
+    results[i].search_perf = perf_last();
+
+    TreeSnapshot snapshot = tree_snapshot_new(root, sizeof(int));
+    results[i].snapshot_search_time = test_search_complexity((void **)&snapshot, values, n, (SearchFunc)tree_snapshot_search);
+    tree_snapshot_delete(snapshot);
+
     results[i].delete_time = test_delete_complexity(&root, values, n, (DeleteFunc)node_delete);
+    results[i].delete_perf = perf_last();
 
     tree_delete(root, NULL);
     free(values);
@@ -48,9 +75,18 @@ void test_int()
   system(result_path_cmd);
   FILE *f = fopen("../../result/results_bicolor.csv", "w");
 
-  fprintf(f, "n,insert_time,search_time,delete_time\n");
+  fprintf(f, "n,insert_time,search_time,delete_time,snapshot_search_time");
+  perf_csv_header(f, "insert");
+  perf_csv_header(f, "search");
+  perf_csv_header(f, "delete");
+  fprintf(f, "\n");
   for (int i = 0; i < NB_TESTS; i++) {
-    fprintf(f, "%zu,%.10f,%.10f,%.10f\n", results[i].n, results[i].insert_time, results[i].search_time, results[i].delete_time);
+    fprintf(f, "%zu,%.10f,%.10f,%.10f,%.10f", results[i].n, results[i].insert_time, results[i].search_time, results[i].delete_time,
+            results[i].snapshot_search_time);
+    perf_csv_row(f, &results[i].insert_perf);
+    perf_csv_row(f, &results[i].search_perf);
+    perf_csv_row(f, &results[i].delete_perf);
+    fprintf(f, "\n");
   }
   fclose(f);
 
@@ -88,8 +124,1017 @@ void test_hashmap() {
   printf("\n");
 }
 
+void test_compact() {
+  printf("Compact tree vs pointer tree (int payload, bytes held by the nodes):\n");
+  for (int i = 0; i < NB_TESTS && int_sizes[i] <= COMPACT_MAX_KEYS; i++) {
+    size_t n = int_sizes[i];
+    int *values = unique_list(n);
+    CompactTree tree = compact_tree_new(sizeof(int));
+    struct timespec start, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t j = 0; j < n; j++)
+      compact_tree_insert_sorted(tree, &values[j], compare_int);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double insert_time = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+
+    size_t found = 0;
+    for (size_t j = 0; j < n; j++)
+      found += compact_tree_search(tree, &values[j], compare_int) != NULL;
+
+    /* The same keys in pointer nodes, from an arena that counts its chunks */
+    TreeArena arena = tree_arena_new();
+    Tree pointer = NULL;
+    for (size_t j = 0; j < n; j++)
+      tree_arena_insert(arena, &pointer, &values[j], sizeof(int), compare_int);
+    size_t pool_bytes = compact_tree_memory(tree), pointer_bytes = tree_arena_memory(arena);
+    tree_arena_delete(arena);
+    printf("  n=%zu insert=%.6fs found=%zu height=%zu pool=%zu (%.1f/node) pointer tree=%zu (%.1f/node)\n",
+         n, insert_time, found, compact_tree_height(tree), pool_bytes,
+         (double)pool_bytes / n, pointer_bytes, (double)pointer_bytes / n);
+
+    for (size_t j = 0; j < n; j++)
+      compact_node_delete(tree, &values[j], NULL, compare_int);
+    printf("  size after deleting: %zu, ", compact_tree_size(tree));
+    report_errors((found != n) + (compact_tree_size(tree) != 0));
+
+    compact_tree_delete(tree, NULL);
+    free(values);
+  }
+  printf("\n");
+}
+
+void test_typed() {
+  size_t sizes[] = {1000, 10000, 100000, 1000000};
+  size_t nb = sizeof(sizes) / sizeof(sizes[0]);
+
+  printf("Typed rb_int tree vs generic tree (seconds):\n");
+  for (size_t i = 0; i < nb; i++) {
+    size_t n = sizes[i];
+    int *values = unique_list(n);
+    struct timespec start, end;
+
+    Tree root = NULL;
+    double generic_insert = test_insert_complexity((void **)&root, values, n, (InsertFunc)tree_insert_sorted);
+    double generic_search = test_search_complexity((void **)&root, values, n, (SearchFunc)tree_search);
+    double generic_delete = test_delete_complexity((void **)&root, values, n, (DeleteFunc)node_delete);
+    tree_delete(root, NULL);
+
+    rb_int_tree tree;
+    rb_int_init(&tree);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t j = 0; j < n; j++)
+      rb_int_insert(&tree, values[j]);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double typed_insert = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+
+    size_t found = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t j = 0; j < n; j++)
+      found += rb_int_search(&tree, values[j]) != NULL;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double typed_search = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t j = 0; j < n; j++)
+      rb_int_delete(&tree, values[j]);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double typed_delete = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+
+    printf("  n=%zu insert %.6f/%.6f search %.6f/%.6f delete %.6f/%.6f (typed/generic) found=%zu left=%zu, ",
+         n, typed_insert, generic_insert, typed_search, generic_search,
+         typed_delete, generic_delete, found, rb_int_size(&tree));
+    report_errors((found != n) + (rb_int_size(&tree) != 0));
+
+    rb_int_destroy(&tree);
+    free(values);
+  }
+  printf("\n");
+}
+
+void test_from_sorted() {
+  size_t sizes[] = {1000, 10000, 100000, 1000000};
+  size_t nb = sizeof(sizes) / sizeof(sizes[0]);
+
+  printf("Bulk load from sorted array vs insertion (seconds):\n");
+  for (size_t i = 0; i < nb; i++) {
+    size_t n = sizes[i];
+    int *values = unique_list(n);
+    struct timespec start, end;
+    TreeArena arena = tree_arena_new();
+
+    Tree inserted = NULL;
+    double insert_time = test_insert_complexity((void **)&inserted, values, n, (InsertFunc)tree_insert_sorted);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    Tree loaded = tree_arena_from_sorted(arena, values, n, sizeof(int));
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double load_time = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+
+    size_t heights[2] = {tree_height(loaded), tree_height(inserted)};
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    tree_delete(inserted, NULL); /* releases its private arena at once */
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double delete_time = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+    size_t found = 0;
+    for (size_t j = 0; j < n; j++)
+      found += tree_search(loaded, &values[j], compare_int) != NULL;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    tree_arena_clear(arena); /* releases the loaded tree at once */
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double clear_time = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+    loaded = tree_arena_from_sorted(arena, values, n, sizeof(int)); /* the arena is reusable */
+
+    printf("  n=%zu from_sorted=%.6f insert=%.6f height=%zu/%zu found=%zu delete=%.6f clear=%.6f reloaded=%zu, ",
+         n, load_time, insert_time, heights[0], heights[1], found, delete_time, clear_time,
+         tree_size(loaded));
+    report_errors((found != n) + (tree_size(loaded) != n));
+
+    tree_arena_delete(arena);
+    free(values);
+  }
+
+  int shuffled[] = {42, 7, 19, 3, 88, 7, 61, 25, 0, 54, 13, 42};
+  size_t m = sizeof(shuffled) / sizeof(shuffled[0]);
+  bool sorted = tree_sort(shuffled, m, sizeof(int), compare_int);
+  size_t errors = !sorted;
+  printf("tree_sort: %s ->", sorted ? "ok" : "failed");
+  for (size_t i = 0; i < m; i++) {
+    printf(" %d", shuffled[i]);
+    errors += i > 0 && shuffled[i - 1] > shuffled[i];
+  }
+  printf(", ");
+  report_errors(errors);
+  printf("\n");
+}
+
+void test_batch() {
+  size_t sizes[] = {1000, 10000, 100000, 1000000};
+  size_t nb = sizeof(sizes) / sizeof(sizes[0]);
+  size_t batch = 1000;
+
+  printf("Batch (%zu keys per call) vs single-key operations (seconds):\n", batch);
+  for (size_t i = 0; i < nb; i++) {
+    size_t n = sizes[i];
+    int *values = unique_list(n);
+    Tree root = NULL;
+    double insert_time = test_insert_complexity((void **)&root, values, n, (InsertFunc)tree_insert_sorted);
+    double search_time = test_search_complexity((void **)&root, values, n, (SearchFunc)tree_search);
+    double delete_time = test_delete_complexity((void **)&root, values, n, (DeleteFunc)node_delete);
+
+    Tree batched = NULL;
+    double insert_batch = test_insert_batch_complexity((void **)&batched, values, n, batch, (InsertBatchFunc)tree_insert_batch);
+    double search_batch = test_search_batch_complexity((void **)&batched, values, n, batch, (SearchBatchFunc)tree_search_batch);
+    size_t size_after_insert = tree_size(batched);
+    double delete_batch = test_delete_batch_complexity((void **)&batched, values, n, batch, (DeleteBatchFunc)tree_delete_batch);
+
+    printf("  n=%zu insert %.6f/%.6f search %.6f/%.6f delete %.6f/%.6f (batch/single) size=%zu left=%zu, ",
+         n, insert_batch, insert_time, search_batch, search_time,
+         delete_batch, delete_time, size_after_insert, tree_size(batched));
+    report_errors((size_after_insert != n) + (tree_size(batched) != 0));
+
+    tree_delete(batched, NULL);
+    free(values);
+  }
+
+  /* Unsorted batch with a duplicate: results come back in input order */
+  Tree root = NULL;
+  int keys[] = {30, 10, 50, 20, 10, 40};
+  size_t m = sizeof(keys) / sizeof(keys[0]);
+  bool inserted[6];
+  void *found[6];
+  tree_insert_batch(&root, keys, m, sizeof(int), compare_int, inserted);
+  int probes[] = {50, 15, 10, 40, 60, 20};
+  tree_search_batch(root, probes, m, sizeof(int), compare_int, found);
+  bool expected_new[] = {true, true, true, true, false, true};
+  bool expected_found[] = {true, false, true, true, false, true};
+  size_t errors = 0;
+  printf("Batch results:");
+  for (size_t i = 0; i < m; i++) {
+    printf(" %d:%s/%d:%s", keys[i], inserted[i] ? "new" : "dup",
+         probes[i], found[i] ? "found" : "missing");
+    errors += inserted[i] != expected_new[i] || (found[i] != NULL) != expected_found[i];
+  }
+  printf(", ");
+  report_errors(errors);
+  printf("\n");
+  tree_delete(root, NULL);
+}
+
+void test_wide() {
+  size_t sizes[] = {1000, 10000, 100000, 1000000};
+  size_t nb = sizeof(sizes) / sizeof(sizes[0]);
+  WideKernel kernels[] = {WIDE_SCALAR, WIDE_SSE2, WIDE_AVX2};
+  const char *names[] = {"scalar", "sse2", "avx2"};
+  WideKernel best = tree_wide_kernel();
+
+  printf("Wide int snapshot vs tree_search, shuffled probes (million searches/sec), default kernel %s:\n",
+       names[best]);
+  for (size_t i = 0; i < nb; i++) {
+    size_t n = sizes[i];
+    int *values = unique_list(n);
+    Tree root = NULL;
+    for (size_t j = 0; j < n; j++)
+      tree_insert_sorted(&root, &values[j], sizeof(int), compare_int);
+    shuffle_list(values, n);
+
+    double tree_time = test_search_complexity((void **)&root, values, n, (SearchFunc)tree_search);
+    printf("  n=%zu tree_search %.2f", n, n / tree_time * 1e-6);
+
+    TreeWide wide = tree_wide_new(root);
+    size_t errors = 0;
+    for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+      if (!tree_wide_use_kernel(kernels[k]))
+        continue;
+      struct timespec start, end;
+      size_t found = 0;
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      for (size_t j = 0; j < n; j++)
+        found += tree_wide_search(wide, values[j]) != NULL;
+      clock_gettime(CLOCK_MONOTONIC, &end);
+      double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+      printf(" %s %.2f%s", names[k], n / elapsed * 1e-6, found == n ? "" : " (MISSING KEYS)");
+      errors += found != n;
+    }
+    printf(", ");
+    report_errors(errors);
+    tree_wide_use_kernel(best);
+
+    tree_wide_delete(wide);
+    tree_delete(root, NULL);
+    free(values);
+  }
+  printf("\n");
+}
+
+typedef struct {
+  ConcurrentTree tree;
+  size_t range;    /* keys are drawn from [0, range) */
+  size_t ops;
+  int read_percent;
+  unsigned seed;
+} ConcurrentJob;
+
+void *concurrent_worker(void *arg) {
+  ConcurrentJob *job = arg;
+  uint64_t state = job->seed * 0x9e3779b97f4a7c15u + 1;
+  int out;
+
+  for (size_t i = 0; i < job->ops; i++) {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    int key = (int)((state >> 8) % job->range);
+    if ((int)(state % 100) < job->read_percent)
+      concurrent_tree_search(job->tree, &key, compare_int, &out);
+    else if (state & (1u << 20))
+      concurrent_tree_insert_sorted(job->tree, &key, compare_int);
+    else
+      concurrent_node_delete(job->tree, &key, NULL, compare_int);
+  }
+  return NULL;
+}
+
+/* Thread counts of the scaling runs, 0 after the last: 1, 2 and 3 (even on
+   fewer cores), the powers of two below 'cores', then 'cores' itself */
+size_t next_thread_count(size_t threads, size_t cores) {
+  if (threads < 3)
+    return threads + 1;
+  if (threads >= cores)
+    return 0;
+  size_t next = threads == 3 ? 4 : threads * 2;
+  return next < cores ? next : cores;
+}
+
+void test_concurrent() {
+  size_t n = 1000000;
+  size_t ops = 200000; /* per thread */
+  int mixes[] = {95, 50};
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  size_t max_threads = cores > 2 ? (size_t)cores : 2;
+
+  printf("Concurrent tree throughput, %zu keys, %ld cores (million ops/sec):\n", n, cores);
+  for (size_t m = 0; m < sizeof(mixes) / sizeof(mixes[0]); m++) {
+    int *values = unique_list(n);
+    shuffle_list(values, n);
+    ConcurrentTree tree = concurrent_tree_new(sizeof(int));
+    /* Every other key is present, so that writes both insert and delete */
+    for (size_t j = 0; j < n; j += 2)
+      concurrent_tree_insert_sorted(tree, &values[j], compare_int);
+
+    printf("  %d/%d reads/writes:", mixes[m], 100 - mixes[m]);
+    for (size_t threads = 1; threads; threads = next_thread_count(threads, max_threads)) {
+      pthread_t ids[threads];
+      ConcurrentJob jobs[threads];
+      struct timespec start, end;
+
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      for (size_t t = 0; t < threads; t++) {
+        jobs[t] = (ConcurrentJob){tree, n, ops, mixes[m], (unsigned)(t + 1)};
+        pthread_create(&ids[t], NULL, concurrent_worker, &jobs[t]);
+      }
+      for (size_t t = 0; t < threads; t++)
+        pthread_join(ids[t], NULL);
+      clock_gettime(CLOCK_MONOTONIC, &end);
+
+      double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+      printf(" %zu thread%s %.2f", threads, threads > 1 ? "s" : "",
+           threads * ops / elapsed * 1e-6);
+    }
+    /* Quiescent again: the searches see every key the size counts */
+    size_t present = 0;
+    int out;
+    for (size_t j = 0; j < n; j++)
+      present += concurrent_tree_search(tree, &values[j], compare_int, &out);
+    printf(" (size %zu), ", concurrent_tree_size(tree));
+    report_errors(present != concurrent_tree_size(tree));
+
+    concurrent_tree_delete(tree, NULL);
+    free(values);
+  }
+  printf("\n");
+}
+
+/* Thread-safe walk callback: counts the negative keys (there are none) */
+void count_negative(void *node, void *count) {
+  if (*(int *)tree_get_data(node) < 0)
+    __atomic_add_fetch((size_t *)count, 1, __ATOMIC_RELAXED);
+}
+
+double seconds_since(const struct timespec *start) {
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  return (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+void test_parallel() {
+  size_t n = 2000000;
+  int *values = unique_list(n);
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  size_t max_threads = cores > 2 ? (size_t)cores : 2;
+
+  printf("Parallel walks, %zu nodes, %ld cores (seconds):\n", n, cores);
+  for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+    struct timespec start;
+    size_t negative = 0;
+    tree_parallel_threads(threads);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    Tree tree = tree_parallel_from_sorted(values, n, sizeof(int));
+    double build_time = seconds_since(&start);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    size_t size = tree_parallel_size(tree);
+    double size_time = seconds_since(&start);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    tree_parallel_in_order(tree, count_negative, &negative);
+    double walk_time = seconds_since(&start);
+
+    size_t height = tree_height(tree);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    tree_parallel_delete(tree, NULL);
+    double delete_time = seconds_since(&start);
+
+    printf("  %zu thread%s: from_sorted=%.4f size=%.4f in_order=%.4f delete=%.4f (size %zu, height %zu, negative %zu), ",
+         threads, threads > 1 ? "s" : "", build_time, size_time, walk_time, delete_time,
+         size, height, negative);
+    report_errors((size != n) + negative);
+  }
+  tree_parallel_threads(0);
+  free(values);
+  printf("\n");
+}
+
+/* Naive merge: reinsert every node of a tree into 'target' */
+void insert_into(void *node, void *target) {
+  tree_insert_sorted((Tree *)target, tree_get_data(node), sizeof(int), compare_int);
+}
+
+typedef Tree (*SetFunc)(Tree, Tree, void (*)(void *), int (*)(const void *, const void *), size_t);
+
+void test_set_operations() {
+  size_t sizes[][2] = {{1000000, 1000000}, {1000000, 10000}};
+  SetFunc ops[] = {tree_union, tree_intersection, tree_difference};
+
+  printf("Set operations, join-based vs reinsertion loop (seconds):\n");
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    size_t n = sizes[i][0], m = sizes[i][1];
+    int *a = malloc(n * sizeof(int));
+    int *b = malloc(m * sizeof(int));
+    for (size_t j = 0; j < n; j++)
+      a[j] = (int)(2 * j);
+    for (size_t j = 0; j < m; j++)
+      b[j] = (int)(3 * j); /* multiples of 6 are in both */
+    struct timespec start;
+
+    Tree naive = tree_from_sorted(a, n, sizeof(int));
+    Tree other = tree_from_sorted(b, m, sizeof(int));
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    tree_in_order(other, insert_into, &naive);
+    double naive_time = seconds_since(&start);
+    size_t naive_size = tree_size(naive);
+    tree_delete(naive, NULL);
+    tree_delete(other, NULL);
+
+    /* The even multiples of 3 below 2n are in both trees */
+    size_t both = 0;
+    for (size_t j = 0; j < m; j++)
+      both += b[j] % 2 == 0 && (size_t)b[j] < 2 * n;
+    size_t expected[3] = {n + m - both, both, n - both};
+    size_t errors = naive_size != expected[0];
+
+    double times[3];
+    size_t result_sizes[3], heights[3];
+    for (size_t k = 0; k < 3; k++) {
+      Tree x = tree_from_sorted(a, n, sizeof(int));
+      Tree y = tree_from_sorted(b, m, sizeof(int));
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      Tree result = ops[k](x, y, NULL, compare_int, sizeof(int));
+      times[k] = seconds_since(&start);
+      result_sizes[k] = tree_size(result);
+      errors += result_sizes[k] != expected[k];
+      heights[k] = tree_height(result);
+      tree_delete(result, NULL);
+    }
+
+    printf("  n=%zu m=%zu reinsert=%.4f union=%.4f intersection=%.4f difference=%.4f\n",
+         n, m, naive_time, times[0], times[1], times[2]);
+    printf("    sizes %zu/%zu/%zu/%zu heights %zu/%zu/%zu, ", naive_size,
+         result_sizes[0], result_sizes[1], result_sizes[2], heights[0], heights[1], heights[2]);
+    report_errors(errors);
+    free(a);
+    free(b);
+  }
+
+  int keys[20];
+  for (int j = 0; j < 20; j++)
+    keys[j] = j;
+  Tree left, right;
+  int pivot = 10;
+  Tree middle = tree_split(tree_from_sorted(keys, 20, sizeof(int)), &pivot, compare_int, &left, &right);
+  size_t errors = tree_size(left) != 10 || !middle || tree_size(right) != 9;
+  printf("split at %d: %zu + %s + %zu,", pivot, tree_size(left), middle ? "found" : "missing", tree_size(right));
+  Tree joined = tree_join(left, middle, right);
+  errors += tree_size(joined) != 20;
+  printf(" joined back: size %zu height %zu, ", tree_size(joined), tree_height(joined));
+  report_errors(errors);
+  printf("\n");
+  tree_delete(joined, NULL);
+}
+
+/* In-order callback counting the keys of a range, the scan rank queries replace */
+void count_in_range(void *node, void *range) {
+  int key = *(int *)tree_get_data(node);
+  int *bounds = range;
+  if (key >= bounds[0] && key <= bounds[1])
+    bounds[2]++;
+}
+
+void test_order_statistics() {
+  size_t n = 1000000;
+#ifdef TREE_ORDER_STATISTICS
+  size_t queries = 100000;
+  const char *mode = "subtree counts";
+#else
+  size_t queries = 10; /* every query counts whole subtrees */
+  const char *mode = "no subtree counts";
+#endif
+  int *values = unique_list(n);
+  shuffle_list(values, n);
+  struct timespec start;
+
+  /* Keys 0 .. n - 1 except the multiples of 3 */
+  Tree tree = NULL;
+  for (size_t i = 0; i < n; i++)
+    tree_insert_sorted(&tree, &values[i], sizeof(int), compare_int);
+  for (size_t i = 0; i < n; i++) {
+    if (values[i] % 3 == 0)
+      node_delete(&tree, &values[i], NULL, compare_int, sizeof(int));
+  }
+
+  size_t errors = 0;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (size_t q = 0; q < queries; q++) {
+    int key = values[q];
+    errors += tree_rank(tree, &key, compare_int) != (size_t)(key - (key + 2) / 3);
+  }
+  double rank_time = seconds_since(&start);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (size_t q = 0; q < queries; q++) {
+    size_t index = (size_t)values[q] / 2;
+    int *key = tree_select(tree, index);
+    errors += !key || *key != (int)(index / 2 * 3 + 1 + index % 2);
+  }
+  double select_time = seconds_since(&start);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (size_t q = 0; q < queries; q++) {
+    int low = values[q] / 2, high = values[q];
+    int below_high = high + 1 - (high + 3) / 3, below_low = low - (low + 2) / 3;
+    errors += tree_count_range(tree, &low, &high, compare_int) != (size_t)(below_high - below_low);
+  }
+  double range_time = seconds_since(&start);
+
+  int range[3] = {0, (int)n / 2, 0};
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  tree_in_order(tree, count_in_range, range);
+  double scan_time = seconds_since(&start);
+
+  printf("Order statistics (%s), %zu keys, %zu queries (microseconds per query):\n", mode, tree_size(tree), queries);
+  printf("  rank=%.3f select=%.3f count_range=%.3f, in-order range scan=%.3f (count %d), ",
+       rank_time / queries * 1e6, select_time / queries * 1e6, range_time / queries * 1e6,
+       scan_time * 1e6, range[2]);
+  report_errors(errors);
+  printf("\n");
+
+  tree_delete(tree, NULL);
+  free(values);
+}
+
+void test_range_queries() {
+  size_t n = 1000000, queries = 1000, callback_queries = 10;
+  size_t widths[] = {10, 1000, 10000};
+  int *values = unique_list(n);
+  shuffle_list(values, n);
+  struct timespec start;
+
+  /* Even keys 0 .. 2n - 2: half of the range bounds are absent */
+  Tree tree = NULL;
+  for (size_t i = 0; i < n; i++) {
+    int key = values[i] * 2;
+    tree_insert_sorted(&tree, &key, sizeof(int), compare_int);
+  }
+
+  size_t errors = 0, seen = 0;
+  for (Tree node = tree_last(tree); node; node = iter_prev(node))
+    errors += *(int *)tree_get_data(node) != (int)(2 * (n - ++seen));
+  errors += seen != n;
+
+  printf("Range queries over %zu keys (microseconds per query):\n", n);
+  for (size_t w = 0; w < sizeof(widths) / sizeof(widths[0]); w++) {
+    long long sum = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t q = 0; q < queries; q++) {
+      int low = values[q], high = low + 2 * (int)widths[w] - 1;
+      size_t count = 0;
+      for (Tree node = tree_lower_bound(tree, &low, compare_int); node; node = iter_next(node)) {
+        int key = *(int *)tree_get_data(node);
+        if (key > high)
+          break;
+        sum += key;
+        count++;
+      }
+      size_t first = (size_t)(low + 1) / 2, last = (size_t)high / 2;
+      if (last > n - 1)
+        last = n - 1;
+      errors += count != (first <= last ? last - first + 1 : 0);
+    }
+    double cursor_time = seconds_since(&start);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t q = 0; q < callback_queries; q++) {
+      int range[3] = {values[q], values[q] + 2 * (int)widths[w] - 1, 0};
+      tree_in_order(tree, count_in_range, range);
+      sum += range[2];
+    }
+    double callback_time = seconds_since(&start);
+
+    printf("  width %zu: cursor=%.3f in-order callback=%.3f (checksum %lld)\n", widths[w],
+         cursor_time / queries * 1e6, callback_time / callback_queries * 1e6, sum);
+  }
+
+  /* Upper bound skips an equal key, lower bound stops on it */
+  int probe = 10;
+  Tree upper = tree_upper_bound(tree, &probe, compare_int);
+  Tree lower = tree_lower_bound(tree, &probe, compare_int);
+  errors += !upper || !lower || *(int *)tree_get_data(upper) != 12 || iter_next(lower) != upper;
+  probe = 2 * (int)n;
+  errors += tree_lower_bound(tree, &probe, compare_int) != NULL;
+  printf("  ");
+  report_errors(errors);
+  printf("\n");
+
+  tree_delete(tree, NULL);
+  free(values);
+}
+
+void test_file() {
+  size_t n = 1000000, queries = 100000;
+  const char *path = "test-tree-file.tree";
+  int *values = unique_list(n);
+  shuffle_list(values, n);
+  struct timespec start;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  Tree tree = NULL;
+  for (size_t i = 0; i < n; i++)
+    tree_insert_sorted(&tree, &values[i], sizeof(int), compare_int);
+  double build_time = seconds_since(&start);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  bool written = tree_file_write(tree, sizeof(int), path);
+  double write_time = seconds_since(&start);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  TreeFile file = tree_file_open(path, sizeof(int));
+  double open_time = seconds_since(&start);
+
+  size_t errors = !written || !file || tree_file_size(file) != n;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (size_t q = 0; q < queries; q++) {
+    int *found = tree_file_search(file, &values[q], compare_int);
+    errors += !found || *found != values[q];
+  }
+  double search_time = seconds_since(&start);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (size_t q = 0; q < queries; q++)
+    errors += tree_search(tree, &values[q], compare_int) == NULL;
+  double tree_time = seconds_since(&start);
+
+  int absent = -1;
+  errors += tree_file_search(file, &absent, compare_int) != NULL;
+  /* Another payload size or no file at all: nothing to map */
+  TreeFile wrong = tree_file_open(path, sizeof(long long));
+  errors += wrong != NULL;
+  tree_file_close(wrong);
+  errors += tree_file_open("no-such-tree-file.tree", sizeof(int)) != NULL;
+
+  printf("Tree file, %zu keys: insert build=%.3fs write=%.3fs open=%.3fms\n", n, build_time,
+       write_time, open_time * 1e3);
+  printf("  search (microseconds per query): file=%.3f tree=%.3f, ",
+       search_time / queries * 1e6, tree_time / queries * 1e6);
+  report_errors(errors);
+  printf("\n");
+
+  tree_file_close(file);
+  remove(path);
+  tree_delete(tree, NULL);
+  free(values);
+}
+
+long file_bytes(const char *path) {
+  FILE *f = fopen(path, "rb");
+  if (!f)
+    return -1;
+  fseek(f, 0, SEEK_END);
+  long bytes = ftell(f);
+  fclose(f);
+  return bytes;
+}
+
+void test_stream() {
+  size_t sizes[] = {10000, 100000, 1000000, 10000000};
+  const char *codecs[] = {"raw", "delta varint"};
+  const char *path = "test-tree-stream.tree";
+  struct timespec start;
+
+  printf("Tree stream (payload MB/s):\n");
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    size_t n = sizes[i];
+    int *values = unique_list(n);
+    Tree tree = tree_from_sorted(values, n, sizeof(int));
+    double megabytes = n * sizeof(int) / 1e6;
+
+    for (int codec = TREE_STREAM_RAW; codec <= TREE_STREAM_DELTA_VARINT; codec++) {
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      bool written = tree_stream_write(tree, sizeof(int), path, (TreeStreamCodec)codec);
+      double write_time = seconds_since(&start);
+      long bytes = file_bytes(path);
+
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      Tree copy;
+      bool loaded = tree_stream_read(path, sizeof(int), &copy);
+      double read_time = seconds_since(&start);
+
+      size_t errors = !written || !loaded || tree_size(copy) != n;
+      Tree a = tree_first(tree), b = tree_first(copy);
+      for (; a && b; a = iter_next(a), b = iter_next(b))
+        errors += compare_int(tree_get_data(a), tree_get_data(b)) != 0;
+      errors += a != b;
+
+      printf("  n=%zu %s: %ld bytes, write=%.1f read=%.1f, ", n, codecs[codec],
+           bytes, megabytes / write_time, megabytes / read_time);
+      report_errors(errors);
+      tree_delete(copy, NULL);
+    }
+    remove(path);
+    tree_delete(tree, NULL);
+    free(values);
+  }
+  printf("\n");
+}
+
+void test_stats() {
+  size_t sizes[] = {1000, 100000, 1000000};
+  TreeStats insert, search, del;
+
+  printf("Operation statistics (per operation, shuffled keys):\n");
+  if (!tree_stats(&insert)) {
+    printf("  built without TREE_STATS\n\n");
+    return;
+  }
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    size_t n = sizes[i];
+    int *values = unique_list(n);
+    shuffle_list(values, n);
+    Tree tree = NULL;
+
+    tree_stats_reset();
+    for (size_t j = 0; j < n; j++)
+      tree_insert_sorted(&tree, &values[j], sizeof(int), compare_int);
+    tree_stats(&insert);
+    tree_stats_reset();
+    for (size_t j = 0; j < n; j++)
+      tree_search(tree, &values[j], compare_int);
+    tree_stats(&search);
+    tree_stats_reset();
+    for (size_t j = 0; j < n; j++)
+      node_delete(&tree, &values[j], NULL, compare_int, sizeof(int));
+    tree_stats(&del);
+
+    /* One comparison per node visited on the way down */
+    size_t errors = insert.inserts != n || search.searches != n || del.deletes != n ||
+                    insert.comparisons != insert.insert_visits ||
+                    search.comparisons != search.search_visits ||
+                    del.comparisons != del.delete_visits || tree != NULL;
+    double ops = (double)n;
+    printf("  n=%zu insert: single=%.3f double=%.3f recolorings=%.3f path=%.2f"
+           " | search: path=%.2f | delete: single=%.3f double=%.3f recolorings=%.3f"
+           " path=%.2f, ",
+           n, insert.single_rotations / ops, insert.double_rotations / ops,
+           insert.recolorings / ops, insert.insert_visits / ops, search.search_visits / ops,
+           del.single_rotations / ops, del.double_rotations / ops, del.recolorings / ops,
+           del.delete_visits / ops);
+    report_errors(errors);
+    tree_delete(tree, NULL);
+    free(values);
+  }
+  printf("\n");
+}
+
+void test_hints() {
+  size_t sizes[] = {1000, 100000, 1000000};
+  TreeStats stats;
+  bool counted = tree_stats(&stats);
+
+  printf("Finger hints vs root descents (near-sorted keys, hint/root):\n");
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    size_t n = sizes[i];
+    int *values = clustered_list(n);
+    Tree plain = NULL, hinted = NULL, hint = NULL;
+    struct timespec start;
+    uint64_t compares[4];
+    double times[4];
+    size_t found = 0, found_hint = 0;
+
+    tree_stats_reset();
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t j = 0; j < n; j++)
+      tree_insert_sorted(&plain, &values[j], sizeof(int), compare_int);
+    times[0] = seconds_since(&start);
+    tree_stats(&stats);
+    compares[0] = stats.comparisons;
+
+    tree_stats_reset();
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t j = 0; j < n; j++)
+      tree_insert_hint(&hinted, &hint, &values[j], sizeof(int), compare_int);
+    times[1] = seconds_since(&start);
+    tree_stats(&stats);
+    compares[1] = stats.comparisons;
+
+    tree_stats_reset();
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t j = 0; j < n; j++)
+      found += tree_search(plain, &values[j], compare_int) != NULL;
+    times[2] = seconds_since(&start);
+    tree_stats(&stats);
+    compares[2] = stats.comparisons;
+
+    tree_stats_reset();
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t j = 0; j < n; j++)
+      found_hint += tree_search_hint(hinted, &hint, &values[j], compare_int) != NULL;
+    times[3] = seconds_since(&start);
+    tree_stats(&stats);
+    compares[3] = stats.comparisons;
+
+    /* Both trees get the same shape, whatever the descents started from */
+    int missing = -1;
+    size_t errors = tree_size(hinted) != tree_size(plain) ||
+                    tree_height(hinted) != tree_height(plain) ||
+                    found != n || found_hint != n ||
+                    tree_search_hint(hinted, &hint, &missing, compare_int) != NULL;
+    printf("  n=%zu insert %.6f/%.6f search %.6f/%.6f seconds", n, times[1], times[0],
+           times[3], times[2]);
+    if (counted)
+      printf(", comparisons per key insert %.2f/%.2f search %.2f/%.2f",
+             compares[1] / (double)n, compares[0] / (double)n,
+             compares[3] / (double)n, compares[2] / (double)n);
+    printf(", ");
+    report_errors(errors);
+
+    tree_delete(plain, NULL);
+    tree_delete(hinted, NULL);
+    free(values);
+  }
+  printf("\n");
+}
+
+/* Multiplicative hash of an int key, high bits folded into the low ones */
+size_t hash_int(const void *key) {
+  uint64_t hash = (uint32_t)*(const int *)key * 0x9e3779b97f4a7c15u;
+  return (size_t)(hash ^ (hash >> 32));
+}
+
+void test_cache() {
+  size_t n = 1000000, lookups = 1000000, changes = 1000;
+  size_t capacities[] = {1024, 16384, 0};
+  int *values = unique_list(n);
+  int *probes = malloc(lookups * sizeof(int));
+  Tree tree = tree_from_sorted(values, n, sizeof(int));
+  Zipf zipf;
+  zipf_init(&zipf, n, 0.99);
+  for (size_t i = 0; i < lookups; i++)
+    probes[i] = values[zipf_next(&zipf)];
+
+  printf("Front cache vs tree_search (%zu Zipfian lookups, n=%zu, seconds):\n", lookups, n);
+  struct timespec start;
+  size_t found = 0;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (size_t i = 0; i < lookups; i++)
+    found += tree_search(tree, &probes[i], compare_int) != NULL;
+  printf("  tree_search %.6f, found=%zu\n", seconds_since(&start), found);
+
+  for (size_t c = 0; c < sizeof(capacities) / sizeof(capacities[0]); c++) {
+    TreeCache cache = tree_cache_new(tree, capacities[c], hash_int, compare_int);
+    found = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; i < lookups; i++)
+      found += tree_cache_search(cache, tree, &probes[i]) != NULL;
+    double time = seconds_since(&start);
+    double hit_rate = tree_cache_hit_rate(cache);
+
+    /* Remove then reinsert hot keys: the cache must answer like the tree,
+       with the same payload pointers */
+    size_t errors = found != lookups;
+    for (size_t i = 0; i < changes; i++)
+      tree_cache_remove(cache, &tree, &probes[i], NULL, sizeof(int));
+    for (size_t i = 0; i < changes; i++)
+      errors += tree_cache_search(cache, tree, &probes[i]) != NULL;
+    for (size_t i = 0; i < changes; i++)
+      tree_cache_insert(cache, &tree, &probes[i], sizeof(int));
+    for (size_t i = 0; i < lookups; i++)
+      errors += tree_cache_search(cache, tree, &probes[i]) !=
+                tree_search(tree, &probes[i], compare_int);
+
+    printf("  %s cache (capacity %zu) %.6f, hit rate %.3f, entries=%zu, ",
+           capacities[c] ? "bounded" : "complete", capacities[c], time, hit_rate,
+           tree_cache_size(cache));
+    report_errors(errors + (tree_size(tree) != n));
+    tree_cache_delete(cache);
+  }
+  printf("\n");
+
+  tree_delete(tree, NULL);
+  free(probes);
+  free(values);
+}
+
+void test_separated() {
+  size_t sizes[] = {10000, 100000, 1000000};
+
+  printf("Out-of-line records vs inline payloads (%zu-byte Hashmap, seconds):\n", sizeof(Hashmap));
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    size_t n = sizes[i];
+    Hashmap *entries = word_list(n);
+    struct timespec start;
+    double inline_times[3], separated_times[3];
+    size_t errors = 0;
+
+    Tree root = NULL;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t j = 0; j < n; j++)
+      tree_insert_sorted(&root, &entries[j], sizeof(Hashmap), compare_dico);
+    inline_times[0] = seconds_since(&start);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t j = 0; j < n; j++)
+      errors += tree_search(root, &entries[j], compare_dico) == NULL;
+    inline_times[1] = seconds_since(&start);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t j = 0; j < n; j++)
+      node_delete(&root, &entries[j], NULL, compare_dico, sizeof(Hashmap));
+    inline_times[2] = seconds_since(&start);
+
+    rb_dico_tree tree;
+    rb_dico_init(&tree);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t j = 0; j < n; j++)
+      rb_dico_insert(&tree, &entries[j]);
+    separated_times[0] = seconds_since(&start);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t j = 0; j < n; j++)
+      errors += rb_dico_search(&tree, &entries[j]) != &entries[j];
+    separated_times[1] = seconds_since(&start);
+    size_t size = rb_dico_size(&tree);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t j = 0; j < n; j++)
+      errors += rb_dico_delete(&tree, &entries[j]) != &entries[j];
+    separated_times[2] = seconds_since(&start);
+
+    printf("  n=%zu insert %.6f/%.6f search %.6f/%.6f delete %.6f/%.6f (out of line/inline)"
+           " node=%zu bytes size=%zu ",
+           n, separated_times[0], inline_times[0], separated_times[1], inline_times[1],
+           separated_times[2], inline_times[2], sizeof(rb_dico_node), size);
+    report_errors(errors + (root != NULL) + (rb_dico_size(&tree) != 0));
+
+    rb_dico_destroy(&tree);
+    free(entries);
+  }
+  printf("\n");
+}
+
+void test_handles() {
+  size_t sizes[] = {1000, 100000, 1000000};
+
+  printf("Erase by handle vs node_delete (shuffled keys, every other key, seconds):\n");
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    size_t n = sizes[i];
+    int *values = unique_list(n);
+    shuffle_list(values, n);
+    Tree *handles = malloc(n * sizeof(Tree));
+    Tree tree = NULL, other = NULL;
+    struct timespec start;
+    size_t errors = 0;
+    bool inserted;
+
+    for (size_t j = 0; j < n; j++) {
+      handles[j] = tree_insert_handle(&tree, &values[j], sizeof(int), compare_int, &inserted);
+      errors += !inserted;
+      tree_insert_sorted(&other, &values[j], sizeof(int), compare_int);
+    }
+    /* A duplicate gets the handle already in the tree */
+    errors += tree_insert_handle(&tree, &values[0], sizeof(int), compare_int, &inserted) != handles[0] ||
+        inserted;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t j = 0; j < n; j += 2)
+      tree_erase_handle(&tree, handles[j], NULL);
+    double erase_time = seconds_since(&start);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t j = 0; j < n; j += 2)
+      node_delete(&other, &values[j], NULL, compare_int, sizeof(int));
+    double delete_time = seconds_since(&start);
+
+    /* The other handles still hold their own keys */
+    for (size_t j = 1; j < n; j += 2)
+      errors += *(int *)tree_get_data(handles[j]) != values[j];
+    errors += tree_size(tree) != n / 2;
+    size_t height = tree_height(tree), other_height = tree_height(other);
+
+    /* Erase while walking: each erasure hands back the next key */
+    size_t walked = 0;
+    int previous = -1;
+    for (Tree node = tree_first(tree); node; node = tree_erase_handle(&tree, node, NULL)) {
+      errors += *(int *)tree_get_data(node) <= previous;
+      previous = *(int *)tree_get_data(node);
+      walked++;
+    }
+    errors += walked != n / 2 || tree != NULL;
+
+    printf("  n=%zu erase %.6f/%.6f (handle/node_delete) height=%zu/%zu, ",
+           n, erase_time, delete_time, height, other_height);
+    report_errors(errors);
+    tree_delete(other, NULL);
+    free(handles);
+    free(values);
+  }
+  printf("\n");
+}
+
 int main() {
   test_int();
   test_hashmap();
-  return 0;
+  test_compact();
+  test_typed();
+  test_from_sorted();
+  test_batch();
+  test_wide();
+  test_concurrent();
+  test_parallel();
+  test_set_operations();
+  test_order_statistics();
+  test_range_queries();
+  test_file();
+  test_stream();
+  test_stats();
+  test_hints();
+  test_cache();
+  test_separated();
+  test_handles();
+  return test_status();
 }
\ No newline at end of file
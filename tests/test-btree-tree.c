@@ -0,0 +1,185 @@
+#include "test.h"
+#include "btree-tree.h"
+
+// Write results to CSV
+#ifdef _WIN32
+const char* result_path_cmd = "mkdir ..\\..\\result 2>nul";
+const char *python_cmd =
+    "python ../../src/plot_results.py ../../result/results_btree.csv btree";
+#else
+const char* result_path_cmd = "mkdir -p ../../result";
+const char *python_cmd =
+    "python3 ../../src/plot_results.py ../../result/results_btree.csv btree";
+#endif
+
+void print_btree_entry(void *data, void *extra_data) {
+    (void)extra_data;
+    printf("  ");
+    print_hashmap(data);
+    printf("\n");
+}
+
+
+void test_int() {
+    size_t sizes[] = {10, 50, 100, 500, 1000, 5000, 10000,
+                  50000, 100000, 500000, 1000000, 5000000, 10000000,
+                  20000000, 50000000, 100000000};
+    Result results[NB_TESTS];
+
+    for (int i = 0; i < NB_TESTS; i++) {
+        size_t n = sizes[i];
+        int *values = unique_list(n);
+        BTree root = NULL;
+
+        results[i].n = n;
+        results[i].insert_time = test_insert_complexity((void **)&root, values, n, (InsertFunc)btree_insert_sorted);
+        results[i].insert_perf = perf_last();
+        results[i].search_time = test_search_complexity((void **)&root, values, n, (SearchFunc)btree_search);
+        results[i].search_perf = perf_last();
+        results[i].delete_time = test_delete_complexity((void **)&root, values, n, (DeleteFunc)btree_node_delete);
+        results[i].delete_perf = perf_last();
+
+        btree_delete(root, NULL);
+        free(values);
+    }
+
+
+    system(result_path_cmd);
+    FILE *f = fopen("../../result/results_btree.csv", "w");
+    fprintf(f, "n,insert_time,search_time,delete_time");
+    perf_csv_header(f, "insert");
+    perf_csv_header(f, "search");
+    perf_csv_header(f, "delete");
+    fprintf(f, "\n");
+    for (int i = 0; i < NB_TESTS; i++) {
+        fprintf(f, "%zu,%.10f,%.10f,%.10f",
+                results[i].n,
+                results[i].insert_time,
+                results[i].search_time,
+                results[i].delete_time);
+        perf_csv_row(f, &results[i].insert_perf);
+        perf_csv_row(f, &results[i].search_perf);
+        perf_csv_row(f, &results[i].delete_perf);
+        fprintf(f, "\n");
+    }
+    fclose(f);
+
+    system(python_cmd);
+}
+
+void test_hashmap() {
+    BTree root = NULL;
+    Hashmap entries[] = {{"cat", "domestic animal"},
+                         {"dog", "man's best friend"},
+                         {"fish", "lives in water"},
+                         {"mouse", "small rodent"},
+                         {"bird", "can fly"}};
+    size_t n = sizeof(entries) / sizeof(entries[0]);
+
+    for (size_t i = 0; i < n; i++) {
+        printf("Inserting value: %s\n", entries[i].word);
+        btree_insert_sorted(&root, &entries[i], sizeof(Hashmap), compare_dico);
+    }
+
+    printf("\nHashmap B+-tree after inserting (height %zu, %zu per leaf):\n",
+           btree_height(root), btree_leaf_capacity(root));
+    btree_in_order(root, print_btree_entry, NULL);
+    printf("\n");
+
+    Hashmap delete_entries[] = {{"dog", ""}, {"mouse", ""}};
+    size_t m = sizeof(delete_entries) / sizeof(delete_entries[0]);
+
+    for (size_t i = 0; i < m; i++) {
+        printf("Deleting value: %s\n", delete_entries[i].word);
+        btree_node_delete(&root, &delete_entries[i], NULL, compare_dico, sizeof(Hashmap));
+    }
+
+    printf("\nHashmap B+-tree after deleting:\n");
+    btree_in_order(root, print_btree_entry, NULL);
+    btree_delete(root, NULL);
+    printf("\n");
+}
+
+
+void test_shape() {
+    size_t sizes[] = {1000, 10000, 100000, 1000000};
+    size_t nb = sizeof(sizes) / sizeof(sizes[0]);
+
+    printf("B+-tree shape (int payload):\n");
+    for (size_t i = 0; i < nb; i++) {
+        size_t n = sizes[i];
+        int *values = unique_list(n);
+        BTree root = NULL;
+
+        for (size_t j = 0; j < n; j++)
+            btree_insert_sorted(&root, &values[j], sizeof(int), compare_int);
+        printf("  n=%zu height=%zu size=%zu (leaf %zu, inner %zu payloads per node)\n",
+               n, btree_height(root), btree_size(root),
+               btree_leaf_capacity(root), btree_inner_capacity(root));
+
+        // Delete every other value, then check what is left
+        for (size_t j = 0; j < n; j += 2)
+            btree_node_delete(&root, &values[j], NULL, compare_int, sizeof(int));
+        size_t found = 0;
+        for (size_t j = 0; j < n; j++)
+            found += btree_search(root, &values[j], compare_int) != NULL;
+        printf("  after deleting half: height=%zu size=%zu found=%zu\n",
+               btree_height(root), btree_size(root), found);
+
+        btree_delete(root, NULL);
+        free(values);
+    }
+    printf("\n");
+}
+
+// Payloads are pointers to strings: 'delete' releases what 'compare' reads
+static int compare_str_ref(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Wipe the string instead of freeing it, so that a separator still
+// reading it misroutes the searches instead of reading freed memory
+static void release_str_ref(void *data) {
+    memset(*(char **)data, 0x7f, 8);
+}
+
+void test_owned() {
+    size_t n = 100000;
+    int *values = unique_list(n);
+    char *strings = malloc(n * 9);
+    BTree root = NULL;
+
+    printf("B+-tree with owned payloads (char *, released on delete):\n");
+    for (size_t j = 0; j < n; j++) {
+        char *s = strings + 9 * j;
+        sprintf(s, "%08d", values[j]);
+        btree_insert_sorted(&root, &s, sizeof(char *), compare_str_ref);
+    }
+
+    // Delete every other string, the others must still be found
+    size_t errors = 0;
+    for (size_t j = 0; j < n; j += 2) {
+        char copy[9], *key = copy;
+        memcpy(copy, strings + 9 * j, 9);
+        btree_node_delete(&root, &key, release_str_ref, compare_str_ref, sizeof(char *));
+    }
+    for (size_t j = 1; j < n; j += 2) {
+        char *key = strings + 9 * j;
+        errors += btree_search(root, &key, compare_str_ref) == NULL;
+    }
+    printf("  n=%zu size=%zu ", n, btree_size(root));
+    report_errors(errors);
+    printf("\n");
+
+    btree_delete(root, release_str_ref);
+    free(strings);
+    free(values);
+}
+
+int main() {
+    test_int();
+    test_hashmap();
+    test_shape();
+    test_owned();
+    return test_status();
+}
@@ -1,4 +1,12 @@
 #include "test.h"
+#include <math.h>
+
+#ifdef TREE_PERF_COUNTERS
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 int *unique_list(const size_t size) {
     int *list = malloc(sizeof(int) * size);
@@ -11,6 +19,232 @@ int *unique_list(const size_t size) {
     return list;
 }
 
+uint64_t next_random(uint64_t *state) {
+    /* xorshift64: rand() is too short for large arrays */
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+void shuffle_list(int *list, size_t size) {
+    uint64_t state = 0x9e3779b97f4a7c15u;
+    for (size_t i = size; i > 1; i--) {
+        size_t j = next_random(&state) % i;
+        int tmp = list[i - 1];
+        list[i - 1] = list[j];
+        list[j] = tmp;
+    }
+}
+
+int *uniform_list(size_t size) {
+    int *list = malloc(sizeof(int) * size);
+    if (!list) return NULL;
+
+    uint64_t state = 0x2545f4914f6cdd1du;
+    for (size_t i = 0; i < size; i++)
+        list[i] = (int)(uint32_t)next_random(&state);
+    return list;
+}
+
+int *clustered_list(size_t size) {
+    int *list = malloc(sizeof(int) * size);
+    if (!list) return NULL;
+
+    uint64_t state = 0x94d049bb133111ebu;
+    int64_t key = 0;
+    for (size_t i = 0; i < size; i++) {
+        key += 1 + next_random(&state) % 4;
+        list[i] = (int)key;
+    }
+    /* Local disorder: swap each key with one of the next 8 */
+    for (size_t i = 0; i + 1 < size; i++) {
+        size_t j = i + 1 + next_random(&state) % 8;
+        if (j < size) {
+            int tmp = list[i];
+            list[i] = list[j];
+            list[j] = tmp;
+        }
+    }
+    for (size_t i = 0; i < size; i++) {
+        if (next_random(&state) % 32 == 0)
+            list[i] = (int)(uint32_t)next_random(&state);
+    }
+    return list;
+}
+
+/* splitmix64 finalizer: a bijection of the 64-bit integers that scatters
+   neighbours, used to spread ranks and to number distinct keys */
+static uint64_t scatter(uint64_t value) {
+    value ^= value >> 30;
+    value *= 0xbf58476d1ce4e5b9u;
+    value ^= value >> 27;
+    value *= 0x94d049bb133111ebu;
+    return value ^ (value >> 31);
+}
+
+Hashmap *word_list(size_t size) {
+    Hashmap *list = malloc(sizeof(Hashmap) * size);
+    if (!list) return NULL;
+
+    for (size_t i = 0; i < size; i++) {
+        snprintf(list[i].word, sizeof(list[i].word), "user%llu",
+                 (unsigned long long)scatter(i));
+        snprintf(list[i].definition, sizeof(list[i].definition), "record %zu", i);
+    }
+    return list;
+}
+
+static double zeta(size_t items, double theta) {
+    double sum = 0;
+    for (size_t i = 1; i <= items; i++)
+        sum += 1.0 / pow((double)i, theta);
+    return sum;
+}
+
+void zipf_init(Zipf *zipf, size_t items, double theta) {
+    zipf->items = items;
+    zipf->theta = theta;
+    zipf->alpha = 1.0 / (1.0 - theta);
+    zipf->zetan = zeta(items, theta);
+    zipf->eta = (1.0 - pow(2.0 / items, 1.0 - theta)) / (1.0 - zeta(2, theta) / zipf->zetan);
+    zipf->state = 0xbf58476d1ce4e5b9u;
+}
+
+size_t zipf_next(Zipf *zipf) {
+    /* Gray et al., "Quickly generating billion-record synthetic databases" */
+    double u = (next_random(&zipf->state) >> 11) * (1.0 / 9007199254740992.0);
+    double uz = u * zipf->zetan;
+    size_t rank;
+    if (uz < 1.0)
+        rank = 0;
+    else if (uz < 1.0 + pow(0.5, zipf->theta))
+        rank = 1;
+    else
+        rank = (size_t)(zipf->items * pow(zipf->eta * u - zipf->eta + 1.0, zipf->alpha));
+    if (rank >= zipf->items)
+        rank = zipf->items - 1;
+    return scatter(rank) % zipf->items;
+}
+
+static PerfCounts perf_counts = {{NAN, NAN, NAN, NAN, NAN, NAN}};
+
+#ifdef TREE_PERF_COUNTERS
+static const char *const perf_names[PERF_COUNTERS] = {
+    "cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses", "dtlb_misses"
+};
+
+#define CACHE_READ_MISS(cache) \
+    ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static const struct {
+    uint32_t type;
+    uint64_t config;
+} perf_events[PERF_COUNTERS] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HW_CACHE, CACHE_READ_MISS(PERF_COUNT_HW_CACHE_L1D)},
+    {PERF_TYPE_HW_CACHE, CACHE_READ_MISS(PERF_COUNT_HW_CACHE_LL)},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {PERF_TYPE_HW_CACHE, CACHE_READ_MISS(PERF_COUNT_HW_CACHE_DTLB)},
+};
+
+/* One descriptor per counter, -1 when unavailable. They are not grouped:
+   a group larger than the PMU would never be scheduled, single counters
+   are multiplexed and scaled instead. */
+static int perf_fds[PERF_COUNTERS];
+static bool perf_opened = false;
+
+static void perf_open(void) {
+    bool any = false;
+    for (int i = 0; i < PERF_COUNTERS; i++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = perf_events[i].type;
+        attr.config = perf_events[i].config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        perf_fds[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        any |= perf_fds[i] >= 0;
+    }
+    if (!any)
+        fprintf(stderr, "perf_event_open: no hardware counter available, the counts are nan\n");
+    perf_opened = true;
+}
+#endif
+
+void perf_start(void) {
+#ifdef TREE_PERF_COUNTERS
+    if (!perf_opened)
+        perf_open();
+    for (int i = 0; i < PERF_COUNTERS; i++) {
+        if (perf_fds[i] >= 0) {
+            ioctl(perf_fds[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(perf_fds[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+#endif
+}
+
+void perf_stop(size_t operations) {
+#ifdef TREE_PERF_COUNTERS
+    for (int i = 0; i < PERF_COUNTERS; i++) {
+        perf_counts.value[i] = NAN;
+        if (perf_fds[i] < 0)
+            continue;
+        ioctl(perf_fds[i], PERF_EVENT_IOC_DISABLE, 0);
+        /* value, time enabled, time running */
+        uint64_t read_values[3];
+        if (read(perf_fds[i], read_values, sizeof(read_values)) != sizeof(read_values) ||
+            read_values[2] == 0 || operations == 0)
+            continue;
+        /* Scale up when the counter shared the PMU with others */
+        double count = (double)read_values[0] * ((double)read_values[1] / (double)read_values[2]);
+        perf_counts.value[i] = count / (double)operations;
+    }
+#else
+    (void)operations;
+#endif
+}
+
+PerfCounts perf_last(void) {
+    return perf_counts;
+}
+
+void perf_csv_header(FILE *f, const char *prefix) {
+#ifdef TREE_PERF_COUNTERS
+    for (int i = 0; i < PERF_COUNTERS; i++)
+        fprintf(f, ",%s_%s", prefix, perf_names[i]);
+#else
+    (void)f;
+    (void)prefix;
+#endif
+}
+
+void perf_csv_row(FILE *f, const PerfCounts *counts) {
+#ifdef TREE_PERF_COUNTERS
+    for (int i = 0; i < PERF_COUNTERS; i++)
+        fprintf(f, ",%.4f", counts->value[i]);
+#else
+    (void)f;
+    (void)counts;
+#endif
+}
+
+static size_t total_errors = 0;
+
+void report_errors(size_t errors) {
+    printf("errors=%zu\n", errors);
+    total_errors += errors;
+}
+
+int test_status(void) {
+    return total_errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
 int compare_int(const void *a, const void *b) {
     const int va = *(int *)a;
     const int vb = *(int *)b;
@@ -34,6 +268,7 @@ void print_hashmap(void *data) {
 
 double test_insert_complexity(void **root, int *values, size_t n, InsertFunc insert) {
     struct timespec start, end;
+    perf_start();
     clock_gettime(CLOCK_MONOTONIC, &start);
 
     for (size_t i = 0; i < n; i++) {
@@ -41,6 +276,7 @@ double test_insert_complexity(void **root, int *values, size_t n, InsertFunc ins
     }
 
     clock_gettime(CLOCK_MONOTONIC, &end);
+    perf_stop(n);
 
     return (end.tv_sec - start.tv_sec) +
            (end.tv_nsec - start.tv_nsec) * 1e-9;
@@ -48,6 +284,7 @@ double test_insert_complexity(void **root, int *values, size_t n, InsertFunc ins
 
 double test_delete_complexity(void **root, int *values, size_t n, DeleteFunc del) {
     struct timespec start, end;
+    perf_start();
     clock_gettime(CLOCK_MONOTONIC, &start);
 
     for (size_t i = 0; i < n; i++) {
@@ -55,6 +292,7 @@ double test_delete_complexity(void **root, int *values, size_t n, DeleteFunc del
     }
 
     clock_gettime(CLOCK_MONOTONIC, &end);
+    perf_stop(n);
 
     return (end.tv_sec - start.tv_sec) +
            (end.tv_nsec - start.tv_nsec) * 1e-9;
@@ -62,6 +300,7 @@ double test_delete_complexity(void **root, int *values, size_t n, DeleteFunc del
 
 double test_search_complexity(void **root, int *values, size_t n, SearchFunc search) {
     struct timespec start, end;
+    perf_start();
     clock_gettime(CLOCK_MONOTONIC, &start);
 
     for (size_t i = 0; i < n; i++) {
@@ -70,9 +309,62 @@ double test_search_complexity(void **root, int *values, size_t n, SearchFunc sea
     }
 
     clock_gettime(CLOCK_MONOTONIC, &end);
+    perf_stop(n);
 
     return (end.tv_sec - start.tv_sec) +
            (end.tv_nsec - start.tv_nsec) * 1e-9;
 }
 
+double test_insert_batch_complexity(void **root, int *values, size_t n, size_t batch,
+                                    InsertBatchFunc insert) {
+    struct timespec start, end;
+    perf_start();
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (size_t i = 0; i < n; i += batch) {
+        size_t count = (n - i < batch) ? n - i : batch;
+        insert(root, &values[i], count, sizeof(int), compare_int, NULL);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    perf_stop(n);
 
+    return (end.tv_sec - start.tv_sec) +
+           (end.tv_nsec - start.tv_nsec) * 1e-9;
+}
+
+double test_delete_batch_complexity(void **root, int *values, size_t n, size_t batch,
+                                    DeleteBatchFunc del) {
+    struct timespec start, end;
+    perf_start();
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (size_t i = 0; i < n; i += batch) {
+        size_t count = (n - i < batch) ? n - i : batch;
+        del(root, &values[i], count, sizeof(int), NULL, compare_int, NULL);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    perf_stop(n);
+
+    return (end.tv_sec - start.tv_sec) +
+           (end.tv_nsec - start.tv_nsec) * 1e-9;
+}
+
+double test_search_batch_complexity(void **root, int *values, size_t n, size_t batch,
+                                    SearchBatchFunc search) {
+    struct timespec start, end;
+    perf_start();
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (size_t i = 0; i < n; i += batch) {
+        size_t count = (n - i < batch) ? n - i : batch;
+        search(*root, &values[i], count, sizeof(int), compare_int, NULL);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    perf_stop(n);
+
+    return (end.tv_sec - start.tv_sec) +
+           (end.tv_nsec - start.tv_nsec) * 1e-9;
+}